@@ -9,10 +9,13 @@
 #include "mfcb/mfcb.h"
 #include "third-party/blt/blt.h"
 #include "pcb.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 /** Number of iterations to do. */
@@ -40,14 +43,409 @@
 #define BLT_SUITE_NUM_SEQ_KEYS 2000000
 
 
-/** Gets a timestamp of the process time.
+/** Long prefix suite number of keys. */
+#define LP_SUITE_NUM_KEYS 200000
+
+
+/** Long prefix suite shared prefix (90 bytes). */
+#define LP_SUITE_PREFIX "http://www.example.com/a/rather/deep/path/that/every/key/shares/before/the/unique/part/id="
+
+
+/** Routing table suite number of IPv4 prefixes. */
+#define RT_SUITE_NUM_PREFIXES 500000
+
+
+/** Routing table suite number of IPv4 address lookups. */
+#define RT_SUITE_NUM_LOOKUPS 1000000
+
+
+/** Routing table suite entry (an IPv4 prefix or address as a bit string). */
+typedef struct
+{
+    char addr[4];
+    size_t num_bits;
+} pcbb_rt_entry_t;
+
+
+#if BENCH_PCB
+/** Saves a PCB to a file.
+ *
+ *  \param t PCB.
+ *  \param path File path.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _save_pcb(const pcb_t *t, const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+    int ok = pcb_save(t, fd);
+    return close(fd) == 0 && ok;
+}
+
+
+/** Evicts a file from the page cache, so that the next access is cold.
+ *
+ *  \param path File path.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _evict_file(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    int ok = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    return close(fd) == 0 && ok;
+}
+
+
+/** Reader threads shared state. */
+typedef struct
+{
+    /** PCB. */
+    pcb_t *t;
+
+    /** Keys to look up. */
+    char **keys;
+
+    /** Number of keys. */
+    size_t num_keys;
+
+    /** Next key to be looked up by any thread. */
+    size_t next_key;
+
+    /** Number of reader threads still running. */
+    size_t num_running;
+
+    /** Number of keys found. */
+    size_t num_found;
+
+} pcbb_readers_t;
+
+
+/** Looks up blocks of 1024 keys until none is left, each one in a read
+ *  section.
+ *
+ *  \param arg Reader threads shared state.
+ *  \return \c NULL.
+ */
+static void *_reader_thread(void *arg)
+{
+    pcbb_readers_t *rs = arg;
+    pcb_reader_t *r = pcb_reader_create(rs->t);
+    size_t num_found = 0;
+    for (size_t i; r != NULL && (i = __atomic_fetch_add(&rs->next_key, 1024, __ATOMIC_RELAXED)) < rs->num_keys; )
+    {
+        size_t end = rs->num_keys - i < 1024 ? rs->num_keys : i + 1024;
+        pcb_read_begin(r);
+        for (size_t j = i; j < end; j++)
+            num_found += pcb_in(rs->t, rs->keys[j]);
+        pcb_read_end(r);
+    }
+    if (r != NULL)
+        pcb_reader_destroy(r);
+    __atomic_add_fetch(&rs->num_found, num_found, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&rs->num_running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+
+/** Looks up all the keys of a PCB from several reader threads, while this
+ *  thread keeps adding and deleting other keys.
+ *
+ *  \param t PCB.
+ *  \param keys Keys to look up (split among the threads).
+ *  \param num_keys Number of keys.
+ *  \param num_threads Number of reader threads.
+ *  \return Number of keys found.
+ */
+static size_t _read_pcb_threaded(pcb_t *t, char **keys, size_t num_keys, size_t num_threads)
+{
+    pthread_t threads[64];
+    pcbb_readers_t rs = { t, keys, num_keys, 0, num_threads, 0 };
+    size_t num_started = 0;
+    while (num_started < num_threads && num_started < 64 &&
+           pthread_create(&threads[num_started], NULL, _reader_thread, &rs) == 0)
+        num_started++;
+    __atomic_sub_fetch(&rs.num_running, num_threads - num_started, __ATOMIC_RELEASE);
+
+    /* the writer churns keys that are not being looked up */
+    char key[32];
+    while (__atomic_load_n(&rs.num_running, __ATOMIC_ACQUIRE) > 0)
+    {
+        for (size_t i = 0; i < 1024; i++)
+        {
+            snprintf(key, sizeof(key), "w%zu", i);
+            pcb_add(t, key);
+        }
+        for (size_t i = 0; i < 1024; i++)
+        {
+            snprintf(key, sizeof(key), "w%zu", i);
+            pcb_rem(t, key);
+        }
+    }
+    for (size_t i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+    return rs.num_found;
+}
+
+
+/** Number of shards used by the sharded PCB benchmark. */
+#define PCBB_NUM_SHARDS 64
+
+
+/** Writer threads shared state. */
+typedef struct
+{
+    /** Sharded PCB (\c NULL to add concurrently to \c t). */
+    pcb_sharded_t *st;
+
+    /** PCB. */
+    pcb_t *t;
+
+    /** Keys to add. */
+    char **keys;
+
+    /** Number of keys. */
+    size_t num_keys;
+
+    /** Next key to be added by any thread. */
+    size_t next_key;
+
+} pcbb_writers_t;
+
+
+/** Adds blocks of 1024 keys until none is left.
  *
- *  \return Timestamp of the process time.
+ *  \param arg Writer threads shared state.
+ *  \return \c NULL.
+ */
+static void *_writer_thread(void *arg)
+{
+    pcbb_writers_t *ws = arg;
+    for (size_t i; (i = __atomic_fetch_add(&ws->next_key, 1024, __ATOMIC_RELAXED)) < ws->num_keys; )
+    {
+        size_t end = ws->num_keys - i < 1024 ? ws->num_keys : i + 1024;
+        for (size_t j = i; j < end; j++)
+        {
+            if (ws->st != NULL)
+                pcb_sharded_add(ws->st, ws->keys[j]);
+            else
+                pcb_add_concurrent(ws->t, ws->keys[j]);
+        }
+    }
+    return NULL;
+}
+
+
+/** Runs writer threads until all the keys are added.
+ *
+ *  \param ws Writer threads shared state.
+ *  \param num_threads Number of writer threads.
+ */
+static void _run_writers(pcbb_writers_t *ws, size_t num_threads)
+{
+    pthread_t threads[64];
+    size_t num_started = 0;
+    while (num_started < num_threads && num_started < 64 &&
+           pthread_create(&threads[num_started], NULL, _writer_thread, ws) == 0)
+        num_started++;
+    if (num_started == 0)
+        _writer_thread(ws);
+    for (size_t i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+
+/** Compares two keys, for qsort().
+ *
+ *  \param p Pointer to the first key.
+ *  \param q Pointer to the second key.
+ *  \return Comparison result.
+ */
+static int _key_cmp(const void *p, const void *q)
+{
+    return strcmp(*(char *const *)p, *(char *const *)q);
+}
+
+
+/** Counts a key.
+ *
+ *  \param s Key (ignored).
+ *  \param ctx Key count.
+ *  \return Always 1, to keep the iteration.
+ */
+static int _count_key_cb(const char *s, void *ctx)
+{
+    (void)s;
+    (*(size_t *)ctx)++;
+    return 1;
+}
+
+
+/** Adds all the keys to a new sharded PCB from several writer threads.
+ *
+ *  \param keys Keys to add (split among the threads).
+ *  \param num_keys Number of keys.
+ *  \param num_threads Number of writer threads.
+ *  \return Number of keys in the sharded PCB.
+ *  \note The shard splits are the quantiles of a sample of the keys.
+ */
+static size_t _add_sharded_threaded(char **keys, size_t num_keys, size_t num_threads)
+{
+    /* chooses the splits */
+    char *sample[PCBB_NUM_SHARDS * 16];
+    const char *splits[PCBB_NUM_SHARDS - 1];
+    size_t sample_size = num_keys < PCBB_NUM_SHARDS * 16 ? num_keys : PCBB_NUM_SHARDS * 16;
+    if (sample_size < PCBB_NUM_SHARDS)
+        return 0;
+    for (size_t i = 0; i < sample_size; i++)
+        sample[i] = keys[i * (num_keys / sample_size)];
+    qsort(sample, sample_size, sizeof(sample[0]), _key_cmp);
+    size_t num_splits = 0;
+    for (size_t i = 1; i < PCBB_NUM_SHARDS; i++)
+    {
+        const char *split = sample[i * sample_size / PCBB_NUM_SHARDS];
+        if (num_splits == 0 || strcmp(splits[num_splits - 1], split) < 0)
+            splits[num_splits++] = split;
+    }
+
+    /* adds the keys */
+    pcbb_writers_t ws = { pcb_sharded_create(num_splits + 1, splits), NULL, keys, num_keys, 0 };
+    if (ws.st == NULL)
+        return 0;
+    _run_writers(&ws, num_threads);
+
+    /* counts them */
+    size_t count = 0;
+    pcb_sharded_find_suffixes(ws.st, "", _count_key_cb, &count);
+    pcb_sharded_destroy(ws.st);
+    return count;
+}
+
+
+/** Builds a PCB with all the keys using several threads.
+ *
+ *  \param keys Keys to add.
+ *  \param num_keys Number of keys.
+ *  \param num_threads Number of threads.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _build_pcb_parallel(char **keys, size_t num_keys, size_t num_threads)
+{
+    pcb_t *t = pcb_build_parallel((const char *const *)keys, num_keys, num_threads);
+    if (t == NULL)
+        return 0;
+    pcb_destroy(t);
+    return 1;
+}
+
+
+/** Counts a key from a parallel scan.
+ *
+ *  \param s Key.
+ *  \param chunk Chunk containing the key.
+ *  \param ctx Per thread key counter.
+ *  \return 1.
+ */
+static int _count_chunk_key_cb(const char *s, size_t chunk, void *ctx)
+{
+    (void)s;
+    (void)chunk;
+    (*(size_t *)ctx)++;
+    return 1;
+}
+
+
+/** Iterates over all the keys in a PCB using several threads.
+ *
+ *  \param t PCB.
+ *  \param num_threads Number of threads.
+ *  \return Number of keys visited.
+ */
+static size_t _all_suffixes_pcb_parallel(const pcb_t *t, size_t num_threads)
+{
+    /* keeps the per thread counters in different cache lines */
+    size_t counts[8][8] = { { 0 } };
+    void *ctxs[8];
+    for (size_t i = 0; i < 8; i++)
+        ctxs[i] = counts[i];
+    if (num_threads > 8)
+        num_threads = 8;
+    pcb_find_suffixes_parallel(t, "", _count_chunk_key_cb, ctxs, num_threads, 0);
+    size_t count = 0;
+    for (size_t i = 0; i < num_threads; i++)
+        count += counts[i][0];
+    return count;
+}
+
+
+/** Adds all the keys to a new PCB from several lock-free writer threads.
+ *
+ *  \param keys Keys to add (split among the threads).
+ *  \param num_keys Number of keys.
+ *  \param num_threads Number of writer threads.
+ *  \return Number of keys in the PCB.
+ */
+static size_t _add_concurrent_threaded(char **keys, size_t num_keys, size_t num_threads)
+{
+    pcbb_writers_t ws = { NULL, pcb_create(), keys, num_keys, 0 };
+    if (ws.t == NULL)
+        return 0;
+    _run_writers(&ws, num_threads);
+    size_t count = 0;
+    pcb_find_suffixes(ws.t, "", _count_key_cb, &count);
+    pcb_destroy(ws.t);
+    return count;
+}
+
+
+/** Adds a bit string to a PCB, encoded as a key by pcb_bits_key().
+ *
+ *  \param t PCB.
+ *  \param bits Bit string (at most 32 bits).
+ *  \param num_bits Number of bits in \a bits.
+ *  \return See pcb_add_len().
+ */
+static int _add_bits_pcb(pcb_t *t, const char *bits, size_t num_bits)
+{
+    char key[6];
+    return pcb_add_len(t, key, pcb_bits_key(key, bits, num_bits));
+}
+
+
+/** Checks if a bit string, encoded as a key by pcb_bits_key(), is in a PCB.
+ *
+ *  \param t PCB.
+ *  \param bits Bit string (at most 32 bits).
+ *  \param num_bits Number of bits in \a bits.
+ *  \return See pcb_in_len().
+ */
+static int _in_bits_pcb(const pcb_t *t, const char *bits, size_t num_bits)
+{
+    char key[6];
+    return pcb_in_len(t, key, pcb_bits_key(key, bits, num_bits));
+}
+#endif
+
+
+/** Clock used by the timers (process time, unless measuring threads). */
+static clockid_t _timer_clock = CLOCK_PROCESS_CPUTIME_ID;
+
+
+/** Number of online cores (thread phases needing more are skipped, as they
+ *  would only measure scheduling). */
+static size_t _num_cores = 1;
+
+
+/** Gets a timestamp of the timer clock.
+ *
+ *  \return Timestamp of the timer clock.
  */
 static unsigned long long _get_timestamp(void)
 {
     struct timespec t;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    clock_gettime(_timer_clock, &t);
     return t.tv_sec * 1000000000ull + t.tv_nsec;
 }
 
@@ -86,18 +484,100 @@ static void _init_blt_suite_keys(size_t *blt_suite_num_keys, char ***blt_suite_k
 }
 
 
-/** Releases the BLT suite keys.
+/** Initializes the long prefix suite keys (100 bytes, sharing the first 90).
+ *
+ *  \param lp_suite_num_keys Number of long prefix suite keys (output).
+ *  \param lp_suite_keys Long prefix suite keys (output).
+ */
+static void _init_lp_suite_keys(size_t *lp_suite_num_keys, char ***lp_suite_keys)
+{
+    /* loads the keys */
+    char key[256];
+    *lp_suite_num_keys = LP_SUITE_NUM_KEYS;
+    *lp_suite_keys = malloc(LP_SUITE_NUM_KEYS * sizeof(char *));
+    for (size_t i = 0; i < LP_SUITE_NUM_KEYS; i++)
+    {
+        snprintf(key, sizeof(key), "%s%010zu", LP_SUITE_PREFIX, i * 7919 % LP_SUITE_NUM_KEYS);
+        (*lp_suite_keys)[i] = malloc(strlen(key) + 1);
+        strcpy((*lp_suite_keys)[i], key);
+    }
+}
+
+
+/** Initializes the routing table suite (random IPv4 prefixes, mostly /24,
+ *  and addresses to look up, half of them inside some prefix).
  *
- *  \param blt_suite_num_keys Number of BLT suite keys (input/output).
- *  \param blt_suite_keys BLT suite keys (input/output).
+ *  \param rt_suite_prefixes Routing table suite prefixes (output).
+ *  \param rt_suite_lookups Routing table suite addresses (output).
  */
-static void _release_blt_suite_keys(size_t *blt_suite_num_keys, char ***blt_suite_keys)
+static void _init_rt_suite(pcbb_rt_entry_t **rt_suite_prefixes, pcbb_rt_entry_t **rt_suite_lookups)
 {
-    for (size_t i = 0; i < *blt_suite_num_keys; i++)
-        free((*blt_suite_keys)[i]);
-    free(*blt_suite_keys);
-    *blt_suite_keys = NULL;
-    *blt_suite_num_keys = 0;
+    /* generates the prefixes with the host bits cleared */
+    srand(4321);
+    *rt_suite_prefixes = malloc(RT_SUITE_NUM_PREFIXES * sizeof(pcbb_rt_entry_t));
+    for (size_t i = 0; i < RT_SUITE_NUM_PREFIXES; i++)
+    {
+        pcbb_rt_entry_t *e = &(*rt_suite_prefixes)[i];
+        unsigned long addr = ((unsigned long)rand() << 16 ^ (unsigned long)rand()) & 0xFFFFFFFFul;
+        e->num_bits = rand() % 10 < 6 ? 24 : 8 + rand() % 25;
+        addr &= 0xFFFFFFFFul << (32 - e->num_bits);
+        for (size_t j = 0; j < 4; j++)
+            e->addr[j] = (char)(addr >> (24 - 8 * j));
+    }
+
+    /* generates the addresses, alternating random ones and prefix members */
+    *rt_suite_lookups = malloc(RT_SUITE_NUM_LOOKUPS * sizeof(pcbb_rt_entry_t));
+    for (size_t i = 0; i < RT_SUITE_NUM_LOOKUPS; i++)
+    {
+        pcbb_rt_entry_t *e = &(*rt_suite_lookups)[i];
+        unsigned long addr = ((unsigned long)rand() << 16 ^ (unsigned long)rand()) & 0xFFFFFFFFul;
+        if (i % 2 == 1)
+        {
+            const pcbb_rt_entry_t *p = &(*rt_suite_prefixes)[rand() % RT_SUITE_NUM_PREFIXES];
+            for (size_t j = 0; j < 4; j++)
+                e->addr[j] = (char)(addr >> (24 - 8 * j));
+            for (size_t j = 0; j < p->num_bits; j++)
+            {
+                char mask = (char)(0x80u >> (j % 8));
+                e->addr[j / 8] = (char)((e->addr[j / 8] & ~mask) | (p->addr[j / 8] & mask));
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < 4; j++)
+                e->addr[j] = (char)(addr >> (24 - 8 * j));
+        }
+        e->num_bits = 32;
+    }
+}
+
+
+/** Releases the routing table suite.
+ *
+ *  \param rt_suite_prefixes Routing table suite prefixes (input/output).
+ *  \param rt_suite_lookups Routing table suite addresses (input/output).
+ */
+static void _release_rt_suite(pcbb_rt_entry_t **rt_suite_prefixes, pcbb_rt_entry_t **rt_suite_lookups)
+{
+    free(*rt_suite_prefixes);
+    free(*rt_suite_lookups);
+    *rt_suite_prefixes = NULL;
+    *rt_suite_lookups = NULL;
+}
+
+
+/** Releases a key suite.
+ *
+ *  \param num_keys Number of keys (input/output).
+ *  \param keys Keys (input/output).
+ */
+static void _release_suite_keys(size_t *num_keys, char ***keys)
+{
+    for (size_t i = 0; i < *num_keys; i++)
+        free((*keys)[i]);
+    free(*keys);
+    *keys = NULL;
+    *num_keys = 0;
 }
 
 
@@ -127,11 +607,26 @@ int main(void)
     #define PCBB_TIMER_GEN_END(test_str, timer_str)\
         do { printf("%s %llu\n", test_str "_" timer_str, _get_timestamp() - start); } while(0)
 
+    /* counts the cores */
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cores > 1)
+        _num_cores = (size_t)num_cores;
+
     /* BLT suite keys */
     size_t blt_suite_num_keys = 0;
     char **blt_suite_keys = NULL;
     _init_blt_suite_keys(&blt_suite_num_keys, &blt_suite_keys);
 
+    /* long prefix suite keys */
+    size_t lp_suite_num_keys = 0;
+    char **lp_suite_keys = NULL;
+    _init_lp_suite_keys(&lp_suite_num_keys, &lp_suite_keys);
+
+    /* routing table suite */
+    pcbb_rt_entry_t *rt_suite_prefixes = NULL;
+    pcbb_rt_entry_t *rt_suite_lookups = NULL;
+    _init_rt_suite(&rt_suite_prefixes, &rt_suite_lookups);
+
     /* iterates all tests many times */
     for (size_t i = 0; i < NUM_ITERS; i++)
     {
@@ -199,14 +694,38 @@ int main(void)
         #define PCBB_CB_IT_DEF(id) const char *id = NULL
         #define PCBB_CB_CB_FUNC_DEF(id, f) int (*id)(const char *, void *) = (int (*)(const char *, void *))f
         #define PCBB_CB_INIT(id) id = pcb_create()
-        #define PCBB_CB_ADD(id, s) pcb_add(&id, s)
+        #define PCBB_CB_ADD(id, s) pcb_add(id, s)
         #define PCBB_CB_GET(id, s) pcb_in(id, s)
+        #define PCBB_CB_GET_BATCH(id, keys, n, results) pcb_in_batch(id, keys, n, results)
+        #define PCBB_CB_READ_THREADS(id, n) _read_pcb_threaded(id, blt_suite_keys, blt_suite_num_keys, n)
+        #define PCBB_CB_ADD_THREADS(n) _add_sharded_threaded(blt_suite_keys, blt_suite_num_keys, n)
+        #define PCBB_CB_ADD_CONCURRENT_THREADS(keys, num_keys, n) _add_concurrent_threaded(keys, num_keys, n)
+        #define PCBB_CB_BUILD_THREADS(n) _build_pcb_parallel(blt_suite_keys, blt_suite_num_keys, n)
+        #define PCBB_CB_FREEZE
+        #define PCBB_CB_FREEZE_DEF(id, cb) pcb_frozen_t *id = pcb_freeze(cb)
+        #define PCBB_CB_FROZEN_GET(id, s) pcb_frozen_in(id, s)
+        #define PCBB_CB_FROZEN_RELEASE(id) pcb_frozen_destroy(id)
+        #define PCBB_CB_SAVE(id, path) _save_pcb(id, path)
+        #define PCBB_CB_OPEN_DEF(id, path) pcb_frozen_t *id = pcb_open_mmap(path)
+        #define PCBB_CB_EVICT(path) _evict_file(path)
         #define PCBB_CB_FIRST(id) pcb_find_next(id, "")
         #define PCBB_CB_NEXT(id, it) pcb_find_next(id, it)
+        #define PCBB_CB_CURSOR_DEF(id, cb) pcb_cursor_t *id = pcb_cursor_create(cb)
+        #define PCBB_CB_CURSOR_FIRST(id) pcb_cursor_first(id)
+        #define PCBB_CB_CURSOR_NEXT(id) pcb_cursor_next(id)
+        #define PCBB_CB_CURSOR_RELEASE(id) pcb_cursor_destroy(id)
         #define PCBB_CB_ALL_SUFFIXES(id, s, cb) pcb_find_suffixes(id, s, cb, NULL)
+        #define PCBB_CB_ALL_SUFFIXES_THREADS(id, n) _all_suffixes_pcb_parallel(id, n)
         #define PCBB_CB_DELETE(id, s) pcb_rem(id, s)
+        #define PCBB_CB_ADD_BITS(id, bits, n) _add_bits_pcb(id, bits, n)
+        #define PCBB_CB_GET_BITS(id, bits, n) _in_bits_pcb(id, bits, n)
+        #define PCBB_CB_LONGEST_PREFIX_BITS(id, bits, n) pcb_longest_prefix_bits(id, bits, n, NULL)
         #define PCBB_CB_RELEASE(id) pcb_destroy(id)
+        #if PCB_COMPACT_NODES
+        #define PCBB_TIMER_END(timer_str) PCBB_TIMER_GEN_END("pcb_compact", timer_str)
+        #else
         #define PCBB_TIMER_END(timer_str) PCBB_TIMER_GEN_END("pcb", timer_str)
+        #endif
         #include "benchmark.inc"
         #undef PCBB_CB_DEF
         #undef PCBB_CB_IT_DEF
@@ -214,15 +733,37 @@ int main(void)
         #undef PCBB_CB_INIT
         #undef PCBB_CB_ADD
         #undef PCBB_CB_GET
+        #undef PCBB_CB_GET_BATCH
+        #undef PCBB_CB_READ_THREADS
+        #undef PCBB_CB_ADD_THREADS
+        #undef PCBB_CB_ADD_CONCURRENT_THREADS
+        #undef PCBB_CB_BUILD_THREADS
+        #undef PCBB_CB_FREEZE
+        #undef PCBB_CB_FREEZE_DEF
+        #undef PCBB_CB_FROZEN_GET
+        #undef PCBB_CB_FROZEN_RELEASE
+        #undef PCBB_CB_SAVE
+        #undef PCBB_CB_OPEN_DEF
+        #undef PCBB_CB_EVICT
         #undef PCBB_CB_FIRST
         #undef PCBB_CB_NEXT
+        #undef PCBB_CB_CURSOR_DEF
+        #undef PCBB_CB_CURSOR_FIRST
+        #undef PCBB_CB_CURSOR_NEXT
+        #undef PCBB_CB_CURSOR_RELEASE
         #undef PCBB_CB_ALL_SUFFIXES
+        #undef PCBB_CB_ALL_SUFFIXES_THREADS
         #undef PCBB_CB_DELETE
+        #undef PCBB_CB_ADD_BITS
+        #undef PCBB_CB_GET_BITS
+        #undef PCBB_CB_LONGEST_PREFIX_BITS
         #undef PCBB_CB_RELEASE
         #undef PCBB_TIMER_END
         #endif
     }
 
-    /* releases the BLT suite keys */
-    _release_blt_suite_keys(&blt_suite_num_keys, &blt_suite_keys);
+    /* releases the suite keys */
+    _release_suite_keys(&blt_suite_num_keys, &blt_suite_keys);
+    _release_suite_keys(&lp_suite_num_keys, &lp_suite_keys);
+    _release_rt_suite(&rt_suite_prefixes, &rt_suite_lookups);
 }
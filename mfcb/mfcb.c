@@ -26,10 +26,14 @@ typedef struct
  *
  *  \param s Source string.
  *  \return Copy of \a s in dynamically allocated memory.
+ *  \note The copy is zero padded to a multiple of 8 bytes, so it can be
+ *        compared a word at a time.
  */
 static char *_strdup(const char *s)
 {
-    char *ret = malloc(strlen(s) + 1);
+    size_t num_words = strlen(s) / sizeof(uint64_t) + 1;
+    char *ret = malloc(num_words * sizeof(uint64_t));
+    memset(ret + (num_words - 1) * sizeof(uint64_t), 0, sizeof(uint64_t));
     strcpy(ret, s);
     return ret;
 }
@@ -85,17 +89,33 @@ static int _get_direction(const mfcb_node_t *p, const char *s, size_t s_len)
 
 /** Gets the position of the critical bit.
  *
- *  \param s1 First string to compare.
+ *  \param s1 First string to compare (allocated by _strdup()).
  *  \param s2 Second string to compare.
+ *  \param s2_len Length of \a s2.
  *  \return Position of the critical bit.
  *  \note The strings must be different.
  */
-static size_t _get_critbit_pos(const char *s1, const char *s2)
+static size_t _get_critbit_pos(const char *s1, const char *s2, size_t s2_len)
 {
-    size_t critbit_pos = 0;
-    while (((s1[critbit_pos >> 3] ^ s2[critbit_pos >> 3]) & (1 << (7 - (critbit_pos & 7)))) == 0)
-        critbit_pos++;
-    return critbit_pos;
+    /* compares a word at a time while s2 has full words; as long as they
+       match, s1 has no NUL yet and its padding covers the next word */
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= s2_len; i += sizeof(uint64_t))
+    {
+        uint64_t w1, w2;
+        memcpy(&w1, s1 + i, sizeof(w1));
+        memcpy(&w2, s2 + i, sizeof(w2));
+        if (w1 != w2)
+            break;
+    }
+
+    /* finishes byte by byte (the NUL terminator of s2 stops the loop) */
+    while (s1[i] == s2[i])
+        i++;
+
+    /* the first differing bit is given by the leading zeros */
+    unsigned x = (unsigned char)(s1[i] ^ s2[i]);
+    return i * CHAR_BIT + (size_t)(__builtin_clz(x) - (sizeof(unsigned) * CHAR_BIT - 8));
 }
 
 
@@ -199,7 +219,7 @@ int mfcb_add(mfcb_t *t, const char *s)
         return 0;
 
     /* if it doesn't match, we have a critical bit that differs */
-    size_t critbit_pos = _get_critbit_pos((const char *)p, (const char *)s);
+    size_t critbit_pos = _get_critbit_pos((const char *)p, s, s_len);
 
     /* redoes the search to see which pointer to update */
     intptr_t *pp = &t->root;
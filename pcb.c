@@ -4,16 +4,55 @@
  *  \copyright MIT License.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "pcb.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+    #include <immintrin.h>
+    /** Whether the AVX2 comparison kernel can be selected at runtime. */
+    #define PCB_HAS_AVX2_KERNEL 1
+#else
+    #define PCB_HAS_AVX2_KERNEL 0
+#endif
+
+
+#ifndef PCB_SEGMENT_BITS
+    /** Number of bits of the node index within a pool segment (every
+     *  segment has <tt>2^PCB_SEGMENT_BITS</tt> nodes, after the first ones). */
+    #define PCB_SEGMENT_BITS 16
+#endif
+
+
+#ifndef PCB_MIN_SEGMENT_BITS
+    /** Number of bits of the node index within the first pool segment (the
+     *  following ones double its size until reaching
+     *  <tt>2^PCB_SEGMENT_BITS</tt> nodes, so small trees stay small). */
+    #define PCB_MIN_SEGMENT_BITS 10
+#endif
+#if PCB_MIN_SEGMENT_BITS > PCB_SEGMENT_BITS
+    #error "PCB_MIN_SEGMENT_BITS must not be bigger than PCB_SEGMENT_BITS"
+#endif
 
 
-#ifndef PCB_INITIAL_NUM_NODES
-    /** Initial number of PCB nodes. */
-    #define PCB_INITIAL_NUM_NODES 1024
+#ifndef PCB_SEGMENT_MMAP
+    /** Whether to map pool segments directly, asking for transparent huge
+     *  pages, instead of using malloc(). */
+    #define PCB_SEGMENT_MMAP 0
 #endif
 
 
@@ -23,17 +62,145 @@
 #endif
 
 
+#ifndef PCB_ARENA_CHUNK_SIZE
+    /** String arena chunk size in bytes. */
+    #define PCB_ARENA_CHUNK_SIZE 65536
+#endif
+
+
+#ifndef PCB_ARENA_NUM_CLASSES
+    /** Number of string arena size classes (strings needing more blocks are
+     *  allocated individually). */
+    #define PCB_ARENA_NUM_CLASSES 64
+#endif
+
+
+#ifndef PCB_PATH_STACK_DEPTH
+    /** Depth of the path stack recorded while inserting (deeper descents
+     *  fall back to walking the tree again). */
+    #define PCB_PATH_STACK_DEPTH 64
+#endif
+
+
+#ifndef PCB_TRAVERSE_STACK_DEPTH
+    /** Number of pending subtrees kept while traversing (deeper ones are
+     *  recovered by descending again). */
+    #define PCB_TRAVERSE_STACK_DEPTH 64
+#endif
+
+
+#ifndef PCB_BATCH_SIZE
+    /** Number of lookups advanced in lock-step by the batch functions. */
+    #define PCB_BATCH_SIZE 16
+#endif
+
+
+#ifndef PCB_MAX_THREADS
+    /** Maximum number of threads used by the parallel functions. */
+    #define PCB_MAX_THREADS 64
+#endif
+
+
+#ifndef PCB_SCAN_CHUNKS_PER_THREAD
+    /** Number of chunks per thread the parallel scans start with. */
+    #define PCB_SCAN_CHUNKS_PER_THREAD 8
+#endif
+
+
+#ifndef PCB_RECLAIM_INTERVAL
+    /** Number of retired leaves and nodes between reclamation attempts. */
+    #define PCB_RECLAIM_INTERVAL 64
+#endif
+
+
+#ifndef PCB_SAVE_BUFFER_SIZE
+    /** Size in bytes of the buffer used to write frozen images. */
+    #define PCB_SAVE_BUFFER_SIZE 65536
+#endif
+
+
+#ifndef PCB_COMPACT_NODES
+    /** Whether to use compact nodes (32-bit byte index, bit mask and 32-bit
+     *  children instead of a size_t bit position and uintptr_t children). */
+    #define PCB_COMPACT_NODES 0
+#endif
+
+
+#ifndef PCB_SUBTREE_COUNTS
+    /** Whether internal nodes keep the number of leaves below them (so that
+     *  counting, ranking and selecting take a single descent). The counts
+     *  along the path are updated after linking a leaf and before unlinking
+     *  it, so readers running during a modification can see it counted in
+     *  some nodes and not in others: their counts are only exact between
+     *  modifications. */
+    #define PCB_SUBTREE_COUNTS 0
+#endif
+
+
+#if PCB_COMPACT_NODES
+    /** Base (tagged) pointer type. */
+    typedef uint32_t pcb_ptr_t;
+
+    /** Size of the node data. */
+    #define PCB_NODE_DATA_SIZE ((2 + PCB_SUBTREE_COUNTS) * sizeof(uint32_t) + 2 * sizeof(pcb_ptr_t))
+
+    /** Number of reserved nodes (node 0 is reserved, so that a zero base
+     *  pointer is never a valid leaf). */
+    #define PCB_NUM_RESERVED_NODES 1
+
+    /** Maximum number of nodes (leaves use two tag bits). */
+    #define PCB_MAX_NUM_NODES ((size_t)1 << 30)
+#else
+    /** Base (tagged) pointer type. */
+    typedef uintptr_t pcb_ptr_t;
+
+    /** Size of the node data. */
+    #define PCB_NODE_DATA_SIZE ((1 + PCB_SUBTREE_COUNTS) * sizeof(size_t) + 2 * sizeof(pcb_ptr_t))
+
+    /** Number of reserved nodes. */
+    #define PCB_NUM_RESERVED_NODES 0
+
+    /** Maximum number of nodes. */
+    #define PCB_MAX_NUM_NODES (SIZE_MAX / 2 / PCB_NODE_DATA_SIZE)
+#endif
+
+
+/* String node type (forward declaration). */
+struct pcb_string_node_t;
+
+
 /** Pooled CritBit node type. */
 typedef union
 {
     /** Used node. */
     struct
     {
+#if PCB_COMPACT_NODES
+        /** CritBit byte index. */
+        uint32_t cb_byte;
+
+        /** Children. */
+        pcb_ptr_t children[2];
+
+        /** CritBit mask, applied to the byte with its presence bit (0x100). */
+        uint32_t cb_mask;
+
+#if PCB_SUBTREE_COUNTS
+        /** Number of leaves below. */
+        uint32_t num_leaves;
+#endif
+#else
         /** CritBit position. */
         size_t cb_pos;
 
         /** Children. */
-        uintptr_t children[2];
+        pcb_ptr_t children[2];
+
+#if PCB_SUBTREE_COUNTS
+        /** Number of leaves below. */
+        size_t num_leaves;
+#endif
+#endif
 
     } used;
 
@@ -45,14 +212,135 @@ typedef union
 
     } free;
 
+    /** Inline leaf. */
+    struct
+    {
+        /** Value. */
+        pcb_value_t value;
+
+        /** String contents (zero padded), with the unused length in the
+         *  last byte (it doubles as NUL terminator when the string fills
+         *  the leaf). */
+        char s[PCB_NODE_DATA_SIZE > sizeof(pcb_value_t) + 1 ?
+               PCB_NODE_DATA_SIZE - sizeof(pcb_value_t) : 2];
+
+    } leaf;
+
+#if PCB_COMPACT_NODES
+    /** Out-of-line leaf. */
+    struct
+    {
+        /** String node. */
+        struct pcb_string_node_t *sn;
+
+    } ext;
+#endif
+
 } pcb_node_t;
 
 
+/** String node type. */
+typedef struct pcb_string_node_t
+{
+    /** Value. */
+    pcb_value_t value;
+
+    /** String length. */
+    size_t len;
+
+    /** String contents (NUL terminated and zero padded). */
+    char s[];
+
+} pcb_string_node_t;
+
+
+/** String arena chunk type. */
+typedef struct pcb_arena_chunk_t
+{
+    /** Previous chunk. */
+    struct pcb_arena_chunk_t *prev;
+
+    /** Chunk contents. */
+    char data[];
+
+} pcb_arena_chunk_t;
+
+
+/** Large string type (allocated outside the arena chunks). */
+typedef struct pcb_large_string_t
+{
+    /** Previous large string. */
+    struct pcb_large_string_t *prev;
+
+    /** Next large string. */
+    struct pcb_large_string_t *next;
+
+    /** String contents. */
+    char data[];
+
+} pcb_large_string_t;
+
+
+/** String arena type. */
+typedef struct
+{
+    /** Last chunk. */
+    pcb_arena_chunk_t *last_chunk;
+
+    /** Number of used bytes in the last chunk. */
+    size_t last_chunk_used;
+
+    /** Large strings. */
+    pcb_large_string_t *large_strings;
+
+    /** Free string lists by size class (in blocks). */
+    char *free_strings[PCB_ARENA_NUM_CLASSES];
+
+} pcb_arena_t;
+
+
+/** Retired leaf, internal node or memory block, waiting for the readers
+ *  that could see it. */
+typedef struct
+{
+    /** Base pointer (0 for a memory block). */
+    pcb_ptr_t p;
+
+    /** Memory block. */
+    void *mem;
+
+    /** Epoch in which it was retired. */
+    uint64_t epoch;
+
+} pcb_retired_t;
+
+
+/** Reader type. */
+struct pcb_reader_t
+{
+    /** Critbit tree. */
+    pcb_t *t;
+
+    /** Epoch observed when entering the read section (0 if outside). */
+    uint64_t epoch;
+
+    /** 1 if it's registered, 0 if it can be reused. */
+    int in_use;
+
+    /** Next reader. */
+    pcb_reader_t *next;
+
+};
+
+
 /** Pooled CritBit type. */
 struct pcb_t
 {
     /** Root. */
-    uintptr_t root;
+    pcb_ptr_t root;
+
+    /** String arena. */
+    pcb_arena_t arena;
 
     /** Number of used PCB nodes. */
     size_t num_used_nodes;
@@ -63,523 +351,6849 @@ struct pcb_t
     /** First free node. */
     size_t first_free_node;
 
-    /** Nodes. */
-    pcb_node_t nodes[];
+    /** First node never used (it and the following ones aren't in the free
+     *  list). */
+    size_t first_new_node;
+
+    /** Number of pool segments. */
+    size_t num_segments;
+
+    /** Capacity of the segment directory. */
+    size_t segments_size;
+
+    /** Segment directory, with an entry for every block of
+     *  <tt>2^PCB_MIN_SEGMENT_BITS</tt> nodes holding the address of its
+     *  segment minus the size of the nodes before it (segments never move, so
+     *  nodes keep their address). */
+    uintptr_t *segments;
+
+    /** Readers (new ones are pushed at the head, none are unlinked). */
+    pcb_reader_t *readers;
+
+    /** Number of registered readers. */
+    size_t num_readers;
+
+    /** Global epoch (starting at 1). */
+    uint64_t epoch;
+
+    /** Retired leaves and nodes. */
+    pcb_retired_t *retired;
+
+    /** Number of retired leaves and nodes. */
+    size_t num_retired;
+
+    /** Capacity of the retired array. */
+    size_t retired_size;
+
+    /** Lock for the allocations of concurrent insertions that cannot be done
+     *  lock-free (new segments, arena chunks and large strings). */
+    pthread_mutex_t alloc_lock;
 
 };
 
 
-/** Calculates the required memory for the PCB pool.
+/** Gets the number of bits of the node index within a pool segment.
  *
- *  \param num_node Number of nodes.
- *  \return Required memory in bytes.
+ *  \param k Segment index.
+ *  \return Number of bits.
+ *  \note The first two segments have <tt>2^PCB_MIN_SEGMENT_BITS</tt> nodes
+ *        and every following one doubles the previous one, until reaching
+ *        <tt>2^PCB_SEGMENT_BITS</tt> nodes.
  */
-static size_t _calc_req_mem(size_t num_nodes)
+static size_t _get_segment_bits(size_t k)
 {
-    return offsetof(pcb_t, nodes) + num_nodes * sizeof(pcb_node_t);
+    if (k == 0)
+        return PCB_MIN_SEGMENT_BITS;
+    return k <= PCB_SEGMENT_BITS - PCB_MIN_SEGMENT_BITS ? PCB_MIN_SEGMENT_BITS + k - 1 : PCB_SEGMENT_BITS;
 }
 
 
-/** Creates a string node.
+/** Gets the index of the first node of a pool segment.
  *
- *  \param s String contents.
- *  \param s_len Length of \a s as C string.
- *  \return Pointer to string node.
+ *  \param k Segment index.
+ *  \return Node index.
  */
-static char *_create_string_node(const char *s, size_t s_len)
+static size_t _get_segment_start(size_t k)
 {
-    size_t num_blocks = (s_len + 1 - 1) / PCB_BLOCK_SIZE + 1;
-    char *sn = malloc(num_blocks * PCB_BLOCK_SIZE);
-    memset(sn + (num_blocks - 1) * PCB_BLOCK_SIZE, 0, PCB_BLOCK_SIZE);
-    memcpy(sn, s, s_len);
-    return sn;
+    if (k == 0)
+        return 0;
+    if (k <= PCB_SEGMENT_BITS - PCB_MIN_SEGMENT_BITS)
+        return (size_t)1 << (PCB_MIN_SEGMENT_BITS + k - 1);
+    return (k - (PCB_SEGMENT_BITS - PCB_MIN_SEGMENT_BITS)) << PCB_SEGMENT_BITS;
 }
 
 
-/** Gets a free PCB node from the pool, increasing its size if needed.
+/** Gets a node of the pool.
  *
- *  \param tt Pointer to a critbit tree.
- *  \return Free PCB node or \c NULL in case of error.
+ *  \param t Critbit tree.
+ *  \param i Node index.
+ *  \return Node.
+ *  \note The directory is loaded with acquire semantics, as the writer can
+ *        replace it while readers are active.
  */
-static pcb_node_t *_get_free_pcb_node(pcb_t **tt)
+static pcb_node_t *_get_pool_node(const pcb_t *t, size_t i)
 {
-    /* gets a common pointer to makes common tasks easier */
-    pcb_t *t = *tt;
-
-    /* checks if we don't have a free node */
-    if (t->num_used_nodes == t->num_total_nodes)
-    {
-        /* tries to reallocate the PCB */
-        pcb_t *nt = realloc(t, _calc_req_mem(t->num_total_nodes * 2));
-        if (nt == NULL)
-            return NULL;
-
-        /* reallocation successful, extends the free list */
-        t = *tt = nt;
-        for (size_t i = t->num_total_nodes; i < t->num_total_nodes * 2 - 1; i++)
-            t->nodes[i].free.next_free_node = i + 1;
-        t->nodes[t->num_total_nodes * 2 - 1].free.next_free_node = SIZE_MAX;
-        t->first_free_node = t->num_total_nodes;
-        t->num_total_nodes *= 2;
-    }
-
-    /* gets the first free node and updates the list */
-    pcb_node_t *n = &t->nodes[t->first_free_node];
-    t->first_free_node = n->free.next_free_node;
-
-    /* updates the number of used nodes */
-    t->num_used_nodes++;
-
-    /* returns the (no longer) free node */
-    return n;
+    const uintptr_t *segments = __atomic_load_n(&t->segments, __ATOMIC_ACQUIRE);
+    return (pcb_node_t *)(segments[i >> PCB_MIN_SEGMENT_BITS] + i * sizeof(pcb_node_t));
 }
 
 
-/** Releases a PCB node to the pool.
+/** Reserves space in a growable array.
  *
- *  \param t Critbit tree.
- *  \param n PCB node to be freed.
+ *  \param buf Array (in/out).
+ *  \param cap Capacity in elements (in/out).
+ *  \param needed Number of elements needed.
+ *  \param elem_size Element size.
+ *  \return 1 if successful, 0 otherwise (the array is left unchanged).
  */
-static void _release_pcb_node(pcb_t *t, pcb_node_t *n)
+static int _reserve(void **buf, size_t *cap, size_t needed, size_t elem_size)
 {
-    /* sets it as first free node */
-    n->free.next_free_node = t->first_free_node;
-    t->first_free_node = n - t->nodes;
+    if (needed <= *cap)
+        return 1;
+    size_t new_cap = *cap > 0 ? *cap : 64;
+    while (new_cap < needed)
+        new_cap *= 2;
+    void *nb = realloc(*buf, new_cap * elem_size);
+    if (nb == NULL)
+        return 0;
+    *buf = nb;
+    *cap = new_cap;
+    return 1;
 }
 
 
-/** Reads a given bit from a string.
+/** Retires a memory block that readers could still be using.
  *
- *  \param s String.
- *  \param s_len Length of \a s.
- *  \param bit_pos Bit position.
- *  \return Bit value.
+ *  \param t Critbit tree (with space reserved in the retired array).
+ *  \param mem Memory block.
+ *  \note It's kept until no thread can be using the critbit, as concurrent
+ *        insertions read it without registering as readers.
  */
-static int _get_bit(const char *s, size_t s_len, size_t bit_pos)
+static void _retire_mem(pcb_t *t, void *mem)
 {
-    return (bit_pos >> 3) >= s_len ? 0 : s[bit_pos >> 3] & (1 << (7 - (bit_pos & 7)));
+    t->retired[t->num_retired].p = 0;
+    t->retired[t->num_retired].mem = mem;
+    t->retired[t->num_retired].epoch = UINT64_MAX;
+    t->num_retired++;
 }
 
 
-/** Gets the direction in a string lookup process.
+/** Allocates a pool segment.
  *
- *  \param n PCB node.
- *  \param s String that is being looked up.
- *  \param s_len Length of \a s.
- *  \return 1 means right, 0 means left.
+ *  \param k Segment index.
+ *  \return Segment or \c NULL in case of error.
  */
-static int _get_direction(const pcb_node_t *n, const char *s, size_t s_len)
+static pcb_node_t *_alloc_segment(size_t k)
 {
-    return _get_bit(s, s_len, n->used.cb_pos) != 0;
+    size_t size = sizeof(pcb_node_t) << _get_segment_bits(k);
+#if PCB_SEGMENT_MMAP
+    void *seg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (seg == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(seg, size, MADV_HUGEPAGE);
+#endif
+    return seg;
+#else
+    return malloc(size);
+#endif
 }
 
 
-/** Checks if pointer points to a node.
+/** Releases a pool segment.
  *
- *  \param p Pointer to check.
- *  \return 1 if true, 0 otherwise.
+ *  \param seg Segment.
+ *  \param k Segment index.
  */
-static int _is_node_ptr(uintptr_t p)
+static void _free_segment(pcb_node_t *seg, size_t k)
 {
-    return p & 1;
+#if PCB_SEGMENT_MMAP
+    munmap(seg, sizeof(pcb_node_t) << _get_segment_bits(k));
+#else
+    (void)k;
+    free(seg);
+#endif
 }
 
 
-/** Gets the node pointer.
+/** Initializes an empty pool.
  *
- *  \param t Critbit tree.
- *  \param p Base pointer.
- *  \return Node pointer.
+ *  \param t Critbit tree (only its pool fields are initialized).
+ *  \note No segment is allocated until a node is needed.
  */
-static pcb_node_t* _get_node_ptr(pcb_t *t, uintptr_t p)
+static void _init_pool(pcb_t *t)
 {
-    return &t->nodes[(size_t)(p >> 1)];
+    t->num_used_nodes = PCB_NUM_RESERVED_NODES;
+    t->num_total_nodes = 0;
+    t->first_free_node = SIZE_MAX;
+    t->first_new_node = PCB_NUM_RESERVED_NODES;
+    t->num_segments = 0;
+    t->segments_size = 0;
+    t->segments = NULL;
 }
 
 
-/** Gets the constant node pointer.
+/** Releases the segments of a pool.
  *
  *  \param t Critbit tree.
- *  \param p Base pointer.
- *  \return Node pointer.
  */
-static const pcb_node_t* _get_const_node_ptr(const pcb_t *t, uintptr_t p)
+static void _free_pool(pcb_t *t)
 {
-    return &t->nodes[(size_t)(p >> 1)];
+    for (size_t i = 0; i < t->num_segments; i++)
+    {
+        size_t start = _get_segment_start(i);
+        _free_segment((pcb_node_t *)(t->segments[start >> PCB_MIN_SEGMENT_BITS] + start * sizeof(pcb_node_t)), i);
+    }
+    free(t->segments);
+    _init_pool(t);
 }
 
 
-/** Gets the base pointer from a node pointer.
+/** Adds a segment to the pool.
  *
- *  \param t Critbit tree.
- *  \param n Node pointer.
- *  \return Base pointer associated with \a n.
+ *  \param t Critbit tree (with all its nodes used at least once).
+ *  \return 1 if successful, 0 otherwise.
+ *  \note The new nodes are not linked, they are taken in order as needed.
+ *        When the directory is full, it's replaced by a copy with twice the
+ *        capacity and the old one is retired.
  */
-static uintptr_t _get_base_ptr(pcb_t *t, const pcb_node_t *n)
+static int _add_segment(pcb_t *t)
 {
-    return ((uintptr_t)(n - t->nodes) << 1) | 1;
+    /* checks the limits */
+    size_t seg_size = (size_t)1 << _get_segment_bits(t->num_segments);
+    if (t->num_total_nodes > PCB_MAX_NUM_NODES - seg_size)
+        return 0;
+
+    /* grows the directory if needed */
+    size_t num_blocks = t->num_total_nodes >> PCB_MIN_SEGMENT_BITS;
+    size_t seg_blocks = seg_size >> PCB_MIN_SEGMENT_BITS;
+    if (num_blocks + seg_blocks > t->segments_size)
+    {
+        size_t new_size = t->segments_size > 0 ? 2 * t->segments_size : 8;
+        while (new_size < num_blocks + seg_blocks)
+            new_size *= 2;
+        uintptr_t *ns = malloc(new_size * sizeof(uintptr_t));
+        if (ns == NULL ||
+            !_reserve((void **)&t->retired, &t->retired_size, t->num_retired + 1, sizeof(pcb_retired_t)))
+        {
+            free(ns);
+            return 0;
+        }
+        uintptr_t *old = t->segments;
+        if (old != NULL)
+            memcpy(ns, old, num_blocks * sizeof(uintptr_t));
+        __atomic_store_n(&t->segments, ns, __ATOMIC_RELEASE);
+        t->segments_size = new_size;
+        if (old != NULL)
+            _retire_mem(t, old);
+    }
+
+    /* allocates the segment */
+    pcb_node_t *seg = _alloc_segment(t->num_segments);
+    if (seg == NULL)
+        return 0;
+    for (size_t j = 0; j < seg_blocks; j++)
+        t->segments[num_blocks + j] = (uintptr_t)seg - t->num_total_nodes * sizeof(pcb_node_t);
+    t->num_segments++;
+    __atomic_store_n(&t->num_total_nodes, t->num_total_nodes + seg_size, __ATOMIC_RELEASE);
+    return 1;
 }
 
 
-/** Gets the position of the critical bit.
+/** Initializes a string arena.
  *
- *  \param s1 First string to compare.
- *  \param s2 Second string to compare.
- *  \return Position of the critical bit.
- *  \note The strings must be different.
+ *  \param a String arena.
  */
-static size_t _get_critbit_pos(const char *s1, const char *s2)
+static void _arena_init(pcb_arena_t *a)
 {
-    size_t critbit_pos = 0;
-    while (((s1[critbit_pos >> 3] ^ s2[critbit_pos >> 3]) & (1 << (7 - (critbit_pos & 7)))) == 0)
-        critbit_pos++;
-    return critbit_pos;
+    a->last_chunk = NULL;
+    a->last_chunk_used = PCB_ARENA_CHUNK_SIZE;
+    a->large_strings = NULL;
+    for (size_t i = 0; i < PCB_ARENA_NUM_CLASSES; i++)
+        a->free_strings[i] = NULL;
 }
 
 
-/** Recursively traverses a subtree, executing a callback over every external node.
+/** Releases all the memory held by a string arena, leaving it empty.
  *
- *  \param t Critbit tree.
- *  \param r Root node.
- *  \param cb Callback to be executed over every external node.
- *  \param ctx Context for \a cb.
- *  \return 1 if the iteration was completed successfully, 0 otherwise.
- *  \note The iteration is interrupted if the callback returns 0.
+ *  \param a String arena.
  */
-static int _rec_traverse(const pcb_t *t, uintptr_t r, int (*cb)(const char *s, void *ctx), void *ctx)
+static void _arena_clear(pcb_arena_t *a)
 {
-    /* if it's an external node, just executes the calllback */
-    if (!_is_node_ptr(r))
-        return cb((const char *)r, ctx);
+    /* releases the chunks */
+    while (a->last_chunk != NULL)
+    {
+        pcb_arena_chunk_t *prev = a->last_chunk->prev;
+        free(a->last_chunk);
+        a->last_chunk = prev;
+    }
 
-    /* otherwise, just executes recursively over the children */
-    const pcb_node_t *n = _get_const_node_ptr(t, r);
-    if (!_rec_traverse(t, n->used.children[0], cb, ctx))
-        return 0;
-    if (!_rec_traverse(t, n->used.children[1], cb, ctx))
-        return 0;
-    return 1;
+    /* releases the large strings */
+    while (a->large_strings != NULL)
+    {
+        pcb_large_string_t *next = a->large_strings->next;
+        free(a->large_strings);
+        a->large_strings = next;
+    }
+
+    /* starts again */
+    _arena_init(a);
 }
 
 
-/** Recursively walks until finding the string nodes to be freed.
+/** Releases a string to the arena.
  *
- *  \param t Critbit tree.
- *  \param p Tagged pointer to the node.
+ *  \param a String arena.
+ *  \param p String memory.
+ *  \param num_blocks Size of \a p in blocks.
  */
-static void _rec_clear(pcb_t *t, uintptr_t p)
+static void _arena_free(pcb_arena_t *a, char *p, size_t num_blocks)
 {
-    /* if it's an internal node, we have to recurse */
-    if (_is_node_ptr(p))
-    {
-        pcb_node_t *n = _get_node_ptr(t, p);
-        _rec_clear(t, n->used.children[0]);
-        _rec_clear(t, n->used.children[1]);
-    }
-    /* otherwise, we just free the node */
-    else
+    /* large strings are unlinked and released directly */
+    if (num_blocks >= PCB_ARENA_NUM_CLASSES)
     {
-        free((char *)p);
+        pcb_large_string_t *ls = (pcb_large_string_t *)(p - offsetof(pcb_large_string_t, data));
+        if (ls->prev != NULL)
+            ls->prev->next = ls->next;
+        else
+            a->large_strings = ls->next;
+        if (ls->next != NULL)
+            ls->next->prev = ls->prev;
+        free(ls);
+        return;
     }
+
+    /* the rest are pushed in the free list of their size class */
+    memcpy(p, &a->free_strings[num_blocks], sizeof(char *));
+    a->free_strings[num_blocks] = p;
 }
 
 
-/** Creates a critbit.
+/** Gets memory for a string from the arena.
  *
- *  \return Newly created critbit.
+ *  \param a String arena.
+ *  \param num_blocks Required size in blocks.
+ *  \return Memory for the string or \c NULL in case of error.
  */
-pcb_t *pcb_create(void)
+static char *_arena_alloc(pcb_arena_t *a, size_t num_blocks)
 {
-    /* allocates the memory for the PCB */
-    pcb_t *t = malloc(_calc_req_mem(PCB_INITIAL_NUM_NODES));
-    if (t == NULL)
-        return t;
+    /* large strings get their own allocation */
+    if (num_blocks >= PCB_ARENA_NUM_CLASSES)
+    {
+        pcb_large_string_t *ls = malloc(offsetof(pcb_large_string_t, data) + num_blocks * PCB_BLOCK_SIZE);
+        if (ls == NULL)
+            return NULL;
+        ls->prev = NULL;
+        ls->next = a->large_strings;
+        if (ls->next != NULL)
+            ls->next->prev = ls;
+        a->large_strings = ls;
+        return ls->data;
+    }
 
-    /* the root starts cleared */
-    t->root = 0;
+    /* reuses a released string of the same size class if possible */
+    char *p = a->free_strings[num_blocks];
+    if (p != NULL)
+    {
+        memcpy(&a->free_strings[num_blocks], p, sizeof(char *));
+        return p;
+    }
+
+    /* checks if we need a new chunk */
+    size_t size = num_blocks * PCB_BLOCK_SIZE;
+    if (a->last_chunk_used + size > PCB_ARENA_CHUNK_SIZE)
+    {
+        pcb_arena_chunk_t *c = malloc(offsetof(pcb_arena_chunk_t, data) + PCB_ARENA_CHUNK_SIZE);
+        if (c == NULL)
+            return NULL;
 
-    /* initializes the numbers */
-    t->num_used_nodes = 0;
-    t->num_total_nodes = PCB_INITIAL_NUM_NODES;
-    t->first_free_node = 0;
+        /* the tail of the previous chunk is not wasted (concurrent
+           insertions can leave the used size above the chunk size) */
+        size_t tail_num_blocks = a->last_chunk_used < PCB_ARENA_CHUNK_SIZE ?
+                                 (PCB_ARENA_CHUNK_SIZE - a->last_chunk_used) / PCB_BLOCK_SIZE : 0;
+        if (a->last_chunk != NULL && tail_num_blocks > 0)
+            _arena_free(a, a->last_chunk->data + a->last_chunk_used, tail_num_blocks);
 
-    /* initializes the free list */
-    for (size_t i = 0; i < t->num_total_nodes - 1; i++)
-        t->nodes[i].free.next_free_node = i + 1;
-    t->nodes[t->num_total_nodes - 1].free.next_free_node = SIZE_MAX;
+        /* links the new chunk */
+        c->prev = a->last_chunk;
+        a->last_chunk = c;
+        a->last_chunk_used = 0;
+    }
 
-    /* returns the PCB */
-    return t;
+    /* bump allocation */
+    p = a->last_chunk->data + a->last_chunk_used;
+    a->last_chunk_used += size;
+    return p;
 }
 
 
-/** Destroys a critbit.
+#if !PCB_SUBTREE_COUNTS
+/** Releases a string to the arena, from one of many concurrent insertions.
  *
- *  \param t Critbit tree to be destroyed.
+ *  \param t Critbit tree.
+ *  \param p String memory.
+ *  \param num_blocks Size of \a p in blocks.
+ *  \note Strings of a size class are pushed with a compare-and-swap. As the
+ *        free lists are only popped outside the concurrent phases, it's not
+ *        exposed to ABA problems. Large strings take the allocation lock.
  */
-void pcb_destroy(pcb_t *t)
+static void _arena_free_concurrent(pcb_t *t, char *p, size_t num_blocks)
 {
-    /* first clears it */
-    pcb_clear(t);
+    /* large strings are unlinked with the lock */
+    if (num_blocks >= PCB_ARENA_NUM_CLASSES)
+    {
+        pthread_mutex_lock(&t->alloc_lock);
+        _arena_free(&t->arena, p, num_blocks);
+        pthread_mutex_unlock(&t->alloc_lock);
+        return;
+    }
 
-    /* then releases the memory */
-    free(t);
+    /* the rest are pushed in the free list of their size class */
+    char **head = &t->arena.free_strings[num_blocks];
+    char *next = __atomic_load_n(head, __ATOMIC_RELAXED);
+    do
+        memcpy(p, &next, sizeof(char *));
+    while (!__atomic_compare_exchange_n(head, &next, p, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
 
-/** Adds a string to the critbit.
+/** Gets memory for a string from the arena, from one of many concurrent
+ *  insertions.
  *
- *  \param tt Pointer to a critbit tree.
- *  \param s String to be added.
- *  \return 1 if successful, 0 otherwise.
+ *  \param t Critbit tree.
+ *  \param num_blocks Required size in blocks.
+ *  \return Memory for the string or \c NULL in case of error.
+ *  \note The space is claimed with an atomic increment of the used size of
+ *        the last chunk; only replacing a full chunk and allocating large
+ *        strings take the allocation lock. The chunk is replaced before
+ *        resetting the used size, so a claim is only valid if the chunk is
+ *        the same before and after it. The free lists are not used, as
+ *        popping from them concurrently would be exposed to ABA problems.
  */
-int pcb_add(pcb_t **tt, const char *s)
+static char *_arena_alloc_concurrent(pcb_t *t, size_t num_blocks)
 {
-    /* gets a simple pointer to make common tasks easier */
-    pcb_t *t = *tt;
+    pcb_arena_t *a = &t->arena;
 
-    /* gets the length of the string */
-    size_t s_len = strlen(s);
+    /* large strings get their own allocation */
+    if (num_blocks >= PCB_ARENA_NUM_CLASSES)
+    {
+        pthread_mutex_lock(&t->alloc_lock);
+        char *p = _arena_alloc(a, num_blocks);
+        pthread_mutex_unlock(&t->alloc_lock);
+        return p;
+    }
 
-    /* if it's empty, just gets a string node */
-    if (t->root == 0)
+    size_t size = num_blocks * PCB_BLOCK_SIZE;
+    while (1)
     {
-        /* string node */
-        const char *sn = _create_string_node(s, s_len);
-        if (sn == NULL)
-            return 0;
+        /* claims the space, retrying if the chunk was replaced meanwhile */
+        pcb_arena_chunk_t *c = __atomic_load_n(&a->last_chunk, __ATOMIC_ACQUIRE);
+        size_t used = __atomic_fetch_add(&a->last_chunk_used, size, __ATOMIC_ACQ_REL);
+        if (__atomic_load_n(&a->last_chunk, __ATOMIC_ACQUIRE) != c)
+            continue;
+        if (used + size <= PCB_ARENA_CHUNK_SIZE)
+            return c->data + used;
 
-        /* sets as root */
-        t->root = (uintptr_t)sn;
-        return 1;
+        /* the claim that crossed the end releases the tail of the chunk */
+        if (c != NULL && used < PCB_ARENA_CHUNK_SIZE)
+            _arena_free_concurrent(t, c->data + used, (PCB_ARENA_CHUNK_SIZE - used) / PCB_BLOCK_SIZE);
+
+        /* replaces the chunk, unless another thread already did it */
+        pthread_mutex_lock(&t->alloc_lock);
+        if (a->last_chunk == c && __atomic_load_n(&a->last_chunk_used, __ATOMIC_RELAXED) > PCB_ARENA_CHUNK_SIZE - size)
+        {
+            pcb_arena_chunk_t *nc = malloc(offsetof(pcb_arena_chunk_t, data) + PCB_ARENA_CHUNK_SIZE);
+            if (nc == NULL)
+            {
+                pthread_mutex_unlock(&t->alloc_lock);
+                return NULL;
+            }
+            nc->prev = c;
+            __atomic_store_n(&a->last_chunk, nc, __ATOMIC_RELEASE);
+            __atomic_store_n(&a->last_chunk_used, 0, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&t->alloc_lock);
     }
+}
+#endif
 
-    /* search loop */
-    uintptr_t p = t->root;
+
+/** Calculates the number of blocks used by a string node.
+ *
+ *  \param s_len Length of the string.
+ *  \return Number of blocks.
+ */
+static size_t _calc_string_node_blocks(size_t s_len)
+{
+    return (offsetof(pcb_string_node_t, s) + s_len + 1 - 1) / PCB_BLOCK_SIZE + 1;
+}
+
+
+/** Initializes a string node.
+ *
+ *  \param p String node memory.
+ *  \param num_blocks Size of \a p in blocks.
+ *  \param s String contents.
+ *  \param s_len Length of \a s.
+ *  \return Pointer to string node.
+ *  \note The value starts zero-initialized.
+ */
+static pcb_string_node_t *_init_string_node(char *p, size_t num_blocks, const char *s, size_t s_len)
+{
+    memset(p + (num_blocks - 1) * PCB_BLOCK_SIZE, 0, PCB_BLOCK_SIZE);
+    pcb_string_node_t *sn = (pcb_string_node_t *)p;
+    sn->value = (pcb_value_t){ 0 };
+    sn->len = s_len;
+    memcpy(sn->s, s, s_len);
+    return sn;
+}
+
+
+/** Creates a string node.
+ *
+ *  \param t Critbit tree.
+ *  \param s String contents.
+ *  \param s_len Length of \a s.
+ *  \return Pointer to string node or \c NULL in case of error.
+ *  \note The value starts zero-initialized.
+ */
+static pcb_string_node_t *_create_string_node(pcb_t *t, const char *s, size_t s_len)
+{
+    size_t num_blocks = _calc_string_node_blocks(s_len);
+    char *p = _arena_alloc(&t->arena, num_blocks);
+    if (p == NULL)
+        return NULL;
+    return _init_string_node(p, num_blocks, s, s_len);
+}
+
+
+/** Releases a string node.
+ *
+ *  \param t Critbit tree.
+ *  \param sn String node.
+ */
+static void _release_string_node(pcb_t *t, pcb_string_node_t *sn)
+{
+    _arena_free(&t->arena, (char *)sn, _calc_string_node_blocks(sn->len));
+}
+
+
+#if !PCB_SUBTREE_COUNTS
+/** Creates a string node, from one of many concurrent insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param s String contents.
+ *  \param s_len Length of \a s.
+ *  \return Pointer to string node or \c NULL in case of error.
+ *  \note The value starts zero-initialized.
+ */
+static pcb_string_node_t *_create_string_node_concurrent(pcb_t *t, const char *s, size_t s_len)
+{
+    size_t num_blocks = _calc_string_node_blocks(s_len);
+    char *p = _arena_alloc_concurrent(t, num_blocks);
+    if (p == NULL)
+        return NULL;
+    return _init_string_node(p, num_blocks, s, s_len);
+}
+
+
+/** Releases a string node, from one of many concurrent insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param sn String node.
+ */
+static void _release_string_node_concurrent(pcb_t *t, pcb_string_node_t *sn)
+{
+    _arena_free_concurrent(t, (char *)sn, _calc_string_node_blocks(sn->len));
+}
+#endif
+
+
+/** Gets a free PCB node from the pool, increasing its size if needed.
+ *
+ *  \param t Critbit tree.
+ *  \param idx Index of the node (output).
+ *  \return Free PCB node or \c NULL in case of error.
+ *  \note Released nodes are reused first. The pool grows by adding a
+ *        segment, so existing nodes never move.
+ */
+static pcb_node_t *_get_free_pcb_node(pcb_t *t, size_t *idx)
+{
+    pcb_node_t *n;
+    if (t->first_free_node != SIZE_MAX)
+    {
+        /* gets the first free node and updates the list */
+        *idx = t->first_free_node;
+        n = _get_pool_node(t, *idx);
+        t->first_free_node = n->free.next_free_node;
+    }
+    else
+    {
+        /* takes a new one, adding a segment if needed */
+        if (t->first_new_node >= t->num_total_nodes && !_add_segment(t))
+            return NULL;
+        *idx = t->first_new_node++;
+        n = _get_pool_node(t, *idx);
+    }
+
+    /* updates the number of used nodes */
+    t->num_used_nodes++;
+
+    /* returns the (no longer) free node */
+    return n;
+}
+
+
+/** Releases a PCB node to the pool.
+ *
+ *  \param t Critbit tree.
+ *  \param i Index of the PCB node to be freed.
+ */
+static void _release_pcb_node(pcb_t *t, size_t i)
+{
+    /* sets it as first free node */
+    _get_pool_node(t, i)->free.next_free_node = t->first_free_node;
+    t->first_free_node = i;
+
+    /* updates the number of used nodes */
+    t->num_used_nodes--;
+}
+
+
+#if !PCB_SUBTREE_COUNTS
+/** Gets a never used PCB node from the pool, from one of many concurrent
+ *  insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param idx Index of the node (output).
+ *  \return Free PCB node or \c NULL in case of error.
+ *  \note The node is claimed with an atomic increment; only adding a segment
+ *        takes the allocation lock. The free list is not used, as popping
+ *        from it concurrently would be exposed to ABA problems.
+ */
+static pcb_node_t *_get_new_pcb_node_concurrent(pcb_t *t, size_t *idx)
+{
+    /* claims the index */
+    *idx = __atomic_fetch_add(&t->first_new_node, 1, __ATOMIC_RELAXED);
+
+    /* adds segments until it exists */
+    if (*idx >= __atomic_load_n(&t->num_total_nodes, __ATOMIC_ACQUIRE))
+    {
+        int ok = 1;
+        pthread_mutex_lock(&t->alloc_lock);
+        while (ok && *idx >= t->num_total_nodes)
+            ok = _add_segment(t);
+        pthread_mutex_unlock(&t->alloc_lock);
+        if (!ok)
+            return NULL;
+    }
+
+    /* updates the number of used nodes */
+    __atomic_add_fetch(&t->num_used_nodes, 1, __ATOMIC_RELAXED);
+    return _get_pool_node(t, *idx);
+}
+
+
+/** Releases a PCB node to the pool, from one of many concurrent insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param i Index of the PCB node to be freed.
+ *  \note It's pushed in the free list with a compare-and-swap. As the free
+ *        list is only popped outside the concurrent phases, it's not exposed
+ *        to ABA problems.
+ */
+static void _release_pcb_node_concurrent(pcb_t *t, size_t i)
+{
+    /* sets it as first free node */
+    pcb_node_t *n = _get_pool_node(t, i);
+    size_t next = __atomic_load_n(&t->first_free_node, __ATOMIC_RELAXED);
+    do
+        n->free.next_free_node = next;
+    while (!__atomic_compare_exchange_n(&t->first_free_node, &next, i, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* updates the number of used nodes */
+    __atomic_sub_fetch(&t->num_used_nodes, 1, __ATOMIC_RELAXED);
+}
+#endif
+
+
+/** Reads a given bit from a string.
+ *
+ *  \param s String.
+ *  \param s_len Length of \a s.
+ *  \param bit_pos Bit position.
+ *  \return Bit value.
+ *  \note Every byte has 9 bits: bit position <tt>(i << 4) | 0</tt> is set if
+ *        the byte \a i exists and positions <tt>(i << 4) | k</tt> with \a k
+ *        from 1 to 8 are its bits from MSB to LSB. That way a string sorts
+ *        before its extensions even if they continue with NUL bytes.
+ */
+static int _get_bit(const char *s, size_t s_len, size_t bit_pos)
+{
+    return (bit_pos >> 4) >= s_len ? 0 : ((0x100 | (unsigned char)s[bit_pos >> 4]) >> (8 - (bit_pos & 15))) & 1;
+}
+
+
+/** Gets the critbit position of a node.
+ *
+ *  \param n PCB node.
+ *  \return CritBit position.
+ */
+static size_t _get_cb_pos(const pcb_node_t *n)
+{
+#if PCB_COMPACT_NODES
+    return ((size_t)n->used.cb_byte << 4) |
+           (size_t)(__builtin_clz(n->used.cb_mask) - (sizeof(unsigned) * CHAR_BIT - 9));
+#else
+    return n->used.cb_pos;
+#endif
+}
+
+
+/** Sets the critbit position of a node.
+ *
+ *  \param n PCB node.
+ *  \param cb_pos CritBit position.
+ */
+static void _set_cb_pos(pcb_node_t *n, size_t cb_pos)
+{
+#if PCB_COMPACT_NODES
+    n->used.cb_byte = (uint32_t)(cb_pos >> 4);
+    n->used.cb_mask = 0x100 >> (cb_pos & 15);
+#else
+    n->used.cb_pos = cb_pos;
+#endif
+}
+
+
+/** Gets the direction in a string lookup process.
+ *
+ *  \param n PCB node.
+ *  \param s String that is being looked up.
+ *  \param s_len Length of \a s.
+ *  \return 1 means right, 0 means left.
+ */
+static int _get_direction(const pcb_node_t *n, const char *s, size_t s_len)
+{
+#if PCB_COMPACT_NODES
+    size_t i = n->used.cb_byte;
+    return i < s_len && ((0x100 | (unsigned char)s[i]) & n->used.cb_mask) != 0;
+#else
+    return _get_bit(s, s_len, n->used.cb_pos) != 0;
+#endif
+}
+
+
+/** Checks if pointer points to a node.
+ *
+ *  \param p Pointer to check.
+ *  \return 1 if true, 0 otherwise.
+ */
+static int _is_node_ptr(pcb_ptr_t p)
+{
+    return p & 1;
+}
+
+
+/** Gets the node pointer.
+ *
+ *  \param t Critbit tree.
+ *  \param p Base pointer.
+ *  \return Node pointer.
+ */
+static pcb_node_t* _get_node_ptr(pcb_t *t, pcb_ptr_t p)
+{
+    return _get_pool_node(t, (size_t)(p >> 1));
+}
+
+
+/** Gets the constant node pointer.
+ *
+ *  \param t Critbit tree.
+ *  \param p Base pointer.
+ *  \return Node pointer.
+ */
+static const pcb_node_t* _get_const_node_ptr(const pcb_t *t, pcb_ptr_t p)
+{
+    return _get_pool_node(t, (size_t)(p >> 1));
+}
+
+
+/** Gets a child of an internal node, as seen by a reader.
+ *
+ *  \param n Internal node.
+ *  \param dir Direction.
+ *  \return Child base pointer.
+ *  \note Acquire load, pairing with the release stores that publish nodes.
+ */
+static pcb_ptr_t _get_child(const pcb_node_t *n, int dir)
+{
+    return __atomic_load_n(&n->used.children[dir], __ATOMIC_ACQUIRE);
+}
+
+
+/** Gets the root of a critbit, as seen by a reader.
+ *
+ *  \param t Critbit tree.
+ *  \return Root base pointer (0 if empty).
+ */
+static pcb_ptr_t _get_root(const pcb_t *t)
+{
+    return __atomic_load_n(&t->root, __ATOMIC_ACQUIRE);
+}
+
+
+/** Publishes a child or root pointer, making the nodes below it visible
+ *  to readers.
+ *
+ *  \param pp Pointer to be updated.
+ *  \param p New base pointer.
+ */
+static void _publish_ptr(pcb_ptr_t *pp, pcb_ptr_t p)
+{
+    __atomic_store_n(pp, p, __ATOMIC_RELEASE);
+}
+
+
+/** Gets the base pointer of an internal node.
+ *
+ *  \param i Node index.
+ *  \return Base pointer associated with the node.
+ */
+static pcb_ptr_t _get_base_ptr(size_t i)
+{
+    return ((pcb_ptr_t)i << 1) | 1;
+}
+
+
+/** Checks if pointer points to an inline leaf.
+ *
+ *  \param p Pointer to check.
+ *  \return 1 if true, 0 otherwise.
+ */
+static int _is_inline_leaf_ptr(pcb_ptr_t p)
+{
+    return (p & 3) == 2;
+}
+
+
+/** Gets the base pointer of an inline leaf.
+ *
+ *  \param i Node index.
+ *  \return Base pointer associated with the leaf.
+ */
+static pcb_ptr_t _get_inline_leaf_base_ptr(size_t i)
+{
+    return ((pcb_ptr_t)i << 2) | 2;
+}
+
+
+/** Gets the pool node of a leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer (inline, or out-of-line with compact nodes).
+ *  \return Node.
+ */
+static pcb_node_t *_get_leaf_node(const pcb_t *t, pcb_ptr_t p)
+{
+    return _get_pool_node(t, (size_t)(p >> 2));
+}
+
+
+/** Gets the string node of an out-of-line leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \return String node.
+ */
+static pcb_string_node_t *_get_string_node(const pcb_t *t, pcb_ptr_t p)
+{
+#if PCB_COMPACT_NODES
+    return _get_leaf_node(t, p)->ext.sn;
+#else
+    (void)t;
+    return (pcb_string_node_t *)p;
+#endif
+}
+
+
+/** Gets the string of a leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \return String contents.
+ *  \note Inline leaves live in the pool, so the returned pointer is only
+ *        valid until the next modification of \a t.
+ */
+static const char *_get_leaf_str(const pcb_t *t, pcb_ptr_t p)
+{
+    return _is_inline_leaf_ptr(p) ? _get_leaf_node(t, p)->leaf.s : _get_string_node(t, p)->s;
+}
+
+
+/** Gets the string length of a leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \return String length.
+ */
+static size_t _get_leaf_len(const pcb_t *t, pcb_ptr_t p)
+{
+    if (_is_inline_leaf_ptr(p))
+    {
+        const pcb_node_t *n = _get_leaf_node(t, p);
+        return sizeof(n->leaf.s) - 1 - (unsigned char)n->leaf.s[sizeof(n->leaf.s) - 1];
+    }
+    return _get_string_node(t, p)->len;
+}
+
+
+/** Gets the value of a leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \return Pointer to the value.
+ *  \note The same validity restrictions of _get_leaf_str() apply.
+ */
+static pcb_value_t *_get_leaf_value(const pcb_t *t, pcb_ptr_t p)
+{
+    return _is_inline_leaf_ptr(p) ? &_get_leaf_node(t, p)->leaf.value : &_get_string_node(t, p)->value;
+}
+
+
+/** Initializes an inline leaf.
+ *
+ *  \param n Pool node.
+ *  \param s String contents.
+ *  \param s_len Length of \a s (it must fit in the node).
+ *  \note The value starts zero-initialized.
+ */
+static void _init_inline_leaf(pcb_node_t *n, const char *s, size_t s_len)
+{
+    n->leaf.value = (pcb_value_t){ 0 };
+    memset(n->leaf.s, 0, sizeof(n->leaf.s));
+    memcpy(n->leaf.s, s, s_len);
+    n->leaf.s[sizeof(n->leaf.s) - 1] = (char)(sizeof(n->leaf.s) - 1 - s_len);
+}
+
+
+/** Creates a leaf, storing short strings inline in the pool.
+ *
+ *  \param t Critbit tree.
+ *  \param s String contents.
+ *  \param s_len Length of \a s.
+ *  \return Leaf base pointer or 0 in case of error.
+ *  \note The value starts zero-initialized.
+ */
+static pcb_ptr_t _create_leaf(pcb_t *t, const char *s, size_t s_len)
+{
+    /* long strings go to the arena */
+    if (s_len >= sizeof(((pcb_node_t *)NULL)->leaf.s))
+    {
+        pcb_string_node_t *sn = _create_string_node(t, s, s_len);
+#if PCB_COMPACT_NODES
+        /* compact pointers cannot hold it, so it's referenced from a node */
+        if (sn == NULL)
+            return 0;
+        size_t i;
+        pcb_node_t *n = _get_free_pcb_node(t, &i);
+        if (n == NULL)
+        {
+            _release_string_node(t, sn);
+            return 0;
+        }
+        n->ext.sn = sn;
+        return (pcb_ptr_t)i << 2;
+#else
+        return (pcb_ptr_t)sn;
+#endif
+    }
+
+    /* short ones are stored in a pool node */
+    size_t i;
+    pcb_node_t *n = _get_free_pcb_node(t, &i);
+    if (n == NULL)
+        return 0;
+    _init_inline_leaf(n, s, s_len);
+    return _get_inline_leaf_base_ptr(i);
+}
+
+
+#if !PCB_SUBTREE_COUNTS
+/** Creates a leaf, from one of many concurrent insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param s String contents.
+ *  \param s_len Length of \a s.
+ *  \return Leaf base pointer or 0 in case of error.
+ */
+static pcb_ptr_t _create_leaf_concurrent(pcb_t *t, const char *s, size_t s_len)
+{
+    /* long strings go to the arena */
+    if (s_len >= sizeof(((pcb_node_t *)NULL)->leaf.s))
+    {
+        pcb_string_node_t *sn = _create_string_node_concurrent(t, s, s_len);
+#if PCB_COMPACT_NODES
+        /* compact pointers cannot hold it, so it's referenced from a node */
+        if (sn == NULL)
+            return 0;
+        size_t i;
+        pcb_node_t *n = _get_new_pcb_node_concurrent(t, &i);
+        if (n == NULL)
+        {
+            _release_string_node_concurrent(t, sn);
+            return 0;
+        }
+        n->ext.sn = sn;
+        return (pcb_ptr_t)i << 2;
+#else
+        return (pcb_ptr_t)sn;
+#endif
+    }
+
+    /* short ones are stored in a pool node */
+    size_t i;
+    pcb_node_t *n = _get_new_pcb_node_concurrent(t, &i);
+    if (n == NULL)
+        return 0;
+    _init_inline_leaf(n, s, s_len);
+    return _get_inline_leaf_base_ptr(i);
+}
+#endif
+
+
+/** Releases a leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ */
+static void _release_leaf(pcb_t *t, pcb_ptr_t p)
+{
+    if (_is_inline_leaf_ptr(p))
+    {
+        _release_pcb_node(t, (size_t)(p >> 2));
+        return;
+    }
+    _release_string_node(t, _get_string_node(t, p));
+#if PCB_COMPACT_NODES
+    _release_pcb_node(t, (size_t)(p >> 2));
+#endif
+}
+
+
+/** Releases a leaf or an internal node.
+ *
+ *  \param t Critbit tree.
+ *  \param p Base pointer.
+ */
+static void _release_ptr(pcb_t *t, pcb_ptr_t p)
+{
+    if (_is_node_ptr(p))
+        _release_pcb_node(t, (size_t)(p >> 1));
+    else
+        _release_leaf(t, p);
+}
+
+
+/** Releases a retired entry.
+ *
+ *  \param t Critbit tree.
+ *  \param r Retired entry.
+ */
+static void _release_retired(pcb_t *t, const pcb_retired_t *r)
+{
+    if (r->p != 0)
+        _release_ptr(t, r->p);
+    else
+        free(r->mem);
+}
+
+
+/** Releases the retired entries that no reader can still see.
+ *
+ *  \param t Critbit tree.
+ *  \note Advances the epoch first, so the read sections starting after it
+ *        don't hold anything retired until now.
+ */
+static void _reclaim(pcb_t *t)
+{
+    /* gets the oldest epoch still being read */
+    __atomic_add_fetch(&t->epoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t min_epoch = UINT64_MAX;
+    for (pcb_reader_t *r = __atomic_load_n(&t->readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+    {
+        uint64_t e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+        if (e != 0 && e < min_epoch)
+            min_epoch = e;
+    }
+
+    /* releases the older ones, keeping the rest in order */
+    size_t j = 0;
+    for (size_t i = 0; i < t->num_retired; i++)
+    {
+        if (t->retired[i].epoch < min_epoch)
+            _release_retired(t, &t->retired[i]);
+        else
+            t->retired[j++] = t->retired[i];
+    }
+    t->num_retired = j;
+}
+
+
+/** Releases all the retired entries.
+ *
+ *  \param t Critbit tree (without active readers).
+ */
+static void _reclaim_all(pcb_t *t)
+{
+    for (size_t i = 0; i < t->num_retired; i++)
+        _release_retired(t, &t->retired[i]);
+    t->num_retired = 0;
+}
+
+
+/** Retires a leaf or internal node that was just unlinked from the tree.
+ *
+ *  \param t Critbit tree (with space reserved in the retired array).
+ *  \param p Base pointer.
+ *  \note Without registered readers it's released immediately.
+ */
+static void _retire(pcb_t *t, pcb_ptr_t p)
+{
+    /* the unlinking must be visible before checking for readers */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&t->num_readers, __ATOMIC_SEQ_CST) == 0)
+    {
+        _reclaim_all(t);
+        _release_ptr(t, p);
+        return;
+    }
+
+    /* otherwise, it waits for the readers of this epoch */
+    t->retired[t->num_retired].p = p;
+    t->retired[t->num_retired].mem = NULL;
+    t->retired[t->num_retired].epoch = __atomic_load_n(&t->epoch, __ATOMIC_RELAXED);
+    if (++t->num_retired % PCB_RECLAIM_INTERVAL == 0)
+        _reclaim(t);
+}
+
+
+/** Prefetches the memory referenced by a base pointer.
+ *
+ *  \param t Critbit tree.
+ *  \param p Base pointer (node or leaf).
+ *  \note Always inlined: otherwise GCC can find it has no side effects and
+ *        drop the calls.
+ */
+__attribute__((always_inline))
+static inline void _prefetch_ptr(const pcb_t *t, pcb_ptr_t p)
+{
+    if (_is_node_ptr(p))
+        __builtin_prefetch(_get_const_node_ptr(t, p));
+    else if (_is_inline_leaf_ptr(p))
+        __builtin_prefetch(_get_leaf_node(t, p));
+    else
+        __builtin_prefetch(_get_string_node(t, p));
+}
+
+
+/** Gets the index of the first differing byte, a word at a time.
+ *
+ *  \param s1 First string.
+ *  \param s2 Second string.
+ *  \param n Number of bytes to compare.
+ *  \return Index of the first differing byte or \a n if there is none.
+ */
+static size_t _get_first_diff_word(const char *s1, const char *s2, size_t n)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t))
+    {
+        uint64_t w1, w2;
+        memcpy(&w1, s1 + i, sizeof(w1));
+        memcpy(&w2, s2 + i, sizeof(w2));
+        if (w1 != w2)
+        {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return i + (__builtin_ctzll(w1 ^ w2) >> 3);
+#else
+            return i + (__builtin_clzll(w1 ^ w2) >> 3);
+#endif
+        }
+    }
+    while (i < n && s1[i] == s2[i])
+        i++;
+    return i;
+}
+
+
+#ifdef __SSE2__
+/** Gets the index of the first differing byte, using SSE2.
+ *
+ *  \param s1 First string.
+ *  \param s2 Second string.
+ *  \param n Number of bytes to compare.
+ *  \return Index of the first differing byte or \a n if there is none.
+ */
+static size_t _get_first_diff_sse2(const char *s1, const char *s2, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(s1 + i));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(s2 + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) ^ 0xffff;
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + _get_first_diff_word(s1 + i, s2 + i, n - i);
+}
+#endif
+
+
+#if PCB_HAS_AVX2_KERNEL
+/** Gets the index of the first differing byte, using AVX2.
+ *
+ *  \param s1 First string.
+ *  \param s2 Second string.
+ *  \param n Number of bytes to compare.
+ *  \return Index of the first differing byte or \a n if there is none.
+ */
+__attribute__((target("avx2")))
+static size_t _get_first_diff_avx2(const char *s1, const char *s2, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(s1 + i));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(s2 + i));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v2));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + _get_first_diff_word(s1 + i, s2 + i, n - i);
+}
+#endif
+
+
+/** Comparison kernel for long strings (selected at startup). */
+#ifdef __SSE2__
+static size_t (*_get_first_diff_long)(const char *s1, const char *s2, size_t n) = _get_first_diff_sse2;
+#else
+static size_t (*_get_first_diff_long)(const char *s1, const char *s2, size_t n) = _get_first_diff_word;
+#endif
+
+
+#if PCB_HAS_AVX2_KERNEL
+/** Selects the best comparison kernel supported by the CPU. */
+__attribute__((constructor))
+static void _select_first_diff_kernel(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        _get_first_diff_long = _get_first_diff_avx2;
+}
+#endif
+
+
+/** Gets the index of the first differing byte between two strings.
+ *
+ *  \param s1 First string.
+ *  \param s2 Second string.
+ *  \param n Number of bytes to compare.
+ *  \return Index of the first differing byte or \a n if there is none.
+ *  \note Short strings are compared inline a word at a time, longer ones
+ *        use the widest kernel available.
+ */
+static size_t _get_first_diff(const char *s1, const char *s2, size_t n)
+{
+    return n <= 2 * sizeof(uint64_t) ? _get_first_diff_word(s1, s2, n) : _get_first_diff_long(s1, s2, n);
+}
+
+
+/** Checks if a leaf matches a string.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \param s String.
+ *  \param s_len Length of \a s.
+ *  \return 1 if the leaf string is equal to \a s, 0 otherwise.
+ */
+static int _leaf_matches(const pcb_t *t, pcb_ptr_t p, const char *s, size_t s_len)
+{
+    return _get_leaf_len(t, p) == s_len && _get_first_diff(_get_leaf_str(t, p), s, s_len) == s_len;
+}
+
+
+/** Gets the position of the critical bit.
+ *
+ *  \param s1 First string to compare.
+ *  \param s1_len Length of \a s1.
+ *  \param s2 Second string to compare.
+ *  \param s2_len Length of \a s2.
+ *  \return Position of the critical bit.
+ *  \note The strings must be different.
+ */
+static size_t _get_critbit_pos(const char *s1, size_t s1_len, const char *s2, size_t s2_len)
+{
+    /* looks for the first differing byte */
+    size_t min_len = s1_len < s2_len ? s1_len : s2_len;
+    size_t i = _get_first_diff(s1, s2, min_len);
+
+    /* if there is none, the shorter one ends first */
+    if (i == min_len)
+        return i << 4;
+
+    /* otherwise, the first differing bit is given by the leading zeros */
+    unsigned x = (unsigned char)(s1[i] ^ s2[i]);
+    return (i << 4) | (size_t)(__builtin_clz(x) - (sizeof(unsigned) * CHAR_BIT - 8) + 1);
+}
+
+
+/** Compares two strings as unsigned bytes.
+ *
+ *  \param s1 First string.
+ *  \param s1_len Length of \a s1.
+ *  \param s2 Second string.
+ *  \param s2_len Length of \a s2.
+ *  \return Negative, zero or positive if \a s1 is respectively smaller,
+ *          equal or bigger than \a s2.
+ */
+static int _compare(const char *s1, size_t s1_len, const char *s2, size_t s2_len)
+{
+    size_t min_len = s1_len < s2_len ? s1_len : s2_len;
+    size_t i = _get_first_diff(s1, s2, min_len);
+    if (i < min_len)
+        return (unsigned char)s1[i] < (unsigned char)s2[i] ? -1 : 1;
+    return s1_len < s2_len ? -1 : s1_len > s2_len;
+}
+
+
+/** Traversal state type. */
+typedef struct
+{
+    /** Pending subtrees (a ring, the oldest entries get overwritten). */
+    pcb_ptr_t stack[PCB_TRAVERSE_STACK_DEPTH];
+
+    /** Number of pushes minus pops. */
+    size_t top;
+
+    /** Number of entries in the stack. */
+    size_t count;
+
+    /** Whether entries were overwritten. */
+    int lost;
+
+} pcb_traverse_t;
+
+
+/** Pushes a pending subtree into a traversal stack, prefetching it.
+ *
+ *  \param t Critbit tree.
+ *  \param ts Traversal state.
+ *  \param p Subtree root.
+ */
+static void _traverse_push(const pcb_t *t, pcb_traverse_t *ts, pcb_ptr_t p)
+{
+    _prefetch_ptr(t, p);
+    ts->stack[ts->top++ % PCB_TRAVERSE_STACK_DEPTH] = p;
+    if (ts->count == PCB_TRAVERSE_STACK_DEPTH)
+        ts->lost = 1;
+    else
+        ts->count++;
+}
+
+
+/** Pushes the subtrees following a leaf in a traversal.
+ *
+ *  \param t Critbit tree.
+ *  \param ts Traversal state.
+ *  \param r Traversal root.
+ *  \param p Leaf in the subtree of \a r.
+ *  \param rev 1 if the traversal is in reverse order, 0 otherwise.
+ */
+static void _traverse_push_following(const pcb_t *t, pcb_traverse_t *ts, pcb_ptr_t r, pcb_ptr_t p, int rev)
+{
+    /* the siblings on the path to the leaf that come later are pending */
+    const char *s = _get_leaf_str(t, p);
+    size_t s_len = _get_leaf_len(t, p);
+    while (_is_node_ptr(r))
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, r);
+        int dir = _get_direction(n, s, s_len);
+        if (dir == rev)
+            _traverse_push(t, ts, _get_child(n, !rev));
+        r = _get_child(n, dir);
+    }
+}
+
+
+/** Continues a traversal in order, executing a callback over every leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param r Root node.
+ *  \param ts Traversal state, with the pending subtrees.
+ *  \param p First subtree to walk (0 to start with the pending ones).
+ *  \param rev 1 to traverse in reverse order, 0 otherwise.
+ *  \param visit Callback to be executed over every leaf.
+ *  \param ctx Context for \a visit.
+ *  \return 1 if the iteration was completed successfully, 0 otherwise.
+ *  \note The iteration is interrupted if the callback returns 0. The
+ *        siblings still pending are kept in a fixed ring of
+ *        \c PCB_TRAVERSE_STACK_DEPTH entries, prefetched as they are pushed.
+ *        If deeper subtrees overwrite the oldest entries, they are recovered
+ *        by descending again from \a r with the last visited string.
+ */
+static int _traverse_from(const pcb_t *t, pcb_ptr_t r, pcb_traverse_t *ts, pcb_ptr_t p, int rev,
+                          int (*visit)(const pcb_t *t, pcb_ptr_t p, void *ctx), void *ctx)
+{
+    while (1)
+    {
+        if (p != 0)
+        {
+            /* goes down the first side, leaving the other siblings pending */
+            while (_is_node_ptr(p))
+            {
+                const pcb_node_t *n = _get_const_node_ptr(t, p);
+                _traverse_push(t, ts, _get_child(n, !rev));
+                p = _get_child(n, rev);
+            }
+
+            /* visits the leaf */
+            if (!visit(t, p, ctx))
+                return 0;
+
+            /* if entries were lost, recovers them from the last visited leaf */
+            if (ts->count == 0 && ts->lost)
+            {
+                ts->lost = 0;
+                _traverse_push_following(t, ts, r, p, rev);
+            }
+        }
+
+        /* continues with the last pending subtree */
+        if (ts->count == 0)
+            return 1;
+        p = ts->stack[--ts->top % PCB_TRAVERSE_STACK_DEPTH];
+        ts->count--;
+    }
+}
+
+
+/** Traverses a subtree in order, executing a callback over every leaf.
+ *
+ *  \param t Critbit tree.
+ *  \param r Root node.
+ *  \param first First leaf to visit (0 to start from the smallest one, or
+ *         the biggest one in reverse order).
+ *  \param rev 1 to traverse in reverse order, 0 otherwise.
+ *  \param visit Callback to be executed over every leaf.
+ *  \param ctx Context for \a visit.
+ *  \return 1 if the iteration was completed successfully, 0 otherwise.
+ *  \note See _traverse_from().
+ */
+static int _traverse(const pcb_t *t, pcb_ptr_t r, pcb_ptr_t first, int rev, int (*visit)(const pcb_t *t, pcb_ptr_t p, void *ctx), void *ctx)
+{
+    pcb_traverse_t ts;
+    ts.top = ts.count = 0;
+    ts.lost = 0;
+
+    /* starting from a leaf, the subtrees following it are pending */
+    pcb_ptr_t p = r;
+    if (first != 0)
+    {
+        _traverse_push_following(t, &ts, r, first, rev);
+        p = first;
+    }
+    return _traverse_from(t, r, &ts, p, rev, visit, ctx);
+}
+
+
+/** Starts an in order traversal at the smallest string not smaller than a
+ *  given one.
+ *
+ *  \param t Critbit tree.
+ *  \param r Root node.
+ *  \param ts Traversal state, empty (output).
+ *  \param s Lower bound.
+ *  \param s_len Length of \a s.
+ *  \return First subtree to walk (0 if there is none, to start with the
+ *          pending ones).
+ *  \note The right siblings are pushed while descending with \a s. Once the
+ *        leaf gives the critical bit, the ones pushed below it are dropped:
+ *        that subtree is either walked first or skipped as a whole. Only if
+ *        the rings overflow the tree is descended again.
+ */
+static pcb_ptr_t _traverse_lower_bound(const pcb_t *t, pcb_ptr_t r, pcb_traverse_t *ts, const char *s, size_t s_len)
+{
+    /* descends, keeping the nodes and pushing the right siblings */
+    pcb_ptr_t path[PCB_TRAVERSE_STACK_DEPTH];
+    size_t depth = 0;
+    pcb_ptr_t p = r;
+    while (_is_node_ptr(p))
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, p);
+        path[depth++ % PCB_TRAVERSE_STACK_DEPTH] = p;
+        int dir = _get_direction(n, s, s_len);
+        if (dir == 0)
+            _traverse_push(t, ts, _get_child(n, 1));
+        p = _get_child(n, dir);
+    }
+
+    /* if the leaf is s, it's the first one and every pushed sibling follows */
+    if (_leaf_matches(t, p, s, s_len))
+        return p;
+
+    /* drops the siblings pushed below the critical bit */
+    size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, p), _get_leaf_len(t, p), s, s_len);
+    size_t i = depth;
+    while (i > 0 && i + PCB_TRAVERSE_STACK_DEPTH > depth)
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, path[(i - 1) % PCB_TRAVERSE_STACK_DEPTH]);
+        if (_get_cb_pos(n) < cb_pos)
+            break;
+        p = path[--i % PCB_TRAVERSE_STACK_DEPTH];
+        if (_get_direction(n, s, s_len) == 0)
+        {
+            ts->top--;
+            ts->count--;
+        }
+    }
+
+    /* if nodes or siblings were lost, pushes them again up to the critical
+       bit */
+    if (ts->lost || (i > 0 && i + PCB_TRAVERSE_STACK_DEPTH <= depth))
+    {
+        ts->top = ts->count = 0;
+        ts->lost = 0;
+        p = r;
+        while (_is_node_ptr(p) && _get_cb_pos(_get_const_node_ptr(t, p)) < cb_pos)
+        {
+            const pcb_node_t *n = _get_const_node_ptr(t, p);
+            int dir = _get_direction(n, s, s_len);
+            if (dir == 0)
+                _traverse_push(t, ts, _get_child(n, 1));
+            p = _get_child(n, dir);
+        }
+    }
+
+    /* below the critical bit, the strings are either all bigger than s or
+       all smaller */
+    return _get_bit(s, s_len, cb_pos) ? 0 : p;
+}
+
+
+/** Map callback traversal context type. */
+typedef struct
+{
+    /** Map callback. */
+    int (*cb)(const char *s, pcb_value_t *v, void *ctx);
+
+    /** Map callback context. */
+    void *ctx;
+
+} pcb_map_cb_t;
+
+
+/** Visits a leaf by executing a map callback.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \param ctx Map callback traversal context.
+ *  \return Map callback result.
+ */
+static int _map_cb_visit(const pcb_t *t, pcb_ptr_t p, void *ctx)
+{
+    const pcb_map_cb_t *map_cb = ctx;
+    return map_cb->cb(_get_leaf_str(t, p), _get_leaf_value(t, p), map_cb->ctx);
+}
+
+
+#if !PCB_SUBTREE_COUNTS
+/** Counts a leaf in a traversal.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \param ctx Leaf counter.
+ *  \return 1.
+ */
+static int _count_leaf_visit(const pcb_t *t, pcb_ptr_t p, void *ctx)
+{
+    (void)t;
+    (void)p;
+    (*(size_t *)ctx)++;
+    return 1;
+}
+#endif
+
+
+/** Gets the number of leaves in a subtree.
+ *
+ *  \param t Critbit tree.
+ *  \param p Subtree root (0 if empty).
+ *  \return Number of leaves.
+ *  \note With \c PCB_SUBTREE_COUNTS it's kept in the internal nodes,
+ *        otherwise the subtree gets traversed.
+ */
+static size_t _get_num_leaves(const pcb_t *t, pcb_ptr_t p)
+{
+    if (p == 0)
+        return 0;
+    if (!_is_node_ptr(p))
+        return 1;
+#if PCB_SUBTREE_COUNTS
+    return __atomic_load_n(&_get_const_node_ptr(t, p)->used.num_leaves, __ATOMIC_RELAXED);
+#else
+    size_t count = 0;
+    _traverse(t, p, 0, 0, _count_leaf_visit, &count);
+    return count;
+#endif
+}
+
+
+#if PCB_SUBTREE_COUNTS
+/** Sets the number of leaves below an internal node.
+ *
+ *  \param n PCB node.
+ *  \param num_leaves Number of leaves.
+ *  \note It's stored atomically, as readers can be loading it.
+ */
+static void _set_num_leaves(pcb_node_t *n, size_t num_leaves)
+{
+    __atomic_store_n(&n->used.num_leaves, num_leaves, __ATOMIC_RELAXED);
+}
+
+
+/** Updates the number of leaves along the path of a string.
+ *
+ *  \param t Critbit tree.
+ *  \param path Indices of the first internal nodes in the path (up to
+ *         \c PCB_PATH_STACK_DEPTH of them).
+ *  \param depth Number of internal nodes to be updated.
+ *  \param s String.
+ *  \param s_len Length of \a s.
+ *  \param delta Number of leaves added (negative if removed).
+ *  \note The nodes below the recorded path are found again from the last
+ *        recorded one.
+ */
+static void _update_num_leaves(pcb_t *t, const size_t *path, size_t depth, const char *s, size_t s_len, int delta)
+{
+    pcb_node_t *n = NULL;
+    for (size_t i = 0; i < depth; i++)
+    {
+        if (i < PCB_PATH_STACK_DEPTH)
+            n = _get_pool_node(t, path[i]);
+        else
+            n = _get_node_ptr(t, n->used.children[_get_direction(n, s, s_len)]);
+        _set_num_leaves(n, n->used.num_leaves + delta);
+    }
+}
+
+
+/** Sets the number of leaves of every internal node in a subtree.
+ *
+ *  \param t Critbit tree.
+ *  \param r Subtree root.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note The nodes are visited in post-order, keeping their indices in a
+ *        stack with the lowest bit set once their children were pushed.
+ */
+static int _init_num_leaves(pcb_t *t, pcb_ptr_t r)
+{
+    if (!_is_node_ptr(r))
+        return 1;
+    size_t stack_size = 64, depth = 0;
+    size_t *stack = malloc(stack_size * sizeof(size_t));
+    if (stack == NULL)
+        return 0;
+    stack[depth++] = (size_t)(r >> 1) << 1;
+    while (depth > 0)
+    {
+        /* both children are done, so sums them */
+        size_t e = stack[depth - 1];
+        pcb_node_t *n = _get_pool_node(t, e >> 1);
+        if (e & 1)
+        {
+            _set_num_leaves(n, _get_num_leaves(t, n->used.children[0]) + _get_num_leaves(t, n->used.children[1]));
+            depth--;
+            continue;
+        }
+
+        /* pushes the children first */
+        if (depth + 2 > stack_size)
+        {
+            size_t *ns = realloc(stack, 2 * stack_size * sizeof(size_t));
+            if (ns == NULL)
+            {
+                free(stack);
+                return 0;
+            }
+            stack = ns;
+            stack_size *= 2;
+        }
+        stack[depth - 1] |= 1;
+        for (int dir = 0; dir < 2; dir++)
+            if (_is_node_ptr(n->used.children[dir]))
+                stack[depth++] = (size_t)(n->used.children[dir] >> 1) << 1;
+    }
+    free(stack);
+    return 1;
+}
+#endif
+
+
+/** Creates a critbit.
+ *
+ *  \return Newly created critbit or \c NULL in case of error.
+ */
+pcb_t *pcb_create(void)
+{
+    /* allocates the memory for the PCB */
+    pcb_t *t = malloc(sizeof(pcb_t));
+    if (t == NULL)
+        return t;
+
+    /* the root starts cleared */
+    t->root = 0;
+
+    /* initializes the allocation lock */
+    if (pthread_mutex_init(&t->alloc_lock, NULL) != 0)
+    {
+        free(t);
+        return NULL;
+    }
+
+    /* the string arena starts empty */
+    _arena_init(&t->arena);
+
+    /* there are no readers nor retired nodes */
+    t->readers = NULL;
+    t->num_readers = 0;
+    t->epoch = 1;
+    t->retired = NULL;
+    t->num_retired = 0;
+    t->retired_size = 0;
+
+    /* the pool starts empty */
+    _init_pool(t);
+
+    /* returns the PCB */
+    return t;
+}
+
+
+/** Destroys a critbit.
+ *
+ *  \param t Critbit tree to be destroyed.
+ *  \note There must not be active readers. Its reader handles are
+ *        released too.
+ */
+void pcb_destroy(pcb_t *t)
+{
+    /* first clears it */
+    pcb_clear(t);
+
+    /* then releases the memory */
+    while (t->readers != NULL)
+    {
+        pcb_reader_t *r = t->readers;
+        t->readers = r->next;
+        free(r);
+    }
+    free(t->retired);
+    _free_pool(t);
+    pthread_mutex_destroy(&t->alloc_lock);
+    free(t);
+}
+
+
+/** Registers a reader of a critbit.
+ *
+ *  \param t Critbit tree.
+ *  \return Reader handle or \c NULL in case of error.
+ *  \note It can be called from any thread. Each reader handle must be used
+ *        by only one thread at a time, bracketing its queries with
+ *        pcb_read_begin() and pcb_read_end(); while any reader is
+ *        registered, removed leaves and nodes are released only when no
+ *        read section can still see them.
+ */
+pcb_reader_t *pcb_reader_create(pcb_t *t)
+{
+    /* reuses a released handle if possible */
+    pcb_reader_t *r;
+    for (r = __atomic_load_n(&t->readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&r->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    /* otherwise, pushes a new one */
+    if (r == NULL)
+    {
+        r = malloc(sizeof(pcb_reader_t));
+        if (r == NULL)
+            return NULL;
+        r->t = t;
+        r->epoch = 0;
+        r->in_use = 1;
+        r->next = __atomic_load_n(&t->readers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&t->readers, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    /* from now on, the writer defers releases */
+    __atomic_add_fetch(&t->num_readers, 1, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+
+/** Unregisters a reader.
+ *
+ *  \param r Reader handle (outside of a read section).
+ */
+void pcb_reader_destroy(pcb_reader_t *r)
+{
+    __atomic_sub_fetch(&r->t->num_readers, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+
+/** Enters a read section.
+ *
+ *  \param r Reader handle.
+ *  \note The leaves and nodes reachable during the section stay valid until
+ *        pcb_read_end(), even if the writer removes them. The strings
+ *        returned by queries follow the same rule.
+ */
+void pcb_read_begin(pcb_reader_t *r)
+{
+    /* publishes the epoch before reading anything */
+    __atomic_store_n(&r->epoch, __atomic_load_n(&r->t->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
+/** Exits a read section.
+ *
+ *  \param r Reader handle.
+ */
+void pcb_read_end(pcb_reader_t *r)
+{
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+
+/** Makes sure that a number of never used nodes are available in the pool.
+ *
+ *  \param t Critbit tree.
+ *  \param num_nodes Number of nodes.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note They are the nodes from \c first_new_node on, so they can be taken
+ *        in order without going through _get_free_pcb_node().
+ */
+static int _reserve_new_nodes(pcb_t *t, size_t num_nodes)
+{
+    if (num_nodes > PCB_MAX_NUM_NODES - t->first_new_node)
+        return 0;
+    while (t->first_new_node + num_nodes > t->num_total_nodes)
+        if (!_add_segment(t))
+            return 0;
+    return 1;
+}
+
+
+/** Creates a leaf in a reserved range of the pool.
+ *
+ *  \param t Critbit tree.
+ *  \param a String arena for long strings.
+ *  \param s String contents.
+ *  \param s_len Length of \a s.
+ *  \param next Next reserved node (in/out).
+ *  \return Leaf base pointer or 0 in case of error.
+ *  \note The value starts zero-initialized.
+ */
+static pcb_ptr_t _create_leaf_reserved(pcb_t *t, pcb_arena_t *a, const char *s, size_t s_len, size_t *next)
+{
+    /* long strings go to the arena */
+    if (s_len >= sizeof(((pcb_node_t *)NULL)->leaf.s))
+    {
+        size_t num_blocks = _calc_string_node_blocks(s_len);
+        char *p = _arena_alloc(a, num_blocks);
+        if (p == NULL)
+            return 0;
+        memset(p + (num_blocks - 1) * PCB_BLOCK_SIZE, 0, PCB_BLOCK_SIZE);
+        pcb_string_node_t *sn = (pcb_string_node_t *)p;
+        sn->value = (pcb_value_t){ 0 };
+        sn->len = s_len;
+        memcpy(sn->s, s, s_len);
+#if PCB_COMPACT_NODES
+        /* compact pointers cannot hold it, so it's referenced from a node */
+        size_t i = (*next)++;
+        _get_pool_node(t, i)->ext.sn = sn;
+        return (pcb_ptr_t)i << 2;
+#else
+        return (pcb_ptr_t)sn;
+#endif
+    }
+
+    /* short ones are stored in a pool node */
+    size_t i = (*next)++;
+    _init_inline_leaf(_get_pool_node(t, i), s, s_len);
+    return _get_inline_leaf_base_ptr(i);
+}
+
+
+/** Builds a critbit subtree from sorted strings.
+ *
+ *  \param t Critbit tree.
+ *  \param a String arena for long strings.
+ *  \param keys Strings, sorted in increasing order.
+ *  \param lens Lengths of the strings (\c NULL if NUL terminated).
+ *  \param n Number of strings (at least one).
+ *  \param dedup 1 to skip repeated strings, 0 to reject them.
+ *  \param next Next reserved node (in/out, up to <tt>2 * n - 1</tt> nodes are
+ *         taken).
+ *  \param root Subtree root (output).
+ *  \param stack Right spine stack (output, to be released by the caller).
+ *  \return 1 if successful, 0 otherwise.
+ *  \note The nodes are taken in key order from a range reserved in advance,
+ *        so many subtrees can be built at the same time.
+ */
+static int _build_sorted(pcb_t *t, pcb_arena_t *a, const char *const *keys, const size_t *lens, size_t n,
+                         int dedup, size_t *next, pcb_ptr_t *root, size_t **stack)
+{
+    /* right spine stack, as node indices */
+    size_t stack_size = 64, depth = 0;
+    *stack = malloc(stack_size * sizeof(size_t));
+    if (*stack == NULL)
+        return 0;
+
+    /* the first string is the initial root */
+    size_t prev_len = lens != NULL ? lens[0] : strlen(keys[0]);
+#if PCB_COMPACT_NODES
+    if (prev_len > UINT32_MAX)
+        return 0;
+#endif
+    *root = _create_leaf_reserved(t, a, keys[0], prev_len, next);
+    if (*root == 0)
+        return 0;
+
+    /* adds the others at the right of the spine */
+    for (size_t i = 1; i < n; i++)
+    {
+        /* the string must be bigger than the previous one */
+        size_t s_len = lens != NULL ? lens[i] : strlen(keys[i]);
+#if PCB_COMPACT_NODES
+        if (s_len > UINT32_MAX)
+            return 0;
+#endif
+        if (dedup && s_len == prev_len && memcmp(keys[i - 1], keys[i], s_len) == 0)
+            continue;
+        size_t cb_pos = _get_critbit_pos(keys[i - 1], prev_len, keys[i], s_len);
+        if (!_get_bit(keys[i], s_len, cb_pos))
+            return 0;
+        prev_len = s_len;
+
+        /* gets the nodes */
+        size_t nd_idx = (*next)++;
+        pcb_node_t *nd = _get_pool_node(t, nd_idx);
+        pcb_ptr_t l = _create_leaf_reserved(t, a, keys[i], s_len, next);
+        if (l == 0)
+            return 0;
+
+        /* closes the spine nodes below the critbit */
+        pcb_ptr_t sub = depth > 0 ? _get_pool_node(t, (*stack)[depth - 1])->used.children[1] : *root;
+        while (depth > 0 && _get_cb_pos(_get_pool_node(t, (*stack)[depth - 1])) > cb_pos)
+            sub = _get_base_ptr((*stack)[--depth]);
+
+        /* hangs the new node from the spine */
+        _set_cb_pos(nd, cb_pos);
+        nd->used.children[0] = sub;
+        nd->used.children[1] = l;
+        if (depth > 0)
+            _get_pool_node(t, (*stack)[depth - 1])->used.children[1] = _get_base_ptr(nd_idx);
+        else
+            *root = _get_base_ptr(nd_idx);
+
+        /* pushes it */
+        if (depth == stack_size)
+        {
+            size_t *ns = realloc(*stack, 2 * stack_size * sizeof(size_t));
+            if (ns == NULL)
+                return 0;
+            *stack = ns;
+            stack_size *= 2;
+        }
+        (*stack)[depth++] = nd_idx;
+    }
+
+    /* success */
+    return 1;
+}
+
+
+/** Builds a critbit from sorted strings with explicit lengths.
+ *
+ *  \param keys Strings, sorted in increasing order and without duplicates.
+ *  \param lens Lengths of the strings (\c NULL if NUL terminated).
+ *  \param n Number of strings.
+ *  \return Newly created critbit or \c NULL if the strings are not sorted or
+ *          in case of error.
+ */
+static pcb_t *_build_sorted_len(const char *const *keys, const size_t *lens, size_t n)
+{
+    /* creates the critbit */
+    pcb_t *t = pcb_create();
+    if (t == NULL || n == 0)
+        return t;
+
+    /* builds the tree on enough nodes for every leaf and internal node */
+    size_t *stack = NULL;
+    size_t next = t->first_new_node;
+    int ok = n <= PCB_MAX_NUM_NODES / 2 && _reserve_new_nodes(t, 2 * n) &&
+             _build_sorted(t, &t->arena, keys, lens, n, 0, &next, &t->root, &stack);
+    free(stack);
+#if PCB_SUBTREE_COUNTS
+    ok = ok && _init_num_leaves(t, t->root);
+#endif
+    if (!ok)
+    {
+        pcb_destroy(t);
+        return NULL;
+    }
+    t->num_used_nodes += next - t->first_new_node;
+    t->first_new_node = next;
+    return t;
+}
+
+
+/** Builds a critbit from sorted strings.
+ *
+ *  \param keys Strings, sorted in increasing order and without duplicates.
+ *  \param n Number of strings.
+ *  \return Newly created critbit or \c NULL if the strings are not sorted or
+ *          in case of error.
+ *  \note The tree is built in a single pass, keeping its right spine in a
+ *        stack: the critbit between each pair of adjacent strings determines
+ *        how much of the spine gets closed under the new internal node. The
+ *        nodes are taken from the pool in key order.
+ */
+pcb_t *pcb_build_sorted(const char *const *keys, size_t n)
+{
+    return _build_sorted_len(keys, NULL, n);
+}
+
+
+/** Moves the strings of an arena to another one.
+ *
+ *  \param a Destination string arena.
+ *  \param b Source string arena (left empty).
+ *  \note The last chunk of \a a stays last, so it keeps being filled; the
+ *        unused tail of the last chunk of \a b is released to the free lists.
+ */
+static void _arena_merge(pcb_arena_t *a, pcb_arena_t *b)
+{
+    /* takes the chunks */
+    if (b->last_chunk != NULL)
+    {
+        size_t tail_num_blocks = (PCB_ARENA_CHUNK_SIZE - b->last_chunk_used) / PCB_BLOCK_SIZE;
+        while (tail_num_blocks > 0)
+        {
+            /* it's released in pieces that fit the size classes */
+            size_t num_blocks = tail_num_blocks < PCB_ARENA_NUM_CLASSES ? tail_num_blocks : PCB_ARENA_NUM_CLASSES - 1;
+            tail_num_blocks -= num_blocks;
+            _arena_free(b, b->last_chunk->data + b->last_chunk_used + tail_num_blocks * PCB_BLOCK_SIZE, num_blocks);
+        }
+        if (a->last_chunk == NULL)
+        {
+            a->last_chunk = b->last_chunk;
+            a->last_chunk_used = PCB_ARENA_CHUNK_SIZE;
+        }
+        else
+        {
+            pcb_arena_chunk_t *first = b->last_chunk;
+            while (first->prev != NULL)
+                first = first->prev;
+            first->prev = a->last_chunk->prev;
+            a->last_chunk->prev = b->last_chunk;
+        }
+    }
+
+    /* takes the large strings */
+    if (b->large_strings != NULL)
+    {
+        pcb_large_string_t *last = b->large_strings;
+        while (last->next != NULL)
+            last = last->next;
+        last->next = a->large_strings;
+        if (a->large_strings != NULL)
+            a->large_strings->prev = last;
+        a->large_strings = b->large_strings;
+    }
+
+    /* takes the free strings */
+    for (size_t i = 0; i < PCB_ARENA_NUM_CLASSES; i++)
+    {
+        while (b->free_strings[i] != NULL)
+        {
+            char *p = b->free_strings[i];
+            memcpy(&b->free_strings[i], p, sizeof(char *));
+            _arena_free(a, p, i);
+        }
+    }
+
+    /* leaves it empty */
+    _arena_init(b);
+}
+
+
+/** Task group type. */
+typedef struct
+{
+    /** Number of tasks. */
+    size_t num_tasks;
+
+    /** Next task to be taken by any thread. */
+    size_t next_task;
+
+    /** Task function. */
+    void (*run)(void *ctx, size_t i);
+
+    /** Context for the task function. */
+    void *ctx;
+
+} pcb_tasks_t;
+
+
+/** Takes tasks until none is left.
+ *
+ *  \param arg Tasks.
+ *  \return \c NULL.
+ */
+static void *_tasks_thread(void *arg)
+{
+    pcb_tasks_t *ts = arg;
+    for (size_t i; (i = __atomic_fetch_add(&ts->next_task, 1, __ATOMIC_RELAXED)) < ts->num_tasks; )
+        ts->run(ts->ctx, i);
+    return NULL;
+}
+
+
+/** Runs tasks on a group of threads.
+ *
+ *  \param num_tasks Number of tasks.
+ *  \param num_threads Number of threads (the calling one included).
+ *  \param run Task function, called with the task index.
+ *  \param ctx Context for the task function.
+ *  \note The threads take the tasks in order, as they become idle. If some
+ *        threads cannot be created, the others run their share.
+ */
+static void _run_tasks(size_t num_tasks, size_t num_threads, void (*run)(void *ctx, size_t i), void *ctx)
+{
+    pcb_tasks_t ts = { num_tasks, 0, run, ctx };
+    pthread_t threads[PCB_MAX_THREADS];
+    size_t num_started = 0;
+    while (num_started + 1 < num_threads && num_started < PCB_MAX_THREADS &&
+           pthread_create(&threads[num_started], NULL, _tasks_thread, &ts) == 0)
+        num_started++;
+    _tasks_thread(&ts);
+    for (size_t i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+
+/** Compares two strings, for qsort().
+ *
+ *  \param p Pointer to the first string.
+ *  \param q Pointer to the second string.
+ *  \return Comparison result (it matches the critbit order).
+ */
+static int _str_cmp(const void *p, const void *q)
+{
+    return strcmp(*(const char *const *)p, *(const char *const *)q);
+}
+
+
+/** Parallel build state. */
+typedef struct
+{
+    /** Critbit tree. */
+    pcb_t *t;
+
+    /** Strings (sorted during the build). */
+    const char **keys;
+
+    /** Merge buffer. */
+    const char **buf;
+
+    /** Number of strings. */
+    size_t n;
+
+    /** Number of parts (sorting runs and subtrees). */
+    size_t num_parts;
+
+    /** Run length of the current merge round (in parts). */
+    size_t run_parts;
+
+    /** First reserved node. */
+    size_t base;
+
+    /** Per part state. */
+    struct
+    {
+        /** First string. */
+        size_t first;
+
+        /** End of the strings. */
+        size_t end;
+
+        /** Subtree root (0 if it has no strings of its own). */
+        pcb_ptr_t root;
+
+        /** Next reserved node. */
+        size_t next;
+
+        /** String arena. */
+        pcb_arena_t arena;
+
+        /** 1 if the task succeeded, 0 otherwise. */
+        int ok;
+
+    } *parts;
+
+} pcb_parallel_build_t;
+
+
+/** Sorts the strings of a part.
+ *
+ *  \param ctx Parallel build state.
+ *  \param i Part index.
+ */
+static void _sort_part_task(void *ctx, size_t i)
+{
+    pcb_parallel_build_t *pb = ctx;
+    qsort(pb->keys + pb->parts[i].first, pb->parts[i].end - pb->parts[i].first, sizeof(const char *), _str_cmp);
+}
+
+
+/** Merges a piece of two sorted runs.
+ *
+ *  \param ctx Parallel build state.
+ *  \param i Part index: the output range of the part is filled.
+ *  \note The piece of the left run is the one starting in the part, and
+ *        the matching piece of the right run is found by binary search, so
+ *        every part of a merge is done in parallel.
+ */
+static void _merge_part_task(void *ctx, size_t i)
+{
+    pcb_parallel_build_t *pb = ctx;
+
+    /* gets the runs */
+    size_t run = i / (2 * pb->run_parts) * (2 * pb->run_parts);
+    size_t l_first = pb->parts[run].first;
+    size_t mid_part = run + pb->run_parts < pb->num_parts ? run + pb->run_parts : pb->num_parts;
+    size_t end_part = run + 2 * pb->run_parts < pb->num_parts ? run + 2 * pb->run_parts : pb->num_parts;
+    size_t r_first = pb->parts[mid_part - 1].end;
+    size_t r_end = pb->parts[end_part - 1].end;
+
+    /* finds the output range of this part in both runs */
+    size_t lo[2], hi[2];
+    for (int k = 0; k < 2; k++)
+    {
+        size_t out = k == 0 ? pb->parts[i].first : pb->parts[i].end;
+        size_t b_lo = out - l_first > r_end - r_first ? out - l_first - (r_end - r_first) : 0;
+        size_t b_hi = out - l_first < r_first - l_first ? out - l_first : r_first - l_first;
+        /* binary searches the number of left strings taken */
+        while (b_lo < b_hi)
+        {
+            size_t li = b_lo + (b_hi - b_lo) / 2;
+            size_t ri = out - l_first - li;
+            /* too few left strings if the next left one goes before the
+               last right one taken (left strings go first on ties) */
+            if (ri > 0 && strcmp(pb->keys[l_first + li], pb->keys[r_first + ri - 1]) <= 0)
+                b_lo = li + 1;
+            else
+                b_hi = li;
+        }
+        lo[k] = l_first + b_lo;
+        hi[k] = r_first + (out - l_first - b_lo);
+    }
+
+    /* merges the pieces */
+    size_t li = lo[0], ri = hi[0], out = pb->parts[i].first;
+    while (li < lo[1] && ri < hi[1])
+        pb->buf[out++] = strcmp(pb->keys[li], pb->keys[ri]) <= 0 ? pb->keys[li++] : pb->keys[ri++];
+    while (li < lo[1])
+        pb->buf[out++] = pb->keys[li++];
+    while (ri < hi[1])
+        pb->buf[out++] = pb->keys[ri++];
+}
+
+
+/** Builds the subtree of a part.
+ *
+ *  \param ctx Parallel build state.
+ *  \param i Part index.
+ *  \note The strings repeated from the previous part are skipped, and the
+ *        nodes are taken from the range reserved for the part (two nodes per
+ *        string, starting at the position of its first string).
+ */
+static void _build_part_task(void *ctx, size_t i)
+{
+    pcb_parallel_build_t *pb = ctx;
+
+    /* skips the strings of the previous part */
+    size_t first = pb->parts[i].first;
+    while (first > 0 && first < pb->parts[i].end && strcmp(pb->keys[first - 1], pb->keys[first]) == 0)
+        first++;
+
+    /* builds the subtree */
+    size_t start = pb->base + 2 * pb->parts[i].first;
+    pb->parts[i].next = start;
+    pb->parts[i].root = 0;
+    pb->parts[i].ok = 1;
+    if (first < pb->parts[i].end)
+    {
+        size_t *stack = NULL;
+        pb->parts[i].ok = _build_sorted(pb->t, &pb->parts[i].arena, pb->keys + first, NULL, pb->parts[i].end - first,
+                                        1, &pb->parts[i].next, &pb->parts[i].root, &stack);
+        free(stack);
+    }
+
+    /* links the unused reserved nodes */
+    size_t end = pb->base + 2 * pb->parts[i].end;
+    for (size_t j = pb->parts[i].next; j < end; j++)
+        _get_pool_node(pb->t, j)->free.next_free_node = j + 1 < end ? j + 1 : SIZE_MAX;
+}
+
+
+/** Joins two adjacent subtrees.
+ *
+ *  \param t Critbit tree.
+ *  \param x Subtree with the smaller strings.
+ *  \param y Subtree with the bigger strings.
+ *  \param cb_pos Critbit between the last string of \a x and the first one of
+ *         \a y.
+ *  \param nd_idx Index of the internal node to be added.
+ *  \return Root of the joined subtree.
+ *  \note The right spine of \a x and the left spine of \a y are zipped by
+ *        critbit position, down to where the new node goes.
+ */
+static pcb_ptr_t _join_subtrees(pcb_t *t, pcb_ptr_t x, pcb_ptr_t y, size_t cb_pos, size_t nd_idx)
+{
+    pcb_ptr_t root, *hole = &root;
+    while (1)
+    {
+        size_t cx = _is_node_ptr(x) ? _get_cb_pos(_get_node_ptr(t, x)) : SIZE_MAX;
+        size_t cy = _is_node_ptr(y) ? _get_cb_pos(_get_node_ptr(t, y)) : SIZE_MAX;
+        if (cb_pos < cx && cb_pos < cy)
+            break;
+        if (cx < cy)
+        {
+            *hole = x;
+            hole = &_get_node_ptr(t, x)->used.children[1];
+            x = *hole;
+        }
+        else
+        {
+            *hole = y;
+            hole = &_get_node_ptr(t, y)->used.children[0];
+            y = *hole;
+        }
+    }
+    pcb_node_t *nd = _get_pool_node(t, nd_idx);
+    _set_cb_pos(nd, cb_pos);
+    nd->used.children[0] = x;
+    nd->used.children[1] = y;
+    *hole = _get_base_ptr(nd_idx);
+    return root;
+}
+
+
+/** Builds a critbit from strings in any order, using several threads.
+ *
+ *  \param keys Strings (they can be repeated).
+ *  \param n Number of strings.
+ *  \param num_threads Number of threads (the calling one included).
+ *  \return Newly created critbit or \c NULL in case of error.
+ *  \note The strings are split in parts that are sorted in parallel and
+ *        merged in rounds, with each merge split by binary search to keep
+ *        every thread busy. Then the subtree of each part is built in
+ *        parallel, in its own range of the pool and with its own string
+ *        arena, and the subtrees are joined along their spines. The result
+ *        has the same strings as adding them one by one.
+ */
+pcb_t *pcb_build_parallel(const char *const *keys, size_t n, size_t num_threads)
+{
+    /* creates the critbit */
+    pcb_t *t = pcb_create();
+    if (t == NULL || n == 0)
+        return t;
+
+    /* initializes the state, with several parts per thread to balance them */
+    if (num_threads == 0)
+        num_threads = 1;
+    size_t num_parts = num_threads < PCB_MAX_THREADS ? 4 * num_threads : 4 * PCB_MAX_THREADS;
+    if (num_parts > n)
+        num_parts = n;
+    pcb_parallel_build_t pb = { t, malloc(n * sizeof(const char *)), malloc(n * sizeof(const char *)), n, num_parts,
+                                0, t->first_new_node, calloc(num_parts, sizeof(*pb.parts)) };
+    int ok = pb.keys != NULL && pb.buf != NULL && pb.parts != NULL &&
+             n <= (PCB_MAX_NUM_NODES - num_parts) / 2 && _reserve_new_nodes(t, 2 * n + num_parts);
+    if (ok)
+    {
+        memcpy(pb.keys, keys, n * sizeof(const char *));
+        for (size_t i = 0; i < num_parts; i++)
+        {
+            pb.parts[i].first = i * n / num_parts;
+            pb.parts[i].end = (i + 1) * n / num_parts;
+            _arena_init(&pb.parts[i].arena);
+        }
+
+        /* sorts the parts and merges them */
+        _run_tasks(num_parts, num_threads, _sort_part_task, &pb);
+        for (pb.run_parts = 1; pb.run_parts < num_parts; pb.run_parts *= 2)
+        {
+            _run_tasks(num_parts, num_threads, _merge_part_task, &pb);
+            const char **tmp = pb.keys;
+            pb.keys = pb.buf;
+            pb.buf = tmp;
+        }
+
+        /* builds the subtrees */
+        _run_tasks(num_parts, num_threads, _build_part_task, &pb);
+        for (size_t i = 0; i < num_parts; i++)
+            ok = ok && pb.parts[i].ok;
+    }
+
+    /* joins them, in order */
+    size_t next = pb.base + 2 * n;
+    for (size_t i = 0; ok && i < num_parts; i++)
+    {
+        if (pb.parts[i].root == 0)
+            continue;
+        if (t->root == 0)
+        {
+            t->root = pb.parts[i].root;
+            continue;
+        }
+        size_t j = pb.parts[i].first;
+        while (strcmp(pb.keys[j - 1], pb.keys[j]) == 0)
+            j++;
+        size_t cb_pos = _get_critbit_pos(pb.keys[j - 1], strlen(pb.keys[j - 1]), pb.keys[j], strlen(pb.keys[j]));
+        t->root = _join_subtrees(t, t->root, pb.parts[i].root, cb_pos, next++);
+    }
+#if PCB_SUBTREE_COUNTS
+    ok = ok && _init_num_leaves(t, t->root);
+#endif
+
+    /* completes the pool and the arena */
+    if (ok)
+    {
+        t->num_used_nodes += next - 2 * n - pb.base;
+        for (size_t i = num_parts; i-- > 0;)
+        {
+            size_t end = pb.base + 2 * pb.parts[i].end;
+            t->num_used_nodes += pb.parts[i].next - (pb.base + 2 * pb.parts[i].first);
+            if (pb.parts[i].next < end)
+            {
+                _get_pool_node(t, end - 1)->free.next_free_node = t->first_free_node;
+                t->first_free_node = pb.parts[i].next;
+            }
+        }
+        t->first_new_node = next;
+    }
+    if (pb.parts != NULL)
+    {
+        for (size_t i = 0; i < num_parts; i++)
+            _arena_merge(&t->arena, &pb.parts[i].arena);
+    }
+    free(pb.parts);
+    free(pb.keys);
+    free(pb.buf);
+    if (!ok)
+    {
+        pcb_destroy(t);
+        return NULL;
+    }
+    return t;
+}
+
+
+/** Copies the node or leaf slot referenced by a base pointer into the next
+ *  slot of a new pool.
+ *
+ *  \param t Critbit tree.
+ *  \param nt Critbit tree with the new pool.
+ *  \param p Base pointer in \a t.
+ *  \return Base pointer in \a nt or 0 in case of error.
+ */
+static pcb_ptr_t _relocate_ptr(const pcb_t *t, pcb_t *nt, pcb_ptr_t p)
+{
+    /* out-of-line leaves only take a slot with compact nodes */
+    if (!_is_node_ptr(p) && !_is_inline_leaf_ptr(p) && !PCB_COMPACT_NODES)
+        return p;
+
+    /* copies the slot */
+    size_t i;
+    pcb_node_t *n = _get_free_pcb_node(nt, &i);
+    if (n == NULL)
+        return 0;
+    if (_is_node_ptr(p))
+    {
+        *n = *_get_const_node_ptr(t, p);
+        return _get_base_ptr(i);
+    }
+    *n = *_get_leaf_node(t, p);
+    return ((pcb_ptr_t)i << 2) | (p & 2);
+}
+
+
+/** Compacts a critbit, moving its nodes to a dense pool.
+ *
+ *  \param t Critbit tree.
+ *  \return 1 if successful, 0 otherwise (the critbit is left unchanged).
+ *  \note The nodes are placed in depth-first order, with both children of
+ *        every internal node in consecutive slots, and only the segments
+ *        needed to hold them are kept. Strings are not moved. There must not
+ *        be active readers.
+ */
+int pcb_compact(pcb_t *t)
+{
+    /* the retired strings are kept in the arena, so releases them now */
+    _reclaim_all(t);
+
+    /* the new pool is built in a temporary critbit without readers */
+    pcb_t nt_pool, *nt = &nt_pool;
+    _init_pool(nt);
+    nt->readers = NULL;
+    nt->num_readers = 0;
+    nt->retired = NULL;
+    nt->num_retired = 0;
+    nt->retired_size = 0;
+
+    /* stack of relocated internal nodes whose children are still pending */
+    size_t stack_size = 64, depth = 0;
+    size_t *stack = malloc(stack_size * sizeof(size_t));
+    int ok = stack != NULL;
+
+    /* relocates the nodes, going down the left side first */
+    nt->root = ok && t->root != 0 ? _relocate_ptr(t, nt, t->root) : 0;
+    ok = ok && (nt->root != 0 || t->root == 0);
+    if (ok && _is_node_ptr(nt->root))
+        stack[depth++] = (size_t)(nt->root >> 1);
+    while (ok && depth > 0)
+    {
+        /* the stack can hold both children */
+        if (depth + 2 > stack_size)
+        {
+            size_t *ns = realloc(stack, 2 * stack_size * sizeof(size_t));
+            if (ns == NULL)
+            {
+                ok = 0;
+                break;
+            }
+            stack = ns;
+            stack_size *= 2;
+        }
+
+        /* relocates the children together */
+        pcb_node_t *n = _get_pool_node(nt, stack[--depth]);
+        n->used.children[0] = _relocate_ptr(t, nt, n->used.children[0]);
+        n->used.children[1] = _relocate_ptr(t, nt, n->used.children[1]);
+        ok = n->used.children[0] != 0 && n->used.children[1] != 0;
+        for (int dir = 1; ok && dir >= 0; dir--)
+            if (_is_node_ptr(n->used.children[dir]))
+                stack[depth++] = (size_t)(n->used.children[dir] >> 1);
+    }
+    free(stack);
+    _reclaim_all(nt);
+    free(nt->retired);
+    if (!ok)
+    {
+        _free_pool(nt);
+        return 0;
+    }
+
+    /* replaces the old pool, keeping the string arena */
+    _free_pool(t);
+    t->root = nt->root;
+    t->num_used_nodes = nt->num_used_nodes;
+    t->num_total_nodes = nt->num_total_nodes;
+    t->first_free_node = nt->first_free_node;
+    t->first_new_node = nt->first_new_node;
+    t->num_segments = nt->num_segments;
+    t->segments_size = nt->segments_size;
+    t->segments = nt->segments;
+    return 1;
+}
+
+
+/** Finds the leaf of a string in the critbit, adding it if needed.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be found or added.
+ *  \param s_len Length of \a s.
+ *  \param inserted Set to 1 if \a s was added, 0 otherwise (output).
+ *  \return Leaf base pointer or 0 in case of error.
+ */
+static pcb_ptr_t _find_or_insert(pcb_t *t, const char *s, size_t s_len, int *inserted)
+{
+    /* nothing inserted so far */
+    *inserted = 0;
+
+#if PCB_COMPACT_NODES
+    /* compact nodes store the critbit byte in 32 bits */
+    if (s_len > UINT32_MAX)
+        return 0;
+#endif
+
+    /* if it's empty, just gets a leaf */
+    if (t->root == 0)
+    {
+        /* leaf */
+        pcb_ptr_t l = _create_leaf(t, s, s_len);
+        if (l == 0)
+            return 0;
+
+        /* sets as root */
+        _publish_ptr(&t->root, l);
+        *inserted = 1;
+        return l;
+    }
+
+    /* search loop, recording the path */
+    size_t path[PCB_PATH_STACK_DEPTH];
+    size_t depth = 0;
+    pcb_ptr_t p = t->root;
+    while (_is_node_ptr(p))
+    {
+        if (depth < PCB_PATH_STACK_DEPTH)
+            path[depth] = (size_t)(p >> 1);
+        depth++;
+        p = _get_node_ptr(t, p)->used.children[_get_direction(_get_node_ptr(t, p), s, s_len)];
+    }
+
+    /* if it matches, it was already there */
+    if (_leaf_matches(t, p, s, s_len))
+        return p;
+
+    /* if it doesn't match, we have a critical bit that differs */
+    size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, p), _get_leaf_len(t, p), s, s_len);
+
+    /* gets nodes */
+    size_t n_idx;
+    pcb_node_t *n = _get_free_pcb_node(t, &n_idx);
+    if (n == NULL)
+        return 0;
+    pcb_ptr_t l = _create_leaf(t, s, s_len);
+    if (l == 0)
+    {
+        _release_pcb_node(t, n_idx);
+        return 0;
+    }
+
+    /* finds which pointer to update, and the number of nodes above it */
+    pcb_ptr_t *pp = &t->root;
+    size_t lo = 0;
+    if (depth <= PCB_PATH_STACK_DEPTH)
+    {
+        /* critbit positions increase along the path, so binary searches
+           the first node with a position not below cb_pos */
+        size_t hi = depth;
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (_get_cb_pos(_get_pool_node(t, path[mid])) < cb_pos)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > 0)
+        {
+            pcb_node_t *pn = _get_pool_node(t, path[lo - 1]);
+            pp = &pn->used.children[_get_direction(pn, s, s_len)];
+        }
+    }
+    else
+    {
+        /* the path didn't fit, so redoes the search */
+        while (_is_node_ptr(*pp) &&
+               _get_cb_pos(_get_node_ptr(t, *pp)) < cb_pos)
+        {
+            pp = &_get_node_ptr(t, *pp)->used.children[_get_direction(_get_node_ptr(t, *pp), s, s_len)];
+            lo++;
+        }
+    }
+
+    /* loads the new PCB node */
+    _set_cb_pos(n, cb_pos);
+    n->used.children[_get_bit(s, s_len, cb_pos) != 0] = l;
+    n->used.children[_get_bit(s, s_len, cb_pos) == 0] = *pp;
+#if PCB_SUBTREE_COUNTS
+    n->used.num_leaves = _get_num_leaves(t, *pp) + 1;
+#endif
+
+    /* connects it, publishing it to the readers */
+    _publish_ptr(pp, _get_base_ptr(n_idx));
+#if PCB_SUBTREE_COUNTS
+    _update_num_leaves(t, path, lo, s, s_len, 1);
+#endif
+
+    /* success */
+    *inserted = 1;
+    return l;
+}
+
+
+#if !PCB_SUBTREE_COUNTS
+/** Releases the nodes of a concurrent insertion that were not linked.
+ *
+ *  \param t Critbit tree.
+ *  \param n_idx Index of the internal node (\c SIZE_MAX if none).
+ *  \param l Leaf base pointer (0 if none).
+ *  \note They go to the free lists, to be reused by single-writer
+ *        insertions.
+ */
+static void _discard_concurrent(pcb_t *t, size_t n_idx, pcb_ptr_t l)
+{
+    if (n_idx != SIZE_MAX)
+        _release_pcb_node_concurrent(t, n_idx);
+    if (l != 0 && !_is_inline_leaf_ptr(l))
+        _release_string_node_concurrent(t, _get_string_node(t, l));
+    if (l != 0 && (_is_inline_leaf_ptr(l) || PCB_COMPACT_NODES))
+        _release_pcb_node_concurrent(t, (size_t)(l >> 2));
+}
+#endif
+
+
+/** Adds a string to the critbit, from one of many concurrent insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be added.
+ *  \param s_len Length of \a s.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note The new internal node is linked with a compare-and-swap on the
+ *        child pointer it replaces, expecting the value seen while
+ *        descending: as other insertions only add nodes, if it's unchanged
+ *        the critical bit found is still right. Otherwise, the search is
+ *        redone from that pointer, as the critical bit of \a s cannot be
+ *        above it.
+ */
+static int _insert_concurrent(pcb_t *t, const char *s, size_t s_len)
+{
+#if PCB_SUBTREE_COUNTS
+    /* the counts along the path cannot be kept exact without a lock, so the
+       insertions get serialized */
+    int inserted;
+    pthread_mutex_lock(&t->alloc_lock);
+    int ok = _find_or_insert(t, s, s_len, &inserted) != 0;
+    pthread_mutex_unlock(&t->alloc_lock);
+    return ok && inserted;
+#else
+#if PCB_COMPACT_NODES
+    /* compact nodes store the critbit byte in 32 bits */
+    if (s_len > UINT32_MAX)
+        return 0;
+#endif
+
+    /* the nodes are created once and kept across retries */
+    size_t n_idx = SIZE_MAX;
+    pcb_node_t *n = NULL;
+    pcb_ptr_t l = 0;
+
+    /* the search starts at the root */
+    pcb_ptr_t *start = &t->root;
+    while (1)
+    {
+        /* if the tree is empty, tries to set the leaf as root */
+        pcb_ptr_t p = __atomic_load_n(start, __ATOMIC_ACQUIRE);
+        if (p == 0)
+        {
+            if (l == 0 && (l = _create_leaf_concurrent(t, s, s_len)) == 0)
+                break;
+            if (__atomic_compare_exchange_n(start, &p, l, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            {
+                _discard_concurrent(t, n_idx, 0);
+                return 1;
+            }
+            continue;
+        }
+
+        /* search loop, recording the pointers and the values seen */
+        pcb_ptr_t *path_pp[PCB_PATH_STACK_DEPTH];
+        pcb_ptr_t path_p[PCB_PATH_STACK_DEPTH];
+        size_t depth = 0;
+        pcb_ptr_t *pp = start;
+        while (1)
+        {
+            if (depth < PCB_PATH_STACK_DEPTH)
+            {
+                path_pp[depth] = pp;
+                path_p[depth] = p;
+                depth++;
+            }
+            if (!_is_node_ptr(p))
+                break;
+            pcb_node_t *pn = _get_node_ptr(t, p);
+            int dir = _get_direction(pn, s, s_len);
+            pp = &pn->used.children[dir];
+            p = _get_child(pn, dir);
+        }
+
+        /* if it matches, it was already there */
+        if (_leaf_matches(t, p, s, s_len))
+        {
+            _discard_concurrent(t, n_idx, l);
+            return 0;
+        }
+
+        /* critbit positions increase along the path, so binary searches
+           the first value that is a leaf or has a position above cb_pos */
+        size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, p), _get_leaf_len(t, p), s, s_len);
+        size_t lo = 0, hi = depth;
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (_is_node_ptr(path_p[mid]) && _get_cb_pos(_get_node_ptr(t, path_p[mid])) < cb_pos)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        /* if the path didn't fit, continues below it */
+        if (lo == depth)
+        {
+            start = path_pp[depth - 1];
+            continue;
+        }
+
+        /* gets the nodes */
+        if (n == NULL && (n = _get_new_pcb_node_concurrent(t, &n_idx)) == NULL)
+            break;
+        if (l == 0 && (l = _create_leaf_concurrent(t, s, s_len)) == 0)
+            break;
+
+        /* loads the new PCB node and tries to connect it */
+        pcb_ptr_t q = path_p[lo];
+        _set_cb_pos(n, cb_pos);
+        n->used.children[_get_bit(s, s_len, cb_pos) != 0] = l;
+        n->used.children[_get_bit(s, s_len, cb_pos) == 0] = q;
+        if (__atomic_compare_exchange_n(path_pp[lo], &q, _get_base_ptr(n_idx), 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return 1;
+
+        /* otherwise, retries from the pointer that changed */
+        start = path_pp[lo];
+    }
+
+    /* error */
+    _discard_concurrent(t, n_idx, l);
+    return 0;
+#endif
+}
+
+
+/** Removes a string from the critbit, retrieving its value.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be removed.
+ *  \param s_len Length of \a s.
+ *  \param v Value associated with \a s (output, can be \c NULL).
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _remove(pcb_t *t, const char *s, size_t s_len, pcb_value_t *v)
+{
+    /* if it's empty, we cannot remove anything */
+    if (t->root == 0)
+        return 0;
+
+    /* search loop */
+    pcb_ptr_t *p = &t->root;
+    pcb_ptr_t *q = NULL;
+#if PCB_SUBTREE_COUNTS
+    size_t path[PCB_PATH_STACK_DEPTH];
+    size_t depth = 0;
+#endif
+    while (_is_node_ptr(*p))
+    {
+#if PCB_SUBTREE_COUNTS
+        /* records the path, to update the counts */
+        if (depth < PCB_PATH_STACK_DEPTH)
+            path[depth] = (size_t)(*p >> 1);
+        depth++;
+#endif
+        q = p;
+        p = &_get_node_ptr(t, *p)->used.children[_get_direction(_get_node_ptr(t, *p), s, s_len)];
+    }
+
+    /* if it doesn't match, it cannot be removed */
+    if (!_leaf_matches(t, *p, s, s_len))
+        return 0;
+
+    /* makes room to retire the leaf and its parent */
+    if (!_reserve((void **)&t->retired, &t->retired_size, t->num_retired + 2, sizeof(pcb_retired_t)))
+        return 0;
+
+    /* retrieves the value before releasing the leaf */
+    pcb_ptr_t l = *p;
+    if (v != NULL)
+        *v = *_get_leaf_value(t, l);
+
+    /* checks if the node has a sibling */
+    if (q != NULL)
+    {
+        /* gets the sibling node */
+        pcb_ptr_t n = *q;
+        pcb_ptr_t r = _get_node_ptr(t, n)->used.children[_get_node_ptr(t, n)->used.children[0] == l];
+
+        /* replaces the parent with the sibling, after discounting the leaf
+           from the ancestors of the parent */
+#if PCB_SUBTREE_COUNTS
+        _update_num_leaves(t, path, depth - 1, s, s_len, -1);
+#endif
+        _publish_ptr(q, r);
+
+        /* removes the leaf and the parent internal node */
+        _retire(t, l);
+        _retire(t, n);
+    }
+    else
+    {
+        /* no siblings, it's root */
+        /* releases it, setting the pointer to 0 */
+        _publish_ptr(p, 0);
+        _retire(t, l);
+    }
+
+    /* success */
+    return 1;
+}
+
+
+/** Finds the leaf of a string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be searched for.
+ *  \param s_len Length of \a s.
+ *  \return Leaf base pointer or 0 if \a s was not found.
+ */
+static pcb_ptr_t _find(const pcb_t *t, const char *s, size_t s_len)
+{
+    /* exits on an empty critbit tree */
+    pcb_ptr_t p = _get_root(t);
+    if (p == 0)
+        return 0;
+
+    /* main loop */
+    while (_is_node_ptr(p))
+        p = _get_child(_get_const_node_ptr(t, p), _get_direction(_get_const_node_ptr(t, p), s, s_len));
+
+    /* final check */
+    return _leaf_matches(t, p, s, s_len) ? p : 0;
+}
+
+
+/** Gets the leaf of the smallest string in a subtree.
+ *
+ *  \param t Critbit tree.
+ *  \param p Subtree root.
+ *  \return Leaf base pointer.
+ */
+static pcb_ptr_t _get_min_leaf(const pcb_t *t, pcb_ptr_t p)
+{
+    while (_is_node_ptr(p))
+        p = _get_child(_get_const_node_ptr(t, p), 0);
+    return p;
+}
+
+
+/** Gets the leaf of the biggest string in a subtree.
+ *
+ *  \param t Critbit tree.
+ *  \param p Subtree root.
+ *  \return Leaf base pointer.
+ */
+static pcb_ptr_t _get_max_leaf(const pcb_t *t, pcb_ptr_t p)
+{
+    while (_is_node_ptr(p))
+        p = _get_child(_get_const_node_ptr(t, p), 1);
+    return p;
+}
+
+
+/** Completes the search for the smallest lexicographically bigger string,
+ *  starting from the leaf reached by descending with it.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param s_len Length of \a s.
+ *  \param p Leaf reached by descending with \a s.
+ *  \param q Last right sibling found in that descent (0 if none).
+ *  \return Leaf base pointer of the smallest string in \a t that is bigger
+ *          than \a s or 0 if there is none.
+ */
+static pcb_ptr_t _find_next_from_leaf(const pcb_t *t, const char *s, size_t s_len, pcb_ptr_t p, pcb_ptr_t q)
+{
+    /* if p is s, the answer is the minimum of the last right sibling */
+    size_t p_len = _get_leaf_len(t, p);
+    if (_leaf_matches(t, p, s, s_len))
+        return q != 0 ? _get_min_leaf(t, q) : 0;
+
+    /* otherwise, the strings below the critical bit node share their prefix
+       with s up to the critical bit, so it's enough to descend to it */
+    size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, p), p_len, s, s_len);
+    if ((p = _get_root(t)) == 0)
+        return 0;
+    q = 0;
+    while (_is_node_ptr(p) && _get_cb_pos(_get_const_node_ptr(t, p)) < cb_pos)
+    {
+        int dir = _get_direction(_get_const_node_ptr(t, p), s, s_len);
+        if (dir == 0)
+            q = _get_child(_get_const_node_ptr(t, p), 1);
+        p = _get_child(_get_const_node_ptr(t, p), dir);
+    }
+
+    /* if s is smaller than that subtree, the answer is its minimum */
+    if (!_get_bit(s, s_len, cb_pos))
+        return _get_min_leaf(t, p);
+
+    /* if it's bigger, it's the minimum of the last right sibling */
+    return q != 0 ? _get_min_leaf(t, q) : 0;
+}
+
+
+/** Finds the leaf of the smallest lexicographically bigger string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param s_len Length of \a s.
+ *  \return Leaf base pointer of the smallest string in \a t that is bigger
+ *          than \a s or 0 if there is none.
+ */
+static pcb_ptr_t _find_next(const pcb_t *t, const char *s, size_t s_len)
+{
+    /* if it's empty, there is no answer */
+    pcb_ptr_t p = _get_root(t);
+    if (p == 0)
+        return 0;
+
+    /* search loop for p, keeping the last right sibling in q */
+    pcb_ptr_t q = 0;
+    while (_is_node_ptr(p))
+    {
+        int dir = _get_direction(_get_const_node_ptr(t, p), s, s_len);
+        if (dir == 0)
+            q = _get_child(_get_const_node_ptr(t, p), 1);
+        p = _get_child(_get_const_node_ptr(t, p), dir);
+    }
+
+    return _find_next_from_leaf(t, s, s_len, p, q);
+}
+
+
+/** Finds the leaf of the biggest lexicographically smaller string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param s_len Length of \a s.
+ *  \return Leaf base pointer of the biggest string in \a t that is smaller
+ *          than \a s or 0 if there is none.
+ */
+static pcb_ptr_t _find_prev(const pcb_t *t, const char *s, size_t s_len)
+{
+    /* if it's empty, there is no answer */
+    pcb_ptr_t p = _get_root(t);
+    if (p == 0)
+        return 0;
+
+    /* search loop for p, keeping the last left sibling in q */
+    pcb_ptr_t q = 0;
+    while (_is_node_ptr(p))
+    {
+        int dir = _get_direction(_get_const_node_ptr(t, p), s, s_len);
+        if (dir == 1)
+            q = _get_child(_get_const_node_ptr(t, p), 0);
+        p = _get_child(_get_const_node_ptr(t, p), dir);
+    }
+
+    /* if p is s, the answer is the maximum of the last left sibling */
+    if (_leaf_matches(t, p, s, s_len))
+        return q != 0 ? _get_max_leaf(t, q) : 0;
+
+    /* otherwise, descends to the critical bit node as in _find_next_from_leaf() */
+    size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, p), _get_leaf_len(t, p), s, s_len);
+    if ((p = _get_root(t)) == 0)
+        return 0;
+    q = 0;
+    while (_is_node_ptr(p) && _get_cb_pos(_get_const_node_ptr(t, p)) < cb_pos)
+    {
+        int dir = _get_direction(_get_const_node_ptr(t, p), s, s_len);
+        if (dir == 1)
+            q = _get_child(_get_const_node_ptr(t, p), 0);
+        p = _get_child(_get_const_node_ptr(t, p), dir);
+    }
+
+    /* if s is bigger than that subtree, the answer is its maximum */
+    if (_get_bit(s, s_len, cb_pos))
+        return _get_max_leaf(t, p);
+
+    /* if it's smaller, it's the maximum of the last left sibling */
+    return q != 0 ? _get_max_leaf(t, q) : 0;
+}
+
+
+/** Adds a string with explicit length to the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be added (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \return 1 if successful, 0 otherwise.
+ */
+int pcb_add_len(pcb_t *t, const char *s, size_t s_len)
+{
+    int inserted;
+    return _find_or_insert(t, s, s_len, &inserted) != 0 && inserted;
+}
+
+
+/** Removes a string with explicit length from the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be removed (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \return 1 if successful, 0 otherwise.
+ */
+int pcb_rem_len(pcb_t *t, const char *s, size_t s_len)
+{
+    return _remove(t, s, s_len, NULL);
+}
+
+
+/** Checks if a string with explicit length is in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be searched for (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \return 1 if the string was found, 0 otherwise.
+ */
+int pcb_in_len(const pcb_t *t, const char *s, size_t s_len)
+{
+    return _find(t, s, s_len) != 0;
+}
+
+
+/** Finds the smallest lexicographically bigger string in the critbit, using
+ *  explicit lengths.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \param r_len Length of the returned string (output, can be \c NULL).
+ *  \return The smallest string in \a t that is bigger than \a s or \c NULL if
+ *          there is none.
+ *  \note Strings are compared as unsigned bytes, with a string sorting
+ *        before its extensions. The returned string is NUL terminated and
+ *        it's only valid until the next modification of \a t.
+ */
+const char *pcb_find_next_len(const pcb_t *t, const char *s, size_t s_len, size_t *r_len)
+{
+    pcb_ptr_t p = _find_next(t, s, s_len);
+    if (p == 0)
+        return NULL;
+    if (r_len != NULL)
+        *r_len = _get_leaf_len(t, p);
+    return _get_leaf_str(t, p);
+}
+
+
+/** Finds the biggest lexicographically smaller string in the critbit, using
+ *  explicit lengths.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \param r_len Length of the returned string (output, can be \c NULL).
+ *  \return The biggest string in \a t that is smaller than \a s or \c NULL
+ *          if there is none.
+ *  \note The returned string is NUL terminated and it's only valid until the
+ *        next modification of \a t.
+ */
+const char *pcb_find_prev_len(const pcb_t *t, const char *s, size_t s_len, size_t *r_len)
+{
+    pcb_ptr_t p = _find_prev(t, s, s_len);
+    if (p == 0)
+        return NULL;
+    if (r_len != NULL)
+        *r_len = _get_leaf_len(t, p);
+    return _get_leaf_str(t, p);
+}
+
+
+/** Adds a string to the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be added.
+ *  \return 1 if successful, 0 otherwise.
+ */
+int pcb_add(pcb_t *t, const char *s)
+{
+    return pcb_add_len(t, s, strlen(s));
+}
+
+
+/** Adds a string with explicit length to the critbit, from one of many
+ *  concurrent insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be added (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note Any number of threads can call it at the same time, and also the
+ *        lookup and traversal functions, without registering as readers.
+ *        It must not overlap with other modifications of \a t (they can
+ *        still be done, from a single thread, between concurrent phases).
+ *        With \c PCB_SUBTREE_COUNTS the insertions take a lock.
+ */
+int pcb_add_concurrent_len(pcb_t *t, const char *s, size_t s_len)
+{
+    return _insert_concurrent(t, s, s_len);
+}
+
+
+/** Adds a string to the critbit, from one of many concurrent insertions.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be added.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note See pcb_add_concurrent_len().
+ */
+int pcb_add_concurrent(pcb_t *t, const char *s)
+{
+    return _insert_concurrent(t, s, strlen(s));
+}
+
+
+/** Removes a string from the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be removed.
+ *  \return 1 if successful, 0 otherwise.
+ */
+int pcb_rem(pcb_t *t, const char *s)
+{
+    return pcb_rem_len(t, s, strlen(s));
+}
+
+
+/** Clears the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \note Releases all allocated memory. There must not be active readers.
+ */
+void pcb_clear(pcb_t *t)
+{
+    /* releases all string nodes at once (after the retired ones) */
+    _reclaim_all(t);
+    _arena_clear(&t->arena);
+
+    /* the root is cleared */
+    t->root = 0;
+
+    /* no nodes are used, the segments are kept */
+    t->num_used_nodes = PCB_NUM_RESERVED_NODES;
+    t->first_free_node = SIZE_MAX;
+    t->first_new_node = PCB_NUM_RESERVED_NODES;
+}
+
+
+/** Checks if a string is in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be searched for.
+ *  \return 1 if the string was found, 0 otherwise.
+ */
+int pcb_in(const pcb_t* t, const char *s)
+{
+    return pcb_in_len(t, s, strlen(s));
+}
+
+
+/** Finds the smallest lexicographically bigger string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \return The smallest string in \a t that is bigger than \a s or \c NULL if
+ *          there is none.
+ *  \note The returned string is only valid until the next modification of
+ *        \a t.
+ */
+const char *pcb_find_next(const pcb_t *t, const char *s)
+{
+    return pcb_find_next_len(t, s, strlen(s), NULL);
+}
+
+
+/** Finds the biggest lexicographically smaller string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \return The biggest string in \a t that is smaller than \a s or \c NULL
+ *          if there is none.
+ *  \note The returned string is only valid until the next modification of
+ *        \a t.
+ */
+const char *pcb_find_prev(const pcb_t *t, const char *s)
+{
+    return pcb_find_prev_len(t, s, strlen(s), NULL);
+}
+
+
+/** Gets the biggest string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \return The biggest string in \a t or \c NULL if it's empty.
+ *  \note The returned string is only valid until the next modification of
+ *        \a t.
+ */
+const char *pcb_last(const pcb_t *t)
+{
+    pcb_ptr_t r = _get_root(t);
+    return r != 0 ? _get_leaf_str(t, _get_max_leaf(t, r)) : NULL;
+}
+
+
+/** Set callback adapter type. */
+typedef struct
+{
+    /** Set callback. */
+    int (*cb)(const char *s, void *ctx);
+
+    /** Set callback context. */
+    void *ctx;
+
+} pcb_set_cb_t;
+
+
+/** Adapts a map callback to a set callback.
+ *
+ *  \param s String.
+ *  \param v Value (ignored).
+ *  \param ctx Set callback adapter.
+ *  \return Set callback result.
+ */
+static int _set_cb(const char *s, pcb_value_t *v, void *ctx)
+{
+    const pcb_set_cb_t *set_cb = ctx;
+    (void)v;
+    return set_cb->cb(s, set_cb->ctx);
+}
+
+
+/** Iterates over all the suffixes of a given string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note \a cb is executed over every string in \a t that has \a s as a
+ *        prefix. The iteration is stopped if the callback returns 0.
+ */
+int pcb_find_suffixes(const pcb_t *t, const char *s, int (*cb)(const char *s, void *ctx), void *ctx)
+{
+    pcb_set_cb_t set_cb = { cb, ctx };
+    return pcb_map_find_suffixes(t, s, _set_cb, &set_cb);
+}
+
+
+/** Iterates over all the suffixes of a given string in the critbit, in
+ *  reverse order.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note \a cb is executed from the biggest to the smallest string in \a t
+ *        that has \a s as a prefix. The iteration is stopped if the
+ *        callback returns 0.
+ */
+int pcb_find_suffixes_rev(const pcb_t *t, const char *s, int (*cb)(const char *s, void *ctx), void *ctx)
+{
+    pcb_set_cb_t set_cb = { cb, ctx };
+    return pcb_map_find_suffixes_rev(t, s, _set_cb, &set_cb);
+}
+
+
+/** Descends a group of lookups to their leaves in lock-step.
+ *
+ *  \param t Critbit tree.
+ *  \param r Root (not 0).
+ *  \param keys Strings being looked up.
+ *  \param lens Lengths of the strings.
+ *  \param n Number of strings (up to \c PCB_BATCH_SIZE).
+ *  \param p Leaves reached (output).
+ *  \param q Last right siblings found in each descent (output, can be
+ *         \c NULL).
+ *  \note The next node of every lookup is prefetched before advancing any
+ *        of them, so the cache misses of the group overlap.
+ */
+static void _descend_batch(const pcb_t *t, pcb_ptr_t r, const char *const *keys, const size_t *lens, size_t n,
+                           pcb_ptr_t *p, pcb_ptr_t *q)
+{
+    /* starts every lookup at the root */
+    for (size_t i = 0; i < n; i++)
+    {
+        p[i] = r;
+        if (q != NULL)
+            q[i] = 0;
+    }
+
+    /* advances every lookup one level per round */
+    for (int active = 1; active; )
+    {
+        active = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!_is_node_ptr(p[i]))
+                continue;
+            const pcb_node_t *nd = _get_const_node_ptr(t, p[i]);
+            int dir = _get_direction(nd, keys[i], lens[i]);
+            if (q != NULL && dir == 0)
+                q[i] = _get_child(nd, 1);
+            p[i] = _get_child(nd, dir);
+            _prefetch_ptr(t, p[i]);
+            active = 1;
+        }
+    }
+}
+
+
+/** Checks if a group of strings are in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param keys Strings to be searched for.
+ *  \param n Number of strings.
+ *  \param results Set to 1 for each string found, 0 otherwise (output).
+ *  \return Number of strings found.
+ *  \note The lookups are advanced in lock-step groups of
+ *        \c PCB_BATCH_SIZE, prefetching the next node of each one.
+ */
+size_t pcb_in_batch(const pcb_t *t, const char *const *keys, size_t n, int *results)
+{
+    size_t lens[PCB_BATCH_SIZE];
+    pcb_ptr_t p[PCB_BATCH_SIZE];
+    size_t num_found = 0;
+
+    /* an empty critbit has nothing */
+    pcb_ptr_t r = _get_root(t);
+    if (r == 0)
+    {
+        for (size_t i = 0; i < n; i++)
+            results[i] = 0;
+        return 0;
+    }
+
+    /* processes each group */
+    for (size_t base = 0; base < n; base += PCB_BATCH_SIZE)
+    {
+        size_t m = n - base < PCB_BATCH_SIZE ? n - base : PCB_BATCH_SIZE;
+        for (size_t i = 0; i < m; i++)
+            lens[i] = strlen(keys[base + i]);
+        _descend_batch(t, r, keys + base, lens, m, p, NULL);
+        for (size_t i = 0; i < m; i++)
+        {
+            results[base + i] = _leaf_matches(t, p[i], keys[base + i], lens[i]);
+            num_found += results[base + i];
+        }
+    }
+
+    return num_found;
+}
+
+
+/** Finds the smallest lexicographically bigger string for each string of a
+ *  group.
+ *
+ *  \param t Critbit tree.
+ *  \param keys Base strings.
+ *  \param n Number of strings.
+ *  \param results The smallest string in \a t bigger than each base string
+ *         or \c NULL if there is none (output).
+ *  \note The initial descents are advanced in lock-step groups of
+ *        \c PCB_BATCH_SIZE, prefetching the next node of each one. The
+ *        returned strings are only valid until the next modification of
+ *        \a t.
+ */
+void pcb_find_next_batch(const pcb_t *t, const char *const *keys, size_t n, const char **results)
+{
+    size_t lens[PCB_BATCH_SIZE];
+    pcb_ptr_t p[PCB_BATCH_SIZE], q[PCB_BATCH_SIZE];
+
+    /* an empty critbit has nothing */
+    pcb_ptr_t r = _get_root(t);
+    if (r == 0)
+    {
+        for (size_t i = 0; i < n; i++)
+            results[i] = NULL;
+        return;
+    }
+
+    /* processes each group */
+    for (size_t base = 0; base < n; base += PCB_BATCH_SIZE)
+    {
+        size_t m = n - base < PCB_BATCH_SIZE ? n - base : PCB_BATCH_SIZE;
+        for (size_t i = 0; i < m; i++)
+            lens[i] = strlen(keys[base + i]);
+        _descend_batch(t, r, keys + base, lens, m, p, q);
+        for (size_t i = 0; i < m; i++)
+        {
+            pcb_ptr_t next = _find_next_from_leaf(t, keys[base + i], lens[i], p[i], q[i]);
+            results[base + i] = next != 0 ? _get_leaf_str(t, next) : NULL;
+        }
+    }
+}
+
+
+/** Associates a value with a string in the critbit, adding it if needed.
+ *
+ *  \param t Critbit tree.
+ *  \param s String.
+ *  \param v Value to be associated with \a s.
+ *  \return 1 if successful, 0 otherwise.
+ */
+int pcb_map_put(pcb_t *t, const char *s, pcb_value_t v)
+{
+    int inserted;
+    pcb_ptr_t p = _find_or_insert(t, s, strlen(s), &inserted);
+    if (p == 0)
+        return 0;
+    *_get_leaf_value(t, p) = v;
+    return 1;
+}
+
+
+/** Gets the value associated with a string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be searched for.
+ *  \return Pointer to the value associated with \a s or \c NULL if \a s is
+ *          not in \a t.
+ *  \note The returned pointer is only valid until the next modification of
+ *        \a t.
+ */
+pcb_value_t *pcb_map_get(const pcb_t *t, const char *s)
+{
+    pcb_ptr_t p = _find(t, s, strlen(s));
+    return p != 0 ? _get_leaf_value(t, p) : NULL;
+}
+
+
+/** Gets the value associated with a string in the critbit, adding the
+ *  string with a zero-initialized value if needed.
+ *
+ *  \param t Critbit tree.
+ *  \param s String.
+ *  \param inserted Set to 1 if \a s was added, 0 otherwise (output, can be
+ *         \c NULL).
+ *  \return Pointer to the value associated with \a s or \c NULL in case of
+ *          error.
+ *  \note The returned pointer is only valid until the next modification of
+ *        \a t.
+ */
+pcb_value_t *pcb_map_get_or_insert(pcb_t *t, const char *s, int *inserted)
+{
+    int dummy;
+    pcb_ptr_t p = _find_or_insert(t, s, strlen(s), inserted != NULL ? inserted : &dummy);
+    return p != 0 ? _get_leaf_value(t, p) : NULL;
+}
+
+
+/** Removes a string from the critbit, retrieving its value.
+ *
+ *  \param t Critbit tree.
+ *  \param s String to be removed.
+ *  \param v Value that was associated with \a s (output, can be \c NULL).
+ *  \return 1 if successful, 0 otherwise.
+ */
+int pcb_map_remove(pcb_t *t, const char *s, pcb_value_t *v)
+{
+    return _remove(t, s, strlen(s), v);
+}
+
+
+/** Finds the smallest lexicographically bigger string in the critbit, with
+ *  its value.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param v Pointer to the value associated with the returned string (output,
+ *         can be \c NULL).
+ *  \return The smallest string in \a t that is bigger than \a s or \c NULL if
+ *          there is none.
+ *  \note The returned pointers are only valid until the next modification of
+ *        \a t.
+ */
+const char *pcb_map_find_next(const pcb_t *t, const char *s, pcb_value_t **v)
+{
+    pcb_ptr_t p = _find_next(t, s, strlen(s));
+    if (p == 0)
+        return NULL;
+    if (v != NULL)
+        *v = _get_leaf_value(t, p);
+    return _get_leaf_str(t, p);
+}
+
+
+/** Finds the biggest lexicographically smaller string in the critbit, with
+ *  its value.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param v Value associated with the returned string (output, can be
+ *         \c NULL).
+ *  \return The biggest string in \a t that is smaller than \a s or \c NULL
+ *          if there is none.
+ *  \note The returned string and value are only valid until the next
+ *        modification of \a t.
+ */
+const char *pcb_map_find_prev(const pcb_t *t, const char *s, pcb_value_t **v)
+{
+    pcb_ptr_t p = _find_prev(t, s, strlen(s));
+    if (p == 0)
+        return NULL;
+    if (v != NULL)
+        *v = _get_leaf_value(t, p);
+    return _get_leaf_str(t, p);
+}
+
+
+/** Finds the root of the subtree containing the suffixes of a string.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \return Subtree root or 0 if no string in \a t has \a s as a prefix.
+ */
+static pcb_ptr_t _find_suffixes_root(const pcb_t *t, const char *s)
+{
+    /* if it's empty, there are no suffixes */
+    pcb_ptr_t p = _get_root(t);
+    if (p == 0)
+        return 0;
+
+    /* gets the required critical bit position */
+    size_t s_len = strlen(s);
+    size_t cb_pos = s_len << 4;
+
+    /* search loop for the critical node */
+    while (_is_node_ptr(p) && _get_cb_pos(_get_const_node_ptr(t, p)) < cb_pos)
+        p = _get_child(_get_const_node_ptr(t, p), _get_direction(_get_const_node_ptr(t, p), s, s_len));
+    pcb_ptr_t q = p;
+
+    /* checking the prefix existence */
+    while (_is_node_ptr(p))
+        p = _get_child(_get_const_node_ptr(t, p), _get_direction(_get_const_node_ptr(t, p), s, s_len));
+    if (_get_leaf_len(t, p) < s_len || memcmp(_get_leaf_str(t, p), s, s_len) != 0)
+        return 0;
+    return q;
+}
+
+
+/** Iterates over all the suffixes of a given string in the critbit, with
+ *  their values, in a given order.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param rev 1 to iterate in reverse order, 0 otherwise.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ */
+static int _find_suffixes(const pcb_t *t, const char *s, int rev,
+                          int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx)
+{
+    /* if there are no suffixes, it "succeeded" */
+    pcb_ptr_t q = _find_suffixes_root(t, s);
+    if (q == 0)
+        return 1;
+
+    /* traverses starting from the node */
+    pcb_map_cb_t map_cb = { cb, ctx };
+    return _traverse(t, q, 0, rev, _map_cb_visit, &map_cb);
+}
+
+
+/** Iterates over all the suffixes of a given string in the critbit, with
+ *  their values.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note \a cb is executed over every string in \a t that has \a s as a
+ *        prefix. The iteration is stopped if the callback returns 0.
+ */
+int pcb_map_find_suffixes(const pcb_t *t, const char *s, int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx)
+{
+    return _find_suffixes(t, s, 0, cb, ctx);
+}
+
+
+/** Iterates over all the suffixes of a given string in the critbit, with
+ *  their values, in reverse order.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note \a cb is executed from the biggest to the smallest string in \a t
+ *        that has \a s as a prefix. The iteration is stopped if the
+ *        callback returns 0.
+ */
+int pcb_map_find_suffixes_rev(const pcb_t *t, const char *s, int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx)
+{
+    return _find_suffixes(t, s, 1, cb, ctx);
+}
+
+
+/** Parallel scan task type. */
+typedef struct
+{
+    /** Subtree root. */
+    pcb_ptr_t p;
+
+    /** Chunk containing the subtree. */
+    size_t chunk;
+
+} pcb_scan_task_t;
+
+
+/** Parallel scan deque type (the owner takes tasks from the tail, the other
+ *  threads steal them from the head). */
+typedef struct
+{
+    /** Lock protecting the deque. */
+    pthread_mutex_t lock;
+
+    /** Tasks (the ones at the tail come first in order). */
+    pcb_scan_task_t *tasks;
+
+    /** Index of the first task. */
+    size_t head;
+
+    /** Index past the last task. */
+    size_t tail;
+
+    /** Size of the tasks array. */
+    size_t size;
+
+} pcb_scan_deque_t;
+
+
+/** Parallel scan state. */
+typedef struct
+{
+    /** Critbit tree. */
+    const pcb_t *t;
+
+    /** Callback function. */
+    int (*cb)(const char *s, size_t chunk, void *ctx);
+
+    /** Per thread callback contexts. */
+    void *const *ctxs;
+
+    /** Whether the chunks must be kept whole. */
+    int ordered;
+
+    /** Number of threads. */
+    size_t num_threads;
+
+    /** Per thread deques. */
+    pcb_scan_deque_t *deques;
+
+    /** Number of tasks queued or running. */
+    size_t num_pending;
+
+    /** Number of threads looking for tasks to steal. */
+    size_t num_idle;
+
+    /** Whether a callback stopped the scan. */
+    int stopped;
+
+    /** Number of tasks pushed while other threads were idle. */
+    size_t num_pushes;
+
+    /** Lock protecting the waits for new tasks. */
+    pthread_mutex_t idle_lock;
+
+    /** Condition signaled when a task is pushed or the last one is done. */
+    pthread_cond_t idle_cond;
+
+} pcb_parallel_scan_t;
+
+
+/** Parallel scan visit context type. */
+typedef struct
+{
+    /** Parallel scan state. */
+    pcb_parallel_scan_t *ps;
+
+    /** Callback context. */
+    void *ctx;
+
+    /** Current chunk. */
+    size_t chunk;
+
+} pcb_scan_visit_t;
+
+
+/** Pushes a task into the tail of a deque.
+ *
+ *  \param d Deque.
+ *  \param task Task.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _scan_push(pcb_scan_deque_t *d, pcb_scan_task_t task)
+{
+    int ret = 1;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->size)
+    {
+        /* reuses the stolen entries before growing */
+        if (d->head > 0)
+        {
+            memmove(d->tasks, d->tasks + d->head, (d->tail - d->head) * sizeof(pcb_scan_task_t));
+            d->tail -= d->head;
+            d->head = 0;
+        }
+        else
+        {
+            size_t new_size = d->size > 0 ? 2 * d->size : 16;
+            pcb_scan_task_t *new_tasks = realloc(d->tasks, new_size * sizeof(pcb_scan_task_t));
+            if (new_tasks == NULL)
+                ret = 0;
+            else
+            {
+                d->tasks = new_tasks;
+                d->size = new_size;
+            }
+        }
+    }
+    if (ret)
+        d->tasks[d->tail++] = task;
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+
+/** Takes a task from a deque.
+ *
+ *  \param d Deque.
+ *  \param steal 1 to take it from the head (stealing), 0 from the tail.
+ *  \param task Where to store the task.
+ *  \return 1 if a task was taken, 0 if the deque was empty.
+ */
+static int _scan_take(pcb_scan_deque_t *d, int steal, pcb_scan_task_t *task)
+{
+    int ret = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+    {
+        *task = steal ? d->tasks[d->head++] : d->tasks[--d->tail];
+        ret = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+
+/** Visits a leaf in a parallel scan.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \param ctx Parallel scan visit context.
+ *  \return Callback result (0 if another thread stopped the scan).
+ */
+static int _scan_visit(const pcb_t *t, pcb_ptr_t p, void *ctx)
+{
+    pcb_scan_visit_t *sv = ctx;
+    if (__atomic_load_n(&sv->ps->stopped, __ATOMIC_RELAXED))
+        return 0;
+    if (!sv->ps->cb(_get_leaf_str(t, p), sv->chunk, sv->ctx))
+    {
+        __atomic_store_n(&sv->ps->stopped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+
+/** Wakes up the threads waiting for new tasks.
+ *
+ *  \param ps Parallel scan state.
+ *  \param pushed 1 if a task was pushed, 0 if the last one was done.
+ */
+static void _scan_wake(pcb_parallel_scan_t *ps, int pushed)
+{
+    pthread_mutex_lock(&ps->idle_lock);
+    if (pushed)
+    {
+        ps->num_pushes++;
+        pthread_cond_signal(&ps->idle_cond);
+    }
+    else
+        pthread_cond_broadcast(&ps->idle_cond);
+    pthread_mutex_unlock(&ps->idle_lock);
+}
+
+
+/** Runs a parallel scan thread, draining its deque and then stealing from
+ *  the others.
+ *
+ *  \param ctx Parallel scan state.
+ *  \param i Thread index.
+ *  \note Idle threads that find nothing to steal block until a task is
+ *        pushed or the last one is done, instead of spinning. The number of
+ *        pushes is read before looking for tasks, so a push made meanwhile
+ *        is never missed.
+ */
+static void _scan_thread(void *ctx, size_t i)
+{
+    pcb_parallel_scan_t *ps = ctx;
+    pcb_scan_visit_t sv = { ps, ps->ctxs != NULL ? ps->ctxs[i] : NULL, 0 };
+    pcb_scan_task_t task;
+    while (1)
+    {
+        /* takes its own tasks first, in order */
+        if (!_scan_take(&ps->deques[i], 0, &task))
+        {
+            /* steals from the other threads until every task is done */
+            int found = 0;
+            __atomic_fetch_add(&ps->num_idle, 1, __ATOMIC_SEQ_CST);
+            while (!found && __atomic_load_n(&ps->num_pending, __ATOMIC_ACQUIRE) > 0)
+            {
+                pthread_mutex_lock(&ps->idle_lock);
+                size_t num_pushes = ps->num_pushes;
+                pthread_mutex_unlock(&ps->idle_lock);
+                for (size_t j = 1; !found && j < ps->num_threads; j++)
+                    found = _scan_take(&ps->deques[(i + j) % ps->num_threads], 1, &task);
+                if (found)
+                    break;
+                pthread_mutex_lock(&ps->idle_lock);
+                while (ps->num_pushes == num_pushes && __atomic_load_n(&ps->num_pending, __ATOMIC_ACQUIRE) > 0)
+                    pthread_cond_wait(&ps->idle_cond, &ps->idle_lock);
+                pthread_mutex_unlock(&ps->idle_lock);
+            }
+            __atomic_fetch_sub(&ps->num_idle, 1, __ATOMIC_RELAXED);
+            if (!found)
+                return;
+        }
+
+        /* splits the task while other threads are idle, keeping the rest */
+        pcb_ptr_t p = task.p;
+        while (!ps->ordered && _is_node_ptr(p) && __atomic_load_n(&ps->num_idle, __ATOMIC_RELAXED) > 0)
+        {
+            const pcb_node_t *n = _get_const_node_ptr(ps->t, p);
+            pcb_scan_task_t rest = { _get_child(n, 1), task.chunk };
+            __atomic_fetch_add(&ps->num_pending, 1, __ATOMIC_RELAXED);
+            if (!_scan_push(&ps->deques[i], rest))
+            {
+                __atomic_fetch_sub(&ps->num_pending, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            _scan_wake(ps, 1);
+            p = _get_child(n, 0);
+        }
+
+        /* traverses the subtree */
+        sv.chunk = task.chunk;
+        if (!__atomic_load_n(&ps->stopped, __ATOMIC_RELAXED))
+            _traverse(ps->t, p, 0, 0, _scan_visit, &sv);
+        if (__atomic_sub_fetch(&ps->num_pending, 1, __ATOMIC_RELEASE) == 0)
+            _scan_wake(ps, 0);
+    }
+}
+
+
+/** Iterates over all the suffixes of a given string in the critbit, using
+ *  several threads.
+ *
+ *  \param t Critbit tree.
+ *  \param s Base string.
+ *  \param cb Callback function, receiving the chunk containing the string.
+ *  \param ctxs Contexts for the callback function, one per thread (or
+ *         \c NULL).
+ *  \param num_threads Number of threads (the calling one included).
+ *  \param ordered 1 to keep every chunk whole, 0 to allow splitting them.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note The subtree of the suffixes is split at its internal nodes into
+ *        about \c PCB_SCAN_CHUNKS_PER_THREAD chunks per thread, numbered in
+ *        order. Every thread drains its own range of chunks in order and
+ *        then steals chunks from the other threads. Each thread calls \a cb
+ *        with its own context, so \a cb must only be thread safe with
+ *        respect to shared state. If \a ordered is 1, every chunk is
+ *        visited in order by a single thread, so collecting the strings by
+ *        chunk and concatenating the chunks gives the order of
+ *        pcb_find_suffixes(). Otherwise the threads that take a chunk split
+ *        it further while other threads are idle. The iteration is stopped
+ *        (in every thread) if the callback returns 0. Memory allocation
+ *        and lock initialization errors only reduce the parallelism, and
+ *        the concurrency rules are the same as for pcb_find_suffixes().
+ */
+int pcb_find_suffixes_parallel(const pcb_t *t, const char *s, int (*cb)(const char *s, size_t chunk, void *ctx),
+                               void *const *ctxs, size_t num_threads, int ordered)
+{
+    /* if there are no suffixes, it "succeeded" */
+    pcb_ptr_t q = _find_suffixes_root(t, s);
+    if (q == 0)
+        return 1;
+
+    /* splits the subtree level by level until there are enough chunks */
+    if (num_threads == 0)
+        num_threads = 1;
+    else if (num_threads > PCB_MAX_THREADS)
+        num_threads = PCB_MAX_THREADS;
+    size_t target = num_threads * PCB_SCAN_CHUNKS_PER_THREAD;
+    pcb_ptr_t *chunks = malloc(2 * target * sizeof(pcb_ptr_t));
+    pcb_ptr_t *next_chunks = malloc(2 * target * sizeof(pcb_ptr_t));
+    pcb_scan_deque_t *deques = calloc(num_threads, sizeof(pcb_scan_deque_t));
+    int ok = chunks != NULL && next_chunks != NULL && deques != NULL;
+    size_t num_chunks = 1;
+    if (ok)
+        chunks[0] = q;
+    for (int split = ok; split && num_chunks < target;)
+    {
+        size_t num_next = 0;
+        split = 0;
+        for (size_t i = 0; i < num_chunks; i++)
+        {
+            if (_is_node_ptr(chunks[i]))
+            {
+                const pcb_node_t *n = _get_const_node_ptr(t, chunks[i]);
+                next_chunks[num_next++] = _get_child(n, 0);
+                next_chunks[num_next++] = _get_child(n, 1);
+                split = 1;
+            }
+            else
+                next_chunks[num_next++] = chunks[i];
+        }
+        pcb_ptr_t *tmp = chunks;
+        chunks = next_chunks;
+        next_chunks = tmp;
+        num_chunks = num_next;
+    }
+
+    /* gives a contiguous range of chunks to every thread, with the first
+       ones at the tail */
+    for (size_t c = 0; ok && c < num_chunks; c++)
+        deques[c * num_threads / num_chunks].size++;
+    for (size_t i = 0; ok && i < num_threads; i++)
+    {
+        deques[i].tasks = malloc((deques[i].size > 0 ? deques[i].size : 1) * sizeof(pcb_scan_task_t));
+        ok = deques[i].tasks != NULL;
+    }
+    /* the idle lock and condition are initialized with the deque locks */
+    pcb_parallel_scan_t ps = {
+        .t = t,
+        .cb = cb,
+        .ctxs = ctxs,
+        .ordered = ordered,
+        .num_threads = num_threads,
+        .deques = deques,
+        .num_pending = num_chunks,
+    };
+    for (size_t c = num_chunks; ok && c-- > 0;)
+    {
+        pcb_scan_deque_t *d = &deques[c * num_threads / num_chunks];
+        d->tasks[d->tail].p = chunks[c];
+        d->tasks[d->tail++].chunk = c;
+    }
+
+    /* initializes the locks, undoing it if any of them fails */
+    size_t num_locks = 0;
+    while (ok && num_locks < num_threads && pthread_mutex_init(&deques[num_locks].lock, NULL) == 0)
+        num_locks++;
+    ok = ok && num_locks == num_threads;
+    if (ok && pthread_mutex_init(&ps.idle_lock, NULL) != 0)
+        ok = 0;
+    else if (ok && pthread_cond_init(&ps.idle_cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&ps.idle_lock);
+        ok = 0;
+    }
+    if (ok)
+    {
+        _run_tasks(num_threads, num_threads, _scan_thread, &ps);
+        pthread_cond_destroy(&ps.idle_cond);
+        pthread_mutex_destroy(&ps.idle_lock);
+    }
+    for (size_t i = 0; i < num_locks; i++)
+        pthread_mutex_destroy(&deques[i].lock);
+    if (!ok)
+    {
+        /* without memory or locks for the tasks, scans the whole subtree as
+           a chunk */
+        pcb_scan_visit_t sv = { &ps, ctxs != NULL ? ctxs[0] : NULL, 0 };
+        _traverse(t, q, 0, 0, _scan_visit, &sv);
+    }
+
+    /* cleanup */
+    for (size_t i = 0; deques != NULL && i < num_threads; i++)
+        free(deques[i].tasks);
+    free(deques);
+    free(chunks);
+    free(next_chunks);
+    return !ps.stopped;
+}
+
+
+/** Set operation: union. */
+#define PCB_SET_UNION 0
+
+/** Set operation: intersection. */
+#define PCB_SET_INTERSECT 1
+
+/** Set operation: difference. */
+#define PCB_SET_DIFFERENCE 2
+
+
+/** Set operation frame type (a pair of subtrees still to be combined). */
+typedef struct
+{
+    /** Subtree of the first critbit (0 if none). */
+    pcb_ptr_t x;
+
+    /** Any leaf in \a x (0 if not known yet). */
+    pcb_ptr_t x_leaf;
+
+    /** Subtree of the second critbit (0 if none). */
+    pcb_ptr_t y;
+
+    /** Any leaf in \a y (0 if not known yet). */
+    pcb_ptr_t y_leaf;
+
+} pcb_set_frame_t;
+
+
+/** Set operation state. */
+typedef struct
+{
+    /** Callback function, receiving the string length (\c NULL to count
+     *  only). */
+    int (*cb)(const char *s, size_t s_len, void *ctx);
+
+    /** Context for the callback function. */
+    void *ctx;
+
+    /** Number of strings in the result. */
+    size_t count;
+
+    /** Pending frames (the last one comes first in order). */
+    pcb_set_frame_t *stack;
+
+    /** Number of pending frames. */
+    size_t depth;
+
+    /** Capacity of the stack. */
+    size_t stack_size;
+
+} pcb_set_op_t;
+
+
+/** Visits a leaf of the result of a set operation.
+ *
+ *  \param t Critbit tree containing the leaf.
+ *  \param p Leaf base pointer.
+ *  \param ctx Set operation state.
+ *  \return Callback result (1 when only counting).
+ */
+static int _set_op_visit(const pcb_t *t, pcb_ptr_t p, void *ctx)
+{
+    pcb_set_op_t *so = ctx;
+    so->count++;
+    return so->cb == NULL || so->cb(_get_leaf_str(t, p), _get_leaf_len(t, p), so->ctx);
+}
+
+
+/** Adds a whole subtree to the result of a set operation.
+ *
+ *  \param so Set operation state.
+ *  \param t Critbit tree containing the subtree.
+ *  \param p Subtree root.
+ *  \return Callback result (1 when only counting).
+ *  \note When only counting, the subtree is not traversed with
+ *        \c PCB_SUBTREE_COUNTS.
+ */
+static int _set_op_take(pcb_set_op_t *so, const pcb_t *t, pcb_ptr_t p)
+{
+    if (so->cb != NULL)
+        return _traverse(t, p, 0, 0, _set_op_visit, so);
+    so->count += _get_num_leaves(t, p);
+    return 1;
+}
+
+
+/** Pushes a pair of subtrees to be combined.
+ *
+ *  \param so Set operation state.
+ *  \param x Subtree of the first critbit (0 if none).
+ *  \param x_leaf Any leaf in \a x (0 if not known).
+ *  \param y Subtree of the second critbit (0 if none).
+ *  \param y_leaf Any leaf in \a y (0 if not known).
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _set_op_push(pcb_set_op_t *so, pcb_ptr_t x, pcb_ptr_t x_leaf, pcb_ptr_t y, pcb_ptr_t y_leaf)
+{
+    if (so->depth == so->stack_size)
+    {
+        size_t new_size = so->stack_size > 0 ? 2 * so->stack_size : 64;
+        pcb_set_frame_t *new_stack = realloc(so->stack, new_size * sizeof(pcb_set_frame_t));
+        if (new_stack == NULL)
+            return 0;
+        so->stack = new_stack;
+        so->stack_size = new_size;
+    }
+    pcb_set_frame_t *f = &so->stack[so->depth++];
+    f->x = x;
+    f->x_leaf = x_leaf;
+    f->y = y;
+    f->y_leaf = y_leaf;
+    return 1;
+}
+
+
+/** Pushes a pair of subtrees to be combined and the subtree at one of its
+ *  sides, so that they get combined in order.
+ *
+ *  \param so Set operation state.
+ *  \param f Pair of subtrees.
+ *  \param side Subtree alone (0 if it's not needed).
+ *  \param side_is_x 1 if \a side belongs to the first critbit, 0 otherwise.
+ *  \param side_leaf Any leaf in \a side (0 if not known).
+ *  \param side_dir 1 if \a side comes after \a f, 0 if it comes before.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _set_op_push_side(pcb_set_op_t *so, pcb_set_frame_t f, pcb_ptr_t side, int side_is_x,
+                             pcb_ptr_t side_leaf, int side_dir)
+{
+    if (side != 0 && side_dir &&
+        !_set_op_push(so, side_is_x ? side : 0, side_is_x ? side_leaf : 0, side_is_x ? 0 : side, side_is_x ? 0 : side_leaf))
+        return 0;
+    if (!_set_op_push(so, f.x, f.x_leaf, f.y, f.y_leaf))
+        return 0;
+    if (side != 0 && !side_dir &&
+        !_set_op_push(so, side_is_x ? side : 0, side_is_x ? side_leaf : 0, side_is_x ? 0 : side, side_is_x ? 0 : side_leaf))
+        return 0;
+    return 1;
+}
+
+
+/** Combines two critbits with a set operation by descending both of them
+ *  at once.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \param op Set operation (\c PCB_SET_UNION, \c PCB_SET_INTERSECT or
+ *         \c PCB_SET_DIFFERENCE).
+ *  \param cb Callback function, executed in order over the result and
+ *         receiving the string length (\c NULL to count only).
+ *  \param ctx Context for the callback function.
+ *  \param count Where to store the number of strings in the result (can be
+ *         \c NULL).
+ *  \return 1 if all the callback executions return 1, 0 otherwise or in case
+ *          of error.
+ *  \note Every subtree of a critbit shares all the bits of its strings
+ *        before its critbit position, so comparing any leaf of each
+ *        subtree tells whether the subtrees are disjoint (they differ
+ *        before both critbit positions), whether they split at the same
+ *        position (their children get paired) or whether one of them falls
+ *        entirely at one side of the other. Disjoint subtrees are skipped
+ *        or traversed as a whole, without comparing their strings. The
+ *        leaves used for the comparisons are kept while descending at
+ *        their side, so every internal node starts a descent to a leaf at
+ *        most once.
+ */
+static int _set_op(const pcb_t *a, const pcb_t *b, int op, int (*cb)(const char *s, size_t s_len, void *ctx),
+                   void *ctx, size_t *count)
+{
+    pcb_set_op_t so = { cb, ctx, 0, NULL, 0, 0 };
+    int ok = _set_op_push(&so, _get_root(a), 0, _get_root(b), 0);
+    while (ok && so.depth > 0)
+    {
+        pcb_set_frame_t f = so.stack[--so.depth];
+
+        /* a subtree without a counterpart is either skipped or taken whole */
+        if (f.x == 0 || f.y == 0)
+        {
+            if (f.x != 0 && op != PCB_SET_INTERSECT)
+                ok = _set_op_take(&so, a, f.x);
+            else if (f.y != 0 && op == PCB_SET_UNION)
+                ok = _set_op_take(&so, b, f.y);
+            continue;
+        }
+
+        /* gets the first differing bit between both subtrees */
+        if (f.x_leaf == 0)
+            f.x_leaf = _get_min_leaf(a, f.x);
+        if (f.y_leaf == 0)
+            f.y_leaf = _get_min_leaf(b, f.y);
+        const char *xs = _get_leaf_str(a, f.x_leaf);
+        size_t xs_len = _get_leaf_len(a, f.x_leaf);
+        const char *ys = _get_leaf_str(b, f.y_leaf);
+        size_t ys_len = _get_leaf_len(b, f.y_leaf);
+        size_t d = _get_critbit_pos(xs, xs_len, ys, ys_len);
+        if (xs_len == ys_len && d == xs_len << 4)
+            d = SIZE_MAX;
+        size_t x_pos = _is_node_ptr(f.x) ? _get_cb_pos(_get_const_node_ptr(a, f.x)) : SIZE_MAX;
+        size_t y_pos = _is_node_ptr(f.y) ? _get_cb_pos(_get_const_node_ptr(b, f.y)) : SIZE_MAX;
+
+        if (d == SIZE_MAX && x_pos == SIZE_MAX && y_pos == SIZE_MAX)
+        {
+            /* the same string is in both */
+            if (op != PCB_SET_DIFFERENCE)
+                ok = _set_op_visit(a, f.x, &so);
+        }
+        else if (d < x_pos && d < y_pos)
+        {
+            /* disjoint subtrees */
+            if (op == PCB_SET_DIFFERENCE)
+                ok = _set_op_take(&so, a, f.x);
+            else if (op == PCB_SET_UNION)
+            {
+                pcb_set_frame_t fx = { f.x, f.x_leaf, 0, 0 };
+                ok = _set_op_push_side(&so, fx, f.y, 0, f.y_leaf, _get_bit(ys, ys_len, d));
+            }
+        }
+        else if (x_pos == y_pos)
+        {
+            /* both split at the same position, so the children get paired */
+            const pcb_node_t *xn = _get_const_node_ptr(a, f.x);
+            const pcb_node_t *yn = _get_const_node_ptr(b, f.y);
+            int x_dir = _get_direction(xn, xs, xs_len);
+            int y_dir = _get_direction(yn, ys, ys_len);
+            for (int dir = 1; ok && dir >= 0; dir--)
+                ok = _set_op_push(&so, _get_child(xn, dir), x_dir == dir ? f.x_leaf : 0,
+                                  _get_child(yn, dir), y_dir == dir ? f.y_leaf : 0);
+        }
+        else if (x_pos < y_pos)
+        {
+            /* the second subtree is at one side of the first one */
+            const pcb_node_t *xn = _get_const_node_ptr(a, f.x);
+            int dir = _get_direction(xn, ys, ys_len);
+            int x_dir = _get_direction(xn, xs, xs_len);
+            pcb_set_frame_t fd = { _get_child(xn, dir), x_dir == dir ? f.x_leaf : 0, f.y, f.y_leaf };
+            pcb_ptr_t side = op != PCB_SET_INTERSECT ? _get_child(xn, !dir) : 0;
+            ok = _set_op_push_side(&so, fd, side, 1, x_dir != dir ? f.x_leaf : 0, !dir);
+        }
+        else
+        {
+            /* the first subtree is at one side of the second one */
+            const pcb_node_t *yn = _get_const_node_ptr(b, f.y);
+            int dir = _get_direction(yn, xs, xs_len);
+            int y_dir = _get_direction(yn, ys, ys_len);
+            pcb_set_frame_t fd = { f.x, f.x_leaf, _get_child(yn, dir), y_dir == dir ? f.y_leaf : 0 };
+            pcb_ptr_t side = op == PCB_SET_UNION ? _get_child(yn, !dir) : 0;
+            ok = _set_op_push_side(&so, fd, side, 0, y_dir != dir ? f.y_leaf : 0, !dir);
+        }
+    }
+    free(so.stack);
+    if (count != NULL)
+        *count = so.count;
+    return ok;
+}
+
+
+/** User callback of a set operation. */
+typedef struct
+{
+    /** Callback function. */
+    int (*cb)(const char *s, void *ctx);
+
+    /** Context for the callback function. */
+    void *ctx;
+
+} pcb_set_op_cb_t;
+
+
+/** Calls the user callback of a set operation, dropping the length.
+ *
+ *  \param s String.
+ *  \param s_len Length of \a s.
+ *  \param ctx User callback.
+ *  \return Callback result.
+ */
+static int _set_op_user_cb(const char *s, size_t s_len, void *ctx)
+{
+    (void)s_len;
+    pcb_set_op_cb_t *uc = ctx;
+    return uc->cb(s, uc->ctx);
+}
+
+
+/** Array of strings being collected. */
+typedef struct
+{
+    /** Strings. */
+    const char **keys;
+
+    /** Lengths of the strings. */
+    size_t *lens;
+
+    /** Number of strings. */
+    size_t n;
+
+    /** Capacity of the array. */
+    size_t size;
+
+} pcb_key_array_t;
+
+
+/** Appends a string to an array.
+ *
+ *  \param s String.
+ *  \param s_len Length of \a s.
+ *  \param ctx Array of strings.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _collect_key_cb(const char *s, size_t s_len, void *ctx)
+{
+    pcb_key_array_t *ka = ctx;
+    if (ka->n == ka->size)
+    {
+        size_t new_size = ka->size > 0 ? 2 * ka->size : 64;
+        const char **new_keys = realloc(ka->keys, new_size * sizeof(const char *));
+        if (new_keys == NULL)
+            return 0;
+        ka->keys = new_keys;
+        size_t *new_lens = realloc(ka->lens, new_size * sizeof(size_t));
+        if (new_lens == NULL)
+            return 0;
+        ka->lens = new_lens;
+        ka->size = new_size;
+    }
+    ka->keys[ka->n] = s;
+    ka->lens[ka->n++] = s_len;
+    return 1;
+}
+
+
+/** Builds a critbit with the result of a set operation.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \param op Set operation.
+ *  \return Newly created critbit or \c NULL in case of error.
+ *  \note The result comes in order, so it's built as with
+ *        pcb_build_sorted(), keeping the lengths of the strings so that
+ *        the ones with NUL bytes are copied whole.
+ */
+static pcb_t *_set_op_tree(const pcb_t *a, const pcb_t *b, int op)
+{
+    pcb_key_array_t ka = { NULL, NULL, 0, 0 };
+    pcb_t *t = _set_op(a, b, op, _collect_key_cb, &ka, NULL) ? _build_sorted_len(ka.keys, ka.lens, ka.n) : NULL;
+    free(ka.keys);
+    free(ka.lens);
+    return t;
+}
+
+
+/** Creates a critbit with the union of two critbits.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \return Newly created critbit or \c NULL in case of error.
+ *  \note The values are not copied.
+ */
+pcb_t *pcb_union(const pcb_t *a, const pcb_t *b)
+{
+    return _set_op_tree(a, b, PCB_SET_UNION);
+}
+
+
+/** Creates a critbit with the intersection of two critbits.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \return Newly created critbit or \c NULL in case of error.
+ *  \note The values are not copied.
+ */
+pcb_t *pcb_intersect(const pcb_t *a, const pcb_t *b)
+{
+    return _set_op_tree(a, b, PCB_SET_INTERSECT);
+}
+
+
+/** Creates a critbit with the strings of a critbit that are not in another
+ *  one.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \return Newly created critbit or \c NULL in case of error.
+ *  \note The values are not copied.
+ */
+pcb_t *pcb_difference(const pcb_t *a, const pcb_t *b)
+{
+    return _set_op_tree(a, b, PCB_SET_DIFFERENCE);
+}
+
+
+/** Iterates over the union of two critbits.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise or in case
+ *          of error.
+ *  \note \a cb is executed in order over every string in \a a or \a b. The
+ *        iteration is stopped if the callback returns 0.
+ */
+int pcb_union_cb(const pcb_t *a, const pcb_t *b, int (*cb)(const char *s, void *ctx), void *ctx)
+{
+    pcb_set_op_cb_t uc = { cb, ctx };
+    return _set_op(a, b, PCB_SET_UNION, _set_op_user_cb, &uc, NULL);
+}
+
+
+/** Iterates over the intersection of two critbits.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise or in case
+ *          of error.
+ *  \note \a cb is executed in order over every string in both \a a and
+ *        \a b. The iteration is stopped if the callback returns 0.
+ */
+int pcb_intersect_cb(const pcb_t *a, const pcb_t *b, int (*cb)(const char *s, void *ctx), void *ctx)
+{
+    pcb_set_op_cb_t uc = { cb, ctx };
+    return _set_op(a, b, PCB_SET_INTERSECT, _set_op_user_cb, &uc, NULL);
+}
+
+
+/** Iterates over the strings of a critbit that are not in another one.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise or in case
+ *          of error.
+ *  \note \a cb is executed in order over every string in \a a but not in
+ *        \a b. The iteration is stopped if the callback returns 0.
+ */
+int pcb_difference_cb(const pcb_t *a, const pcb_t *b, int (*cb)(const char *s, void *ctx), void *ctx)
+{
+    pcb_set_op_cb_t uc = { cb, ctx };
+    return _set_op(a, b, PCB_SET_DIFFERENCE, _set_op_user_cb, &uc, NULL);
+}
+
+
+/** Counts the strings in the union of two critbits.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \return Number of strings in \a a or \a b, or \c SIZE_MAX in case of
+ *          error.
+ */
+size_t pcb_union_count(const pcb_t *a, const pcb_t *b)
+{
+    size_t count;
+    return _set_op(a, b, PCB_SET_UNION, NULL, NULL, &count) ? count : SIZE_MAX;
+}
+
+
+/** Counts the strings in the intersection of two critbits.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \return Number of strings in both \a a and \a b, or \c SIZE_MAX in case
+ *          of error.
+ */
+size_t pcb_intersect_count(const pcb_t *a, const pcb_t *b)
+{
+    size_t count;
+    return _set_op(a, b, PCB_SET_INTERSECT, NULL, NULL, &count) ? count : SIZE_MAX;
+}
+
+
+/** Counts the strings of a critbit that are not in another one.
+ *
+ *  \param a First critbit tree.
+ *  \param b Second critbit tree.
+ *  \return Number of strings in \a a but not in \a b, or \c SIZE_MAX in case
+ *          of error.
+ */
+size_t pcb_difference_count(const pcb_t *a, const pcb_t *b)
+{
+    size_t count;
+    return _set_op(a, b, PCB_SET_DIFFERENCE, NULL, NULL, &count) ? count : SIZE_MAX;
+}
+
+
+/** Counts the strings in the critbit with a given prefix.
+ *
+ *  \param t Critbit tree.
+ *  \param s Prefix.
+ *  \return Number of strings in \a t that have \a s as a prefix.
+ *  \note With \c PCB_SUBTREE_COUNTS it takes a single descent, otherwise
+ *        the matching strings get traversed. Concurrent modifications can
+ *        make it inexact (see \c PCB_SUBTREE_COUNTS).
+ */
+size_t pcb_count_prefix(const pcb_t *t, const char *s)
+{
+    return _get_num_leaves(t, _find_suffixes_root(t, s));
+}
+
+
+/** Gets the rank of a string in the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param s String (it doesn't need to be in \a t).
+ *  \return Number of strings in \a t smaller than \a s.
+ *  \note The leaves at the left of the path of \a s are counted. With
+ *        \c PCB_SUBTREE_COUNTS it takes two descents, otherwise those
+ *        leaves get traversed. Concurrent modifications can make it
+ *        inexact (see \c PCB_SUBTREE_COUNTS).
+ */
+size_t pcb_rank(const pcb_t *t, const char *s)
+{
+    /* if it's empty, nothing is smaller */
+    pcb_ptr_t p = _get_root(t);
+    if (p == 0)
+        return 0;
+
+    /* gets the critical bit against the closest leaf */
+    size_t s_len = strlen(s);
+    pcb_ptr_t l = p;
+    while (_is_node_ptr(l))
+        l = _get_child(_get_const_node_ptr(t, l), _get_direction(_get_const_node_ptr(t, l), s, s_len));
+    size_t l_len = _get_leaf_len(t, l);
+    size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, l), l_len, s, s_len);
+    int found = l_len == s_len && cb_pos == s_len << 4;
+
+    /* adds the left siblings down to the leaf or the critical bit */
+    size_t rank = 0;
+    while (_is_node_ptr(p) && (found || _get_cb_pos(_get_const_node_ptr(t, p)) < cb_pos))
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, p);
+        int dir = _get_direction(n, s, s_len);
+        if (dir)
+            rank += _get_num_leaves(t, _get_child(n, 0));
+        p = _get_child(n, dir);
+    }
+
+    /* if it's not there, the subtree at the critical bit is either smaller
+       or bigger as a whole */
+    if (!found && _get_bit(s, s_len, cb_pos))
+        rank += _get_num_leaves(t, p);
+    return rank;
+}
+
+
+#if !PCB_SUBTREE_COUNTS
+/** Selection traversal context type. */
+typedef struct
+{
+    /** Number of leaves still to be skipped. */
+    size_t k;
+
+    /** Selected leaf. */
+    pcb_ptr_t p;
+
+} pcb_select_t;
+
+
+/** Visits a leaf while selecting one by its rank.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \param ctx Selection traversal context.
+ *  \return 0 once the leaf is found, 1 otherwise.
+ */
+static int _select_visit(const pcb_t *t, pcb_ptr_t p, void *ctx)
+{
+    (void)t;
+    pcb_select_t *sel = ctx;
+    if (sel->k-- > 0)
+        return 1;
+    sel->p = p;
+    return 0;
+}
+#endif
+
+
+/** Gets a string in the critbit by its rank.
+ *
+ *  \param t Critbit tree.
+ *  \param k Rank (0 for the smallest string).
+ *  \return String with \a k smaller strings in \a t or \c NULL if there
+ *          are not enough strings.
+ *  \note With \c PCB_SUBTREE_COUNTS it takes a single descent, otherwise
+ *        the strings get traversed in order. Concurrent modifications can
+ *        make the rank inexact (see \c PCB_SUBTREE_COUNTS).
+ */
+const char *pcb_select(const pcb_t *t, size_t k)
+{
+    pcb_ptr_t p = _get_root(t);
+    if (p == 0)
+        return NULL;
+#if PCB_SUBTREE_COUNTS
+    /* goes down to the side holding the rank */
+    if (k >= _get_num_leaves(t, p))
+        return NULL;
+    while (_is_node_ptr(p))
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, p);
+        size_t num_left = _get_num_leaves(t, _get_child(n, 0));
+        int dir = k >= num_left;
+        if (dir)
+            k -= num_left;
+        p = _get_child(n, dir);
+    }
+#else
+    pcb_select_t sel = { k, 0 };
+    _traverse(t, p, 0, 0, _select_visit, &sel);
+    p = sel.p;
+    if (p == 0)
+        return NULL;
+#endif
+    return _get_leaf_str(t, p);
+}
+
+
+/** Gets a random string from the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param r Random number, uniformly distributed.
+ *  \return String or \c NULL if \a t is empty.
+ *  \note Every string is equally likely (except for the negligible bias of
+ *        taking \a r modulo the number of strings).
+ */
+const char *pcb_sample(const pcb_t *t, size_t r)
+{
+    size_t num_leaves = _get_num_leaves(t, _get_root(t));
+    return num_leaves > 0 ? pcb_select(t, r % num_leaves) : NULL;
+}
+
+
+/** Finds the longest string in the critbit that is a prefix of a given one.
+ *
+ *  \param t Critbit tree.
+ *  \param s String.
+ *  \param s_len Length of \a s.
+ *  \return Leaf base pointer or 0 if no string in \a t is a prefix of \a s.
+ *  \note A string in \a t that is a proper prefix of \a s branches off the
+ *        path of \a s to the left, at the presence bit of the byte after
+ *        it, and only that leaf can be at that side. So a single descent
+ *        keeps those nodes (the last \c PCB_PATH_STACK_DEPTH of them) and
+ *        backtracks to the deepest one before the critical bit.
+ */
+static pcb_ptr_t _longest_prefix(const pcb_t *t, const char *s, size_t s_len)
+{
+    /* if it's empty, there is no prefix */
+    pcb_ptr_t r = _get_root(t);
+    if (r == 0)
+        return 0;
+
+    /* descends, keeping the nodes where a prefix branches off */
+    pcb_ptr_t cands[PCB_PATH_STACK_DEPTH];
+    size_t num_cands = 0;
+    pcb_ptr_t p = r;
+    while (_is_node_ptr(p))
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, p);
+        int dir = _get_direction(n, s, s_len);
+        if (dir && (_get_cb_pos(n) & 15) == 0)
+            cands[num_cands++ % PCB_PATH_STACK_DEPTH] = p;
+        p = _get_child(n, dir);
+    }
+
+    /* the leaf is the longest one if it's a prefix */
+    const char *l = _get_leaf_str(t, p);
+    size_t l_len = _get_leaf_len(t, p);
+    if (l_len <= s_len && memcmp(l, s, l_len) == 0)
+        return p;
+
+    /* otherwise it's the deepest one branching off before the critical bit */
+    size_t cb_pos = _get_critbit_pos(l, l_len, s, s_len);
+    for (size_t i = num_cands; i > 0 && i + PCB_PATH_STACK_DEPTH > num_cands; i--)
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, cands[(i - 1) % PCB_PATH_STACK_DEPTH]);
+        if (_get_cb_pos(n) < cb_pos)
+            return _get_child(n, 0);
+    }
+    if (num_cands <= PCB_PATH_STACK_DEPTH)
+        return 0;
+
+    /* the shallower nodes were lost, so descends again up to the critical bit */
+    pcb_ptr_t best = 0;
+    for (p = r; _is_node_ptr(p) && _get_cb_pos(_get_const_node_ptr(t, p)) < cb_pos;)
+    {
+        const pcb_node_t *n = _get_const_node_ptr(t, p);
+        int dir = _get_direction(n, s, s_len);
+        if (dir && (_get_cb_pos(n) & 15) == 0)
+            best = _get_child(n, 0);
+        p = _get_child(n, dir);
+    }
+    return best;
+}
+
+
+/** Finds the longest string in the critbit that is a prefix of a given one.
+ *
+ *  \param t Critbit tree.
+ *  \param s String.
+ *  \return The longest string in \a t that is a prefix of \a s (\a s
+ *          included) or \c NULL if there is none.
+ *  \note The returned string is only valid until the next modification of
+ *        \a t.
+ */
+const char *pcb_longest_prefix(const pcb_t *t, const char *s)
+{
+    pcb_ptr_t p = _longest_prefix(t, s, strlen(s));
+    return p != 0 ? _get_leaf_str(t, p) : NULL;
+}
+
+
+/** Finds the longest string in the critbit that is a prefix of a given one,
+ *  using explicit lengths.
+ *
+ *  \param t Critbit tree.
+ *  \param s String (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \param r_len Length of the returned string (output, can be \c NULL).
+ *  \return The longest string in \a t that is a prefix of \a s (\a s
+ *          included) or \c NULL if there is none.
+ *  \note The returned string is NUL terminated and it's only valid until the
+ *        next modification of \a t.
+ */
+const char *pcb_longest_prefix_len(const pcb_t *t, const char *s, size_t s_len, size_t *r_len)
+{
+    pcb_ptr_t p = _longest_prefix(t, s, s_len);
+    if (p == 0)
+        return NULL;
+    if (r_len != NULL)
+        *r_len = _get_leaf_len(t, p);
+    return _get_leaf_str(t, p);
+}
+
+
+/** Finds the longest string in the critbit that is a prefix of a given one,
+ *  with its value.
+ *
+ *  \param t Critbit tree.
+ *  \param s String.
+ *  \param v Where to store a pointer to the value (can be \c NULL).
+ *  \return The longest string in \a t that is a prefix of \a s (\a s
+ *          included) or \c NULL if there is none.
+ *  \note The returned string and value are only valid until the next
+ *        modification of \a t.
+ */
+const char *pcb_map_longest_prefix(const pcb_t *t, const char *s, pcb_value_t **v)
+{
+    pcb_ptr_t p = _longest_prefix(t, s, strlen(s));
+    if (p == 0)
+        return NULL;
+    if (v != NULL)
+        *v = _get_leaf_value(t, p);
+    return _get_leaf_str(t, p);
+}
+
+
+/** Encodes a bit string as a key.
+ *
+ *  \param buf Buffer for the key (at least \a num_bits / 8 + 2 bytes).
+ *  \param bits Bits, from the most significant one of the first byte.
+ *  \param num_bits Number of bits.
+ *  \return Length of the key (\a num_bits / 8 + 1 bytes).
+ *  \note The bits are followed by a 1 bit and zero padded up to the end of
+ *        the byte, so that keys of different bit lengths are distinct. The
+ *        key is NUL terminated, but it can contain NUL bytes, so it must be
+ *        added with pcb_add_len().
+ */
+size_t pcb_bits_key(char *buf, const char *bits, size_t num_bits)
+{
+    size_t num_bytes = num_bits / 8;
+    unsigned stop = 0x80u >> (num_bits % 8);
+    memcpy(buf, bits, num_bytes);
+    buf[num_bytes] = (char)(num_bits % 8 != 0 ? ((unsigned char)bits[num_bytes] & -stop) | stop : stop);
+    buf[num_bytes + 1] = '\0';
+    return num_bytes + 1;
+}
+
+
+/** Gets the only encoded prefix of a query that branches off its path at a
+ *  given critbit position.
+ *
+ *  \param q Encoded query (see pcb_bits_key()).
+ *  \param q_len Length of \a q.
+ *  \param cb_pos CritBit position.
+ *  \param e Last byte of the encoded prefix (output).
+ *  \return Length of the encoded prefix or 0 if there is none.
+ *  \note Up to the byte of the position, the prefix is equal to \a q. At a
+ *        presence bit it's the prefix ending at the last 1 bit of the
+ *        previous byte. At a bit the query doesn't have set it's the prefix
+ *        ending there, and at one it does it's the prefix ending at the
+ *        previous 1 bit of the byte (the bits in between must be 0 for both).
+ */
+static size_t _get_branching_prefix(const unsigned char *q, size_t q_len, size_t cb_pos, unsigned char *e)
+{
+    size_t j = cb_pos >> 4;
+    size_t k = cb_pos & 15;
+    if (j >= q_len)
+        return 0;
+    if (k == 0)
+    {
+        /* the previous byte must be the whole end of the prefix */
+        if (j == 0 || q[j - 1] == 0)
+            return 0;
+        *e = q[j - 1];
+        return j;
+    }
+
+    /* the 1 bit ending the prefix, either at the position or before */
+    unsigned i = (unsigned)k - 1;
+    unsigned r = i;
+    if (q[j] & (0x80u >> i))
+    {
+        unsigned m = i > 0 ? (unsigned)q[j] >> (8 - i) : 0;
+        if (m == 0)
+            return 0;
+        r = i - 1 - (unsigned)__builtin_ctz(m);
+    }
+
+    /* in the last byte, the prefix must end before the query */
+    if (j == q_len - 1 && (q[j] & (0x7Fu >> r)) == 0)
+        return 0;
+    *e = (unsigned char)((q[j] & ~(0xFFu >> r)) | (0x80u >> r));
+    return j + 1;
+}
+
+
+/** Candidate prefix of a bit string query. */
+typedef struct
+{
+    /** Subtree where it can be. */
+    pcb_ptr_t p;
+
+    /** Length of the encoded prefix. */
+    size_t e_len;
+
+    /** Number of bits of the prefix. */
+    size_t bits;
+
+    /** Last byte of the encoded prefix. */
+    unsigned char e;
+
+} pcb_bits_cand_t;
+
+
+/** Gets the candidate prefix of a query branching off its path at a given
+ *  critbit position.
+ *
+ *  \param q Encoded query.
+ *  \param q_len Length of \a q.
+ *  \param p Subtree where the prefix can be.
+ *  \param cb_pos CritBit position.
+ *  \param c Candidate prefix (output).
+ *  \return 1 if there is a candidate, 0 otherwise.
+ */
+static int _get_prefix_cand(const unsigned char *q, size_t q_len, pcb_ptr_t p, size_t cb_pos, pcb_bits_cand_t *c)
+{
+    c->e_len = _get_branching_prefix(q, q_len, cb_pos, &c->e);
+    if (c->e_len == 0)
+        return 0;
+    c->p = p;
+    c->bits = 8 * (c->e_len - 1) + 7 - (size_t)__builtin_ctz(c->e);
+    return 1;
+}
+
+
+/** Moves the last of some candidate prefixes to keep them sorted from the
+ *  longest one.
+ *
+ *  \param cands Candidate prefixes, sorted except for the last one.
+ *  \param i Index of the last one.
+ */
+static void _sort_prefix_cand(pcb_bits_cand_t *cands, size_t i)
+{
+    pcb_bits_cand_t c = cands[i];
+    for (; i > 0 && cands[i - 1].bits < c.bits; i--)
+        cands[i] = cands[i - 1];
+    cands[i] = c;
+}
+
+
+/** Bit string longest prefix search state. */
+typedef struct
+{
+    /** Critbit tree. */
+    const pcb_t *t;
+
+    /** Encoded query. */
+    unsigned char *q;
+
+    /** Longest prefix found (0 if none). */
+    pcb_ptr_t best;
+
+    /** Number of bits of \a best. */
+    size_t best_bits;
+
+} pcb_bits_prefix_t;
+
+
+/** Checks if a candidate prefix is in its subtree, unless it cannot be
+ *  longer than the longest prefix found so far.
+ *
+ *  \param bp Bit string longest prefix search state.
+ *  \param c Candidate prefix.
+ *  \return 1 if it's the new longest prefix, 0 otherwise.
+ */
+static int _check_prefix_cand(pcb_bits_prefix_t *bp, const pcb_bits_cand_t *c)
+{
+    if (bp->best != 0 && c->bits <= bp->best_bits)
+        return 0;
+
+    /* the query becomes the prefix by replacing its last byte */
+    unsigned char saved = bp->q[c->e_len - 1];
+    bp->q[c->e_len - 1] = c->e;
+    const char *es = (const char *)bp->q;
+    pcb_ptr_t p = c->p;
     while (_is_node_ptr(p))
-        p = _get_node_ptr(t, p)->used.children[_get_direction(_get_node_ptr(t, p), s, s_len)];
+        p = _get_child(_get_const_node_ptr(bp->t, p), _get_direction(_get_const_node_ptr(bp->t, p), es, c->e_len));
+    int found = _leaf_matches(bp->t, p, es, c->e_len);
+    bp->q[c->e_len - 1] = saved;
+    if (!found)
+        return 0;
+    bp->best = p;
+    bp->best_bits = c->bits;
+    return 1;
+}
+
+
+/** Finds the longest bit string in the critbit that is a prefix of a given
+ *  one.
+ *
+ *  \param t Critbit tree, with keys encoding bit strings (see
+ *         pcb_bits_key()).
+ *  \param bits Bits, from the most significant one of the first byte.
+ *  \param num_bits Number of bits.
+ *  \param r_bits Number of bits of the returned key (output, can be
+ *         \c NULL).
+ *  \return Key of the longest bit string in \a t that is a prefix of
+ *          \a bits (the whole of it included) or \c NULL if there is none
+ *          or in case of error.
+ *  \note Every encoded prefix of the query branches off its path at a
+ *        single critbit position, determined by the query, and so does its
+ *        number of bits. A single descent keeps the nodes (the last
+ *        \c PCB_PATH_STACK_DEPTH of them, descending again for the others)
+ *        and, once the critical bit is known, the candidates are tried from
+ *        the longest one, with a short descent each, until one is there.
+ *        Unlike with byte strings, deeper positions can give shorter
+ *        prefixes, so the order is not the one of the path. The returned
+ *        key is only valid until the next modification of \a t.
+ */
+const char *pcb_longest_prefix_bits(const pcb_t *t, const char *bits, size_t num_bits, size_t *r_bits)
+{
+    /* if it's empty, there is no prefix */
+    pcb_ptr_t r = _get_root(t);
+    if (r == 0)
+        return NULL;
+
+    /* encodes the query */
+    unsigned char q_buf[256];
+    size_t q_len = num_bits / 8 + 1;
+    unsigned char *q = q_len + 1 <= sizeof(q_buf) ? q_buf : malloc(q_len + 1);
+    if (q == NULL)
+        return NULL;
+    pcb_bits_key((char *)q, bits, num_bits);
+    const char *qs = (const char *)q;
+
+    /* descends, keeping the nodes */
+    pcb_ptr_t path[PCB_PATH_STACK_DEPTH];
+    size_t depth = 0;
+    pcb_ptr_t p = r;
+    while (_is_node_ptr(p))
+    {
+        path[depth++ % PCB_PATH_STACK_DEPTH] = p;
+        p = _get_child(_get_const_node_ptr(t, p), _get_direction(_get_const_node_ptr(t, p), qs, q_len));
+    }
+
+    /* if the whole query is there, it's the longest one */
+    pcb_bits_prefix_t bp = { t, q, 0, 0 };
+    if (_leaf_matches(t, p, qs, q_len))
+    {
+        bp.best = p;
+        bp.best_bits = num_bits;
+    }
+    else
+    {
+        /* gets the candidates branching off the kept nodes, sorted from the
+           longest one, and the one below the critical bit */
+        size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, p), _get_leaf_len(t, p), qs, q_len);
+        pcb_bits_cand_t cands[PCB_PATH_STACK_DEPTH + 1];
+        size_t num_cands = 0;
+        pcb_ptr_t below = p;
+        for (size_t i = depth; i > 0 && i + PCB_PATH_STACK_DEPTH > depth; i--)
+        {
+            const pcb_node_t *n = _get_const_node_ptr(t, path[(i - 1) % PCB_PATH_STACK_DEPTH]);
+            size_t pos = _get_cb_pos(n);
+            if (pos >= cb_pos)
+            {
+                below = path[(i - 1) % PCB_PATH_STACK_DEPTH];
+                continue;
+            }
+            if (_get_prefix_cand(q, q_len, _get_child(n, !_get_direction(n, qs, q_len)), pos, &cands[num_cands]))
+                _sort_prefix_cand(cands, num_cands++);
+        }
+        if (_get_prefix_cand(q, q_len, below, cb_pos, &cands[num_cands]))
+            _sort_prefix_cand(cands, num_cands++);
+        for (size_t i = 0; i < num_cands && !_check_prefix_cand(&bp, &cands[i]); i++)
+            ;
+
+        /* and the ones branching off the lost nodes, descending again */
+        pcb_bits_cand_t c;
+        p = r;
+        for (size_t i = 0; i + PCB_PATH_STACK_DEPTH < depth; i++)
+        {
+            const pcb_node_t *n = _get_const_node_ptr(t, p);
+            size_t pos = _get_cb_pos(n);
+            int dir = _get_direction(n, qs, q_len);
+            if (pos >= cb_pos)
+            {
+                /* the one at the critical bit was in a smaller subtree */
+                if (_get_prefix_cand(q, q_len, p, cb_pos, &c))
+                    _check_prefix_cand(&bp, &c);
+                break;
+            }
+            if (_get_prefix_cand(q, q_len, _get_child(n, !dir), pos, &c))
+                _check_prefix_cand(&bp, &c);
+            p = _get_child(n, dir);
+        }
+    }
+    if (q != q_buf)
+        free(q);
+    if (bp.best == 0)
+        return NULL;
+    if (r_bits != NULL)
+        *r_bits = bp.best_bits;
+    return _get_leaf_str(t, bp.best);
+}
+
+
+/** Cursor type. */
+struct pcb_cursor_t
+{
+    /** Critbit tree. */
+    const pcb_t *t;
+
+    /** Internal nodes from the root to the current leaf. */
+    pcb_ptr_t *path;
+
+    /** Directions taken at each node of the path. */
+    unsigned char *dirs;
+
+    /** Number of nodes in the path. */
+    size_t depth;
+
+    /** Capacity of the path. */
+    size_t path_size;
+
+    /** Current leaf (0 if the cursor is not positioned). */
+    pcb_ptr_t leaf;
+};
+
+
+/** Pushes a node into the path of a cursor.
+ *
+ *  \param c Cursor.
+ *  \param p Node base pointer.
+ *  \param dir Direction taken at the node.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _cursor_push(pcb_cursor_t *c, pcb_ptr_t p, int dir)
+{
+    /* grows the path if needed */
+    if (c->depth == c->path_size)
+    {
+        size_t new_size = c->path_size * 2;
+        pcb_ptr_t *np = realloc(c->path, new_size * sizeof(pcb_ptr_t));
+        if (np == NULL)
+            return 0;
+        c->path = np;
+        unsigned char *nd = realloc(c->dirs, new_size);
+        if (nd == NULL)
+            return 0;
+        c->dirs = nd;
+        c->path_size = new_size;
+    }
+
+    /* pushes the node */
+    c->path[c->depth] = p;
+    c->dirs[c->depth] = (unsigned char)dir;
+    c->depth++;
+    return 1;
+}
+
+
+/** Descends from a subtree root to its smallest or biggest leaf, positioning
+ *  the cursor there.
+ *
+ *  \param c Cursor.
+ *  \param p Subtree root.
+ *  \param dir 0 to go to the smallest leaf, 1 to go to the biggest.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _cursor_descend(pcb_cursor_t *c, pcb_ptr_t p, int dir)
+{
+    while (_is_node_ptr(p))
+    {
+        if (!_cursor_push(c, p, dir))
+        {
+            c->leaf = 0;
+            return 0;
+        }
+        p = _get_child(_get_const_node_ptr(c->t, p), dir);
+    }
+    c->leaf = p;
+    return 1;
+}
+
+
+/** Moves a cursor to the adjacent leaf in a given direction.
+ *
+ *  \param c Cursor.
+ *  \param dir 1 to move to the next leaf, 0 to move to the previous one.
+ *  \return 1 if the cursor is positioned after moving, 0 otherwise.
+ */
+static int _cursor_step(pcb_cursor_t *c, int dir)
+{
+    /* nothing to do if it's not positioned */
+    if (c->leaf == 0)
+        return 0;
+
+    /* goes up until it's possible to turn in the required direction */
+    while (c->depth > 0 && c->dirs[c->depth - 1] == dir)
+        c->depth--;
+    if (c->depth == 0)
+    {
+        c->leaf = 0;
+        return 0;
+    }
+
+    /* turns and goes down on the opposite side */
+    c->dirs[c->depth - 1] = (unsigned char)dir;
+    return _cursor_descend(c, _get_child(_get_const_node_ptr(c->t, c->path[c->depth - 1]), dir), !dir);
+}
+
+
+/** Creates a cursor over a critbit.
+ *
+ *  \param t Critbit tree.
+ *  \return Newly created cursor (not positioned) or \c NULL in case of
+ *          error.
+ *  \note Adding or removing strings (including through the map functions)
+ *        invalidates every cursor over \a t, as does clearing it; an
+ *        invalidated cursor can only be destroyed. Changing values through
+ *        the pointers returned by \c pcb_cursor_value() is allowed.
+ */
+pcb_cursor_t *pcb_cursor_create(const pcb_t *t)
+{
+    pcb_cursor_t *c = malloc(sizeof(pcb_cursor_t));
+    if (c == NULL)
+        return NULL;
+    c->t = t;
+    c->depth = 0;
+    c->path_size = 64;
+    c->leaf = 0;
+    c->path = malloc(c->path_size * sizeof(pcb_ptr_t));
+    c->dirs = malloc(c->path_size);
+    if (c->path == NULL || c->dirs == NULL)
+    {
+        pcb_cursor_destroy(c);
+        return NULL;
+    }
+    return c;
+}
+
+
+/** Destroys a cursor.
+ *
+ *  \param c Cursor to be destroyed.
+ */
+void pcb_cursor_destroy(pcb_cursor_t *c)
+{
+    free(c->path);
+    free(c->dirs);
+    free(c);
+}
+
+
+/** Positions a cursor at the smallest string of its critbit.
+ *
+ *  \param c Cursor.
+ *  \return 1 if the cursor is positioned, 0 otherwise (empty critbit).
+ */
+int pcb_cursor_first(pcb_cursor_t *c)
+{
+    c->depth = 0;
+    c->leaf = 0;
+    pcb_ptr_t r = _get_root(c->t);
+    return r != 0 && _cursor_descend(c, r, 0);
+}
+
+
+/** Positions a cursor at the biggest string of its critbit.
+ *
+ *  \param c Cursor.
+ *  \return 1 if the cursor is positioned, 0 otherwise (empty critbit).
+ */
+int pcb_cursor_last(pcb_cursor_t *c)
+{
+    c->depth = 0;
+    c->leaf = 0;
+    pcb_ptr_t r = _get_root(c->t);
+    return r != 0 && _cursor_descend(c, r, 1);
+}
+
+
+/** Positions a cursor at the smallest string not smaller than a given
+ *  one, using explicit lengths.
+ *
+ *  \param c Cursor.
+ *  \param s Base string (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \return 1 if the cursor is positioned, 0 otherwise (no such string).
+ */
+int pcb_cursor_lower_bound_len(pcb_cursor_t *c, const char *s, size_t s_len)
+{
+    const pcb_t *t = c->t;
+
+    /* starts from the root */
+    c->depth = 0;
+    c->leaf = 0;
+    pcb_ptr_t r = _get_root(t);
+    if (r == 0)
+        return 0;
+
+    /* descends with s, recording the path */
+    pcb_ptr_t p = r;
+    while (_is_node_ptr(p))
+    {
+        int dir = _get_direction(_get_const_node_ptr(t, p), s, s_len);
+        if (!_cursor_push(c, p, dir))
+            return 0;
+        p = _get_child(_get_const_node_ptr(t, p), dir);
+    }
+
+    /* if p is s, it's done */
+    if (_leaf_matches(t, p, s, s_len))
+    {
+        c->leaf = p;
+        return 1;
+    }
+
+    /* otherwise, goes back to the subtree hanging at the critical bit */
+    size_t cb_pos = _get_critbit_pos(_get_leaf_str(t, p), _get_leaf_len(t, p), s, s_len);
+    while (c->depth > 0 && _get_cb_pos(_get_const_node_ptr(t, c->path[c->depth - 1])) > cb_pos)
+        c->depth--;
+    p = c->depth > 0 ?
+        _get_child(_get_const_node_ptr(t, c->path[c->depth - 1]), c->dirs[c->depth - 1]) : r;
+
+    /* s is either before all the strings in that subtree or after them */
+    if (!_get_bit(s, s_len, cb_pos))
+        return _cursor_descend(c, p, 0);
+    return _cursor_descend(c, p, 1) && _cursor_step(c, 1);
+}
+
+
+/** Positions a cursor at the smallest string not smaller than a given
+ *  one.
+ *
+ *  \param c Cursor.
+ *  \param s Base string.
+ *  \return 1 if the cursor is positioned, 0 otherwise (no such string).
+ */
+int pcb_cursor_lower_bound(pcb_cursor_t *c, const char *s)
+{
+    return pcb_cursor_lower_bound_len(c, s, strlen(s));
+}
+
+
+/** Positions a cursor at a given string, using explicit lengths.
+ *
+ *  \param c Cursor.
+ *  \param s String (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
+ *  \return 1 if the string was found, 0 otherwise (the cursor is not
+ *          positioned).
+ */
+int pcb_cursor_seek_len(pcb_cursor_t *c, const char *s, size_t s_len)
+{
+    if (pcb_cursor_lower_bound_len(c, s, s_len) && _leaf_matches(c->t, c->leaf, s, s_len))
+        return 1;
+    c->leaf = 0;
+    return 0;
+}
+
+
+/** Positions a cursor at a given string.
+ *
+ *  \param c Cursor.
+ *  \param s String.
+ *  \return 1 if the string was found, 0 otherwise (the cursor is not
+ *          positioned).
+ */
+int pcb_cursor_seek(pcb_cursor_t *c, const char *s)
+{
+    return pcb_cursor_seek_len(c, s, strlen(s));
+}
+
+
+/** Moves a cursor to the next string.
+ *
+ *  \param c Cursor.
+ *  \return 1 if the cursor is positioned, 0 otherwise (it was at the last
+ *          string or not positioned).
+ */
+int pcb_cursor_next(pcb_cursor_t *c)
+{
+    return _cursor_step(c, 1);
+}
+
+
+/** Moves a cursor to the previous string.
+ *
+ *  \param c Cursor.
+ *  \return 1 if the cursor is positioned, 0 otherwise (it was at the first
+ *          string or not positioned).
+ */
+int pcb_cursor_prev(pcb_cursor_t *c)
+{
+    return _cursor_step(c, 0);
+}
+
+
+/** Gets the string at the position of a cursor.
+ *
+ *  \param c Cursor.
+ *  \param len Length of the string (output, can be \c NULL).
+ *  \return String or \c NULL if the cursor is not positioned.
+ *  \note The returned string is NUL terminated.
+ */
+const char *pcb_cursor_key(const pcb_cursor_t *c, size_t *len)
+{
+    if (c->leaf == 0)
+        return NULL;
+    if (len != NULL)
+        *len = _get_leaf_len(c->t, c->leaf);
+    return _get_leaf_str(c->t, c->leaf);
+}
+
+
+/** Gets the value at the position of a cursor.
+ *
+ *  \param c Cursor.
+ *  \return Pointer to the value or \c NULL if the cursor is not positioned.
+ */
+pcb_value_t *pcb_cursor_value(const pcb_cursor_t *c)
+{
+    return c->leaf != 0 ? _get_leaf_value(c->t, c->leaf) : NULL;
+}
+
+
+/** Range traversal context type. */
+typedef struct
+{
+    /** Upper bound (excluded, \c NULL if there is none). */
+    const char *hi;
+
+    /** Length of the upper bound. */
+    size_t hi_len;
+
+    /** Maximum number of strings to visit. */
+    size_t max_count;
+
+    /** Number of strings visited. */
+    size_t count;
+
+    /** Whether the iteration stopped because of the callback. */
+    int stopped;
+
+    /** Map callback. */
+    pcb_map_cb_t map_cb;
+
+} pcb_range_t;
+
+
+/** Visits a leaf of a range.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \param ctx Range traversal context.
+ *  \return 1 to continue the traversal, 0 to stop it.
+ */
+static int _range_visit(const pcb_t *t, pcb_ptr_t p, void *ctx)
+{
+    pcb_range_t *rc = ctx;
+
+    /* stops at the upper bound or when the limit is reached */
+    if (rc->count == rc->max_count ||
+        (rc->hi != NULL && _compare(_get_leaf_str(t, p), _get_leaf_len(t, p), rc->hi, rc->hi_len) >= 0))
+        return 0;
+
+    /* executes the callback */
+    rc->count++;
+    if (!_map_cb_visit(t, p, &rc->map_cb))
+    {
+        rc->stopped = 1;
+        return 0;
+    }
+    return 1;
+}
+
+
+/** Iterates over the strings in a range of the critbit, with their values.
+ *
+ *  \param t Critbit tree.
+ *  \param lo Lower bound (included, \c NULL if there is none).
+ *  \param hi Upper bound (excluded, \c NULL if there is none).
+ *  \param max_count Maximum number of strings to visit.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \param stopped Set to 1 if a callback execution returned 0, 0 otherwise
+ *         (output, can be \c NULL).
+ *  \return Number of strings visited (including the one whose callback
+ *          returned 0).
+ *  \note The tree is descended once, to the lower bound, and then walked in
+ *        order until reaching \a hi or \a max_count strings.
+ */
+size_t pcb_map_find_range_n(const pcb_t *t, const char *lo, const char *hi, size_t max_count,
+                            int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx, int *stopped)
+{
+    pcb_range_t rc = { hi, hi != NULL ? strlen(hi) : 0, max_count, 0, 0, { cb, ctx } };
+
+    /* descends once to the lower bound, leaving the following subtrees
+       pending, and walks from there */
+    pcb_ptr_t r = _get_root(t);
+    if (r != 0 && max_count > 0)
+    {
+        pcb_traverse_t ts;
+        ts.top = ts.count = 0;
+        ts.lost = 0;
+        pcb_ptr_t first = lo != NULL ? _traverse_lower_bound(t, r, &ts, lo, strlen(lo)) : r;
+        _traverse_from(t, r, &ts, first, 0, _range_visit, &rc);
+    }
+    if (stopped != NULL)
+        *stopped = rc.stopped;
+    return rc.count;
+}
+
+
+/** Iterates over the strings in a range of the critbit, with their values.
+ *
+ *  \param t Critbit tree.
+ *  \param lo Lower bound (included, \c NULL if there is none).
+ *  \param hi Upper bound (excluded, \c NULL if there is none).
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note \a cb is executed in order over every string in \a t that is not
+ *        smaller than \a lo and smaller than \a hi. The iteration is stopped
+ *        if the callback returns 0.
+ */
+int pcb_map_find_range(const pcb_t *t, const char *lo, const char *hi,
+                       int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx)
+{
+    int stopped;
+    pcb_map_find_range_n(t, lo, hi, SIZE_MAX, cb, ctx, &stopped);
+    return !stopped;
+}
+
+
+/** Iterates over a limited number of strings in a range of the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param lo Lower bound (included, \c NULL if there is none).
+ *  \param hi Upper bound (excluded, \c NULL if there is none).
+ *  \param max_count Maximum number of strings to visit.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \param stopped Set to 1 if a callback execution returned 0, 0 otherwise
+ *         (output, can be \c NULL).
+ *  \return Number of strings visited (including the one whose callback
+ *          returned 0).
+ *  \note Pages can be chained by using the successor of the last visited
+ *        string as the next lower bound.
+ */
+size_t pcb_find_range_n(const pcb_t *t, const char *lo, const char *hi, size_t max_count,
+                        int (*cb)(const char *s, void *ctx), void *ctx, int *stopped)
+{
+    pcb_set_cb_t set_cb = { cb, ctx };
+    return pcb_map_find_range_n(t, lo, hi, max_count, _set_cb, &set_cb, stopped);
+}
+
+
+/** Iterates over the strings in a range of the critbit.
+ *
+ *  \param t Critbit tree.
+ *  \param lo Lower bound (included, \c NULL if there is none).
+ *  \param hi Upper bound (excluded, \c NULL if there is none).
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note \a cb is executed in order over every string in \a t that is not
+ *        smaller than \a lo and smaller than \a hi. The iteration is stopped
+ *        if the callback returns 0.
+ */
+int pcb_find_range(const pcb_t *t, const char *lo, const char *hi, int (*cb)(const char *s, void *ctx), void *ctx)
+{
+    pcb_set_cb_t set_cb = { cb, ctx };
+    return pcb_map_find_range(t, lo, hi, _set_cb, &set_cb);
+}
+
+
+/** Frozen critbit image magic number. */
+#define PCB_FROZEN_MAGIC "PCBFROZ"
+
+/** Frozen critbit image version. */
+#define PCB_FROZEN_VERSION 1
+
+/** Frozen critbit image byte order mark. */
+#define PCB_FROZEN_BYTE_ORDER 0x01020304u
+
+/** Frozen critbit image alignment. */
+#define PCB_FROZEN_ALIGN 64
+
+
+/** Frozen critbit image header type. */
+typedef struct
+{
+    /** Magic number (\c PCB_FROZEN_MAGIC, NUL terminated). */
+    char magic[8];
+
+    /** Version. */
+    uint32_t version;
+
+    /** Byte order mark (\c PCB_FROZEN_BYTE_ORDER in native order). */
+    uint32_t byte_order;
+
+    /** Root (internal node or leaf reference). */
+    uint32_t root;
+
+    /** Padding. */
+    uint32_t pad;
+
+    /** Number of internal nodes. */
+    uint64_t num_nodes;
+
+    /** Number of leaves. */
+    uint64_t num_leaves;
+
+    /** Offset of the key blob from the start of the image. */
+    uint64_t blob_offset;
+
+    /** Size of the key blob. */
+    uint64_t blob_size;
+
+    /** Total size of the image. */
+    uint64_t image_size;
+
+} pcb_frozen_header_t;
+
+
+/** Frozen critbit internal node type. */
+typedef struct
+{
+    /** CritBit byte index. */
+    uint32_t cb_byte;
+
+    /** CritBit mask, applied to the byte with its presence bit (0x100). */
+    uint32_t cb_mask;
+
+    /** Children (internal nodes as index << 1 | 1, leaves as their blob
+     *  offset in blocks << 1). */
+    uint32_t children[2];
+
+} pcb_frozen_node_t;
+
+
+/** Frozen critbit leaf type (in the key blob, aligned to blocks). */
+typedef struct
+{
+    /** String length. */
+    uint32_t len;
+
+    /** String contents (NUL terminated). */
+    char s[];
+
+} pcb_frozen_leaf_t;
+
+
+/** Frozen critbit type. */
+struct pcb_frozen_t
+{
+    /** Image. */
+    const char *image;
+
+    /** Image header. */
+    const pcb_frozen_header_t *header;
+
+    /** Internal nodes. */
+    const pcb_frozen_node_t *nodes;
+
+    /** Key blob (leaves in key order). */
+    const char *blob;
+
+    /** Size of the mapping holding the image (0 if it was allocated). */
+    size_t mapped_size;
+
+};
+
+
+/** Gets the size of a frozen leaf in the key blob.
+ *
+ *  \param len String length.
+ *  \return Size in bytes (a multiple of \c PCB_BLOCK_SIZE).
+ */
+static size_t _frozen_leaf_size(size_t len)
+{
+    return (offsetof(pcb_frozen_leaf_t, s) + len + 1 + PCB_BLOCK_SIZE - 1) / PCB_BLOCK_SIZE * PCB_BLOCK_SIZE;
+}
+
+
+/** Frozen critbit layout context type. */
+typedef struct
+{
+    /** Critbit tree. */
+    const pcb_t *t;
+
+    /** New index of every internal node, by pool index. */
+    uint32_t *new_index;
+
+    /** Pool index of every internal node, by new index. */
+    uint32_t *order;
+
+    /** Next new index. */
+    uint32_t next_index;
+
+} pcb_frozen_layout_t;
+
+
+/** Assigns new indices to the internal nodes in the top levels of a subtree,
+ *  in van Emde Boas order.
+ *
+ *  \param fl Frozen critbit layout context.
+ *  \param r Subtree root (an internal node).
+ *  \param h Number of levels to lay out.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note The top half of the levels is laid out first, followed by every
+ *        subtree hanging from it, so any root to leaf path crosses
+ *        O(log(n) / log(B)) blocks of size B, whatever B is.
+ */
+static int _frozen_layout(pcb_frozen_layout_t *fl, pcb_ptr_t r, size_t h)
+{
+    /* a single level is just the root */
+    if (h == 1)
+    {
+        fl->order[fl->next_index] = (uint32_t)(r >> 1);
+        fl->new_index[(size_t)(r >> 1)] = fl->next_index++;
+        return 1;
+    }
+
+    /* lays out the top half */
+    size_t ht = h / 2;
+    if (!_frozen_layout(fl, r, ht))
+        return 0;
+
+    /* lays out the bottom subtrees, from left to right */
+    struct { pcb_ptr_t p; size_t d; } *stack = NULL;
+    size_t stack_size = 0, depth = 0;
+    if (!_reserve((void **)&stack, &stack_size, 1, sizeof(*stack)))
+        return 0;
+    stack[depth].p = r;
+    stack[depth++].d = 0;
+    while (depth > 0)
+    {
+        pcb_ptr_t p = stack[--depth].p;
+        size_t d = stack[depth].d;
+        if (d == ht)
+        {
+            if (!_frozen_layout(fl, p, h - ht))
+            {
+                free(stack);
+                return 0;
+            }
+            continue;
+        }
+        if (!_reserve((void **)&stack, &stack_size, depth + 2, sizeof(*stack)))
+        {
+            free(stack);
+            return 0;
+        }
+        for (int dir = 1; dir >= 0; dir--)
+        {
+            pcb_ptr_t c = _get_child(_get_const_node_ptr(fl->t, p), dir);
+            if (_is_node_ptr(c))
+            {
+                stack[depth].p = c;
+                stack[depth++].d = d + 1;
+            }
+        }
+    }
+    free(stack);
+    return 1;
+}
+
+
+/** Rounds a size up to the frozen critbit image alignment.
+ *
+ *  \param size Size in bytes.
+ *  \return Rounded size.
+ */
+static size_t _frozen_align(size_t size)
+{
+    return (size + PCB_FROZEN_ALIGN - 1) / PCB_FROZEN_ALIGN * PCB_FROZEN_ALIGN;
+}
+
+
+/** Sets up a frozen critbit over an image.
+ *
+ *  \param f Frozen critbit.
+ *  \param image Image.
+ */
+static void _frozen_init(pcb_frozen_t *f, const char *image)
+{
+    f->image = image;
+    f->header = (const pcb_frozen_header_t *)image;
+    f->nodes = (const pcb_frozen_node_t *)(image + _frozen_align(sizeof(pcb_frozen_header_t)));
+    f->blob = image + f->header->blob_offset;
+}
+
 
-    /* if it matches, it cannot be added */
-    if (strcmp((const char *)p, s) == 0)
+/** Frozen critbit image plan type. */
+typedef struct
+{
+    /** Critbit tree. */
+    const pcb_t *t;
+
+    /** Image header. */
+    pcb_frozen_header_t h;
+
+    /** Offset of the internal nodes from the start of the image. */
+    size_t nodes_offset;
+
+    /** Whether some string is too long. */
+    int too_long;
+
+    /** Height, in internal node levels. */
+    size_t height;
+
+    /** Leaf children references of every internal node, by pool index
+     *  (two per node). */
+    uint32_t *leaf_refs;
+
+    /** Frozen critbit layout context. */
+    pcb_frozen_layout_t fl;
+
+} pcb_frozen_plan_t;
+
+
+/** Measures the leaves of a critbit to plan its frozen image.
+ *
+ *  \param fp Frozen critbit image plan (with \c leaf_refs allocated if the
+ *         root is an internal node).
+ *  \return 1 if successful, 0 otherwise.
+ *  \note The walk is in order, so the leaves are measured as they will be
+ *        written to the blob, and their references are set in their parents
+ *        (or as the root). The height is measured too.
+ */
+static int _frozen_measure(pcb_frozen_plan_t *fp)
+{
+    /* pending subtrees, with their level and the reference to be set for
+       leaves */
+    struct { pcb_ptr_t p; uint32_t *ref; size_t d; } *stack = NULL;
+    size_t stack_size = 0, depth = 0;
+    if (!_reserve((void **)&stack, &stack_size, 1, sizeof(*stack)))
+        return 0;
+    stack[depth].p = fp->t->root;
+    stack[depth].ref = &fp->h.root;
+    stack[depth++].d = 1;
+    while (depth > 0)
+    {
+        pcb_ptr_t p = stack[--depth].p;
+        uint32_t *ref = stack[depth].ref;
+        size_t d = stack[depth].d;
+
+        /* leaves go to the blob in order */
+        if (!_is_node_ptr(p))
+        {
+            size_t len = _get_leaf_len(fp->t, p);
+            if (len > UINT32_MAX)
+                fp->too_long = 1;
+            *ref = (uint32_t)(fp->h.blob_size / PCB_BLOCK_SIZE) << 1;
+            fp->h.num_leaves++;
+            fp->h.blob_size += _frozen_leaf_size(len);
+            continue;
+        }
+
+        /* internal nodes have their children pending */
+        if (d > fp->height)
+            fp->height = d;
+        if (!_reserve((void **)&stack, &stack_size, depth + 2, sizeof(*stack)))
+        {
+            free(stack);
+            return 0;
+        }
+        const pcb_node_t *n = _get_const_node_ptr(fp->t, p);
+        for (int dir = 1; dir >= 0; dir--)
+        {
+            stack[depth].p = _get_child(n, dir);
+            stack[depth].ref = &fp->leaf_refs[2 * (size_t)(p >> 1) + (size_t)dir];
+            stack[depth++].d = d + 1;
+        }
+    }
+    free(stack);
+    return 1;
+}
+
+
+/** Releases a frozen critbit image plan.
+ *
+ *  \param fp Frozen critbit image plan.
+ */
+static void _frozen_plan_release(pcb_frozen_plan_t *fp)
+{
+    free(fp->leaf_refs);
+    free(fp->fl.new_index);
+    free(fp->fl.order);
+}
+
+
+/** Plans the image of a frozen critbit: its header, the van Emde Boas order
+ *  of the internal nodes and the blob offsets of the leaves.
+ *
+ *  \param t Critbit tree.
+ *  \param fp Frozen critbit image plan (output, to be released with
+ *         _frozen_plan_release() even if it fails).
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _frozen_plan(const pcb_t *t, pcb_frozen_plan_t *fp)
+{
+    memset(fp, 0, sizeof(*fp));
+    fp->t = t;
+    fp->fl.t = t;
+    memcpy(fp->h.magic, PCB_FROZEN_MAGIC, sizeof(PCB_FROZEN_MAGIC));
+    fp->h.version = PCB_FROZEN_VERSION;
+    fp->h.byte_order = PCB_FROZEN_BYTE_ORDER;
+    fp->nodes_offset = _frozen_align(sizeof(pcb_frozen_header_t));
+
+    /* measures the leaves (only internal nodes need leaf references, and a
+       single out of line leaf leaves the pool empty) */
+    if (_is_node_ptr(t->root))
+    {
+        fp->leaf_refs = malloc(2 * t->first_new_node * sizeof(uint32_t));
+        if (fp->leaf_refs == NULL)
+            return 0;
+    }
+    if (t->root != 0 && !_frozen_measure(fp))
+        return 0;
+    fp->h.num_nodes = fp->h.num_leaves > 0 ? fp->h.num_leaves - 1 : 0;
+    if (fp->too_long || fp->h.num_nodes > UINT32_MAX / 2 || fp->h.blob_size / PCB_BLOCK_SIZE > UINT32_MAX / 2)
+        return 0;
+
+    /* sizes the image */
+    fp->h.blob_offset = _frozen_align(fp->nodes_offset + fp->h.num_nodes * sizeof(pcb_frozen_node_t));
+    fp->h.image_size = _frozen_align(fp->h.blob_offset + fp->h.blob_size);
+    if (!_is_node_ptr(t->root))
+        return 1;
+
+    /* lays out the internal nodes (the root gets the first index) */
+    fp->fl.new_index = malloc(t->first_new_node * sizeof(uint32_t));
+    fp->fl.order = malloc(fp->h.num_nodes * sizeof(uint32_t));
+    if (fp->fl.new_index == NULL || fp->fl.order == NULL || !_frozen_layout(&fp->fl, t->root, fp->height))
+        return 0;
+    fp->h.root = 1;
+    return 1;
+}
+
+
+/** Frozen critbit image output type. */
+typedef struct
+{
+    /** Buffer (the whole image, or a staging buffer for a file). */
+    char *buf;
+
+    /** Size of \a buf. */
+    size_t buf_size;
+
+    /** Bytes used in \a buf. */
+    size_t used;
+
+    /** File descriptor (-1 if \a buf holds the whole image). */
+    int fd;
+
+} pcb_frozen_out_t;
+
+
+/** Flushes a frozen critbit image output to its file.
+ *
+ *  \param out Frozen critbit image output.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _frozen_flush(pcb_frozen_out_t *out)
+{
+    size_t written = 0;
+    while (written < out->used)
+    {
+        ssize_t r = write(out->fd, out->buf + written, out->used - written);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        written += (size_t)r;
+    }
+    out->used = 0;
+    return 1;
+}
+
+
+/** Emits bytes to a frozen critbit image output.
+ *
+ *  \param out Frozen critbit image output.
+ *  \param data Bytes (\c NULL for zeros).
+ *  \param size Number of bytes.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _frozen_emit(pcb_frozen_out_t *out, const void *data, size_t size)
+{
+    while (size > 0)
+    {
+        if (out->used == out->buf_size && (out->fd < 0 || !_frozen_flush(out)))
+            return 0;
+        size_t n = size < out->buf_size - out->used ? size : out->buf_size - out->used;
+        if (data != NULL)
+        {
+            memcpy(out->buf + out->used, data, n);
+            data = (const char *)data + n;
+        }
+        else
+            memset(out->buf + out->used, 0, n);
+        out->used += n;
+        size -= n;
+    }
+    return 1;
+}
+
+
+/** Visits a leaf to emit it to the key blob of a frozen critbit image.
+ *
+ *  \param t Critbit tree.
+ *  \param p Leaf base pointer.
+ *  \param ctx Frozen critbit image output.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _frozen_emit_leaf(const pcb_t *t, pcb_ptr_t p, void *ctx)
+{
+    size_t len = _get_leaf_len(t, p);
+    uint32_t len32 = (uint32_t)len;
+    return _frozen_emit(ctx, &len32, sizeof(len32)) &&
+           _frozen_emit(ctx, _get_leaf_str(t, p), len) &&
+           _frozen_emit(ctx, NULL, _frozen_leaf_size(len) - offsetof(pcb_frozen_leaf_t, s) - len);
+}
+
+
+/** Emits a planned frozen critbit image, sequentially.
+ *
+ *  \param fp Frozen critbit image plan.
+ *  \param out Frozen critbit image output.
+ *  \return 1 if successful, 0 otherwise.
+ */
+static int _frozen_stream(const pcb_frozen_plan_t *fp, pcb_frozen_out_t *out)
+{
+    const pcb_t *t = fp->t;
+
+    /* the header */
+    if (!_frozen_emit(out, &fp->h, sizeof(fp->h)) ||
+        !_frozen_emit(out, NULL, fp->nodes_offset - sizeof(fp->h)))
+        return 0;
+
+    /* the internal nodes, in their new order (prefetched a batch ahead, as
+       it's not the pool one) */
+    for (size_t i = 0; i < fp->h.num_nodes; i++)
+    {
+        if (i + PCB_BATCH_SIZE < fp->h.num_nodes)
+            _prefetch_ptr(t, ((pcb_ptr_t)fp->fl.order[i + PCB_BATCH_SIZE] << 1) | 1);
+        size_t j = fp->fl.order[i];
+        const pcb_node_t *n = _get_const_node_ptr(t, ((pcb_ptr_t)j << 1) | 1);
+        size_t cb_pos = _get_cb_pos(n);
+        pcb_frozen_node_t fn;
+        fn.cb_byte = (uint32_t)(cb_pos >> 4);
+        fn.cb_mask = 0x100 >> (cb_pos & 15);
+        for (int dir = 0; dir < 2; dir++)
+        {
+            pcb_ptr_t c = _get_child(n, dir);
+            fn.children[dir] = _is_node_ptr(c) ? (fp->fl.new_index[(size_t)(c >> 1)] << 1) | 1 : fp->leaf_refs[2 * j + (size_t)dir];
+        }
+        if (!_frozen_emit(out, &fn, sizeof(fn)))
+            return 0;
+    }
+
+    /* the leaves, in key order */
+    if (!_frozen_emit(out, NULL, fp->h.blob_offset - fp->nodes_offset - fp->h.num_nodes * sizeof(pcb_frozen_node_t)) ||
+        (t->root != 0 && !_traverse(t, t->root, 0, 0, _frozen_emit_leaf, out)) ||
+        !_frozen_emit(out, NULL, fp->h.image_size - fp->h.blob_offset - fp->h.blob_size))
         return 0;
+    return out->fd < 0 || _frozen_flush(out);
+}
+
+
+/** Freezes a critbit, building a read-only copy optimized for lookups.
+ *
+ *  \param t Critbit tree.
+ *  \return Frozen critbit or \c NULL in case of error.
+ *  \note The frozen critbit is independent from \a t and it's stored as a
+ *        single position independent image: a header, the internal nodes in
+ *        van Emde Boas order and the strings packed in key order. Values are
+ *        not kept. Strings must be shorter than 4 GB.
+ */
+pcb_frozen_t *pcb_freeze(const pcb_t *t)
+{
+    /* plans the image and writes it to memory */
+    pcb_frozen_plan_t fp;
+    pcb_frozen_t *f = NULL;
+    char *image = NULL;
+    if (_frozen_plan(t, &fp) &&
+        (f = malloc(sizeof(pcb_frozen_t))) != NULL &&
+        (image = aligned_alloc(PCB_FROZEN_ALIGN, fp.h.image_size)) != NULL)
+    {
+        pcb_frozen_out_t out = { image, fp.h.image_size, 0, -1 };
+        if (!_frozen_stream(&fp, &out))
+        {
+            free(image);
+            image = NULL;
+        }
+    }
+    _frozen_plan_release(&fp);
+    if (image == NULL)
+    {
+        free(f);
+        return NULL;
+    }
+    _frozen_init(f, image);
+    f->mapped_size = 0;
+    return f;
+}
+
+
+/** Destroys a frozen critbit.
+ *
+ *  \param f Frozen critbit to be destroyed.
+ */
+void pcb_frozen_destroy(pcb_frozen_t *f)
+{
+    if (f->mapped_size > 0)
+        munmap((void *)f->image, f->mapped_size);
+    else
+        free((char *)f->image);
+    free(f);
+}
+
+
+/** Saves a critbit as a frozen critbit image.
+ *
+ *  \param t Critbit tree.
+ *  \param fd File descriptor where the image is written.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note The image is the one \c pcb_freeze() builds, so it can be loaded
+ *        with \c pcb_open_mmap() by any process with the same byte order.
+ *        It's streamed through a \c PCB_SAVE_BUFFER_SIZE buffer, so besides
+ *        it only a few 32-bit indices per internal node are allocated.
+ */
+int pcb_save(const pcb_t *t, int fd)
+{
+    pcb_frozen_plan_t fp;
+    pcb_frozen_out_t out = { malloc(PCB_SAVE_BUFFER_SIZE), PCB_SAVE_BUFFER_SIZE, 0, fd };
+    int ok = _frozen_plan(t, &fp) && out.buf != NULL && _frozen_stream(&fp, &out);
+    _frozen_plan_release(&fp);
+    free(out.buf);
+    return ok;
+}
+
+
+/** Checks if a frozen reference is an internal node.
+ *
+ *  \param p Frozen reference.
+ *  \return 1 if it's an internal node, 0 if it's a leaf.
+ */
+static int _frozen_is_node(uint32_t p)
+{
+    return p & 1;
+}
 
-    /* if it doesn't match, we have a critical bit that differs */
-    size_t cb_pos = _get_critbit_pos((const char *)p, s);
 
-    /* gets nodes */
-    pcb_node_t *n = _get_free_pcb_node(tt);
-    if (n == NULL)
-        return 0;
-    const char *sn = _create_string_node(s, s_len);
-    if (sn == NULL)
-        return 0;
+/** Checks if a frozen critbit image header is valid.
+ *
+ *  \param h Header.
+ *  \param size Image size.
+ *  \return 1 if it's valid, 0 otherwise.
+ */
+static int _frozen_header_is_valid(const pcb_frozen_header_t *h, size_t size)
+{
+    size_t nodes_offset = _frozen_align(sizeof(pcb_frozen_header_t));
+    return memcmp(h->magic, PCB_FROZEN_MAGIC, sizeof(PCB_FROZEN_MAGIC)) == 0 &&
+           h->version == PCB_FROZEN_VERSION &&
+           h->byte_order == PCB_FROZEN_BYTE_ORDER &&
+           h->image_size == size && size >= nodes_offset &&
+           h->num_nodes == (h->num_leaves > 0 ? h->num_leaves - 1 : 0) &&
+           h->num_nodes <= (size - nodes_offset) / sizeof(pcb_frozen_node_t) &&
+           h->blob_offset >= nodes_offset + h->num_nodes * sizeof(pcb_frozen_node_t) &&
+           h->blob_offset % PCB_FROZEN_ALIGN == 0 &&
+           h->blob_offset <= size && h->blob_size <= size - h->blob_offset;
+}
 
-    /* the pool could have changed position */
-    t = *tt;
 
-    /* redoes the search to see which pointer to update */
-    uintptr_t *pp = &t->root;
-    while (_is_node_ptr(*pp) &&
-           _get_node_ptr(t, *pp)->used.cb_pos < cb_pos)
-        pp = &_get_node_ptr(t, *pp)->used.children[_get_direction(_get_node_ptr(t, *pp), s, s_len)];
+/** Checks if a frozen critbit image is valid.
+ *
+ *  \param image Image.
+ *  \param size Image size.
+ *  \return 1 if it's valid, 0 otherwise.
+ *  \note Besides the header, the tree is walked in order: every internal
+ *        node must be reached once, with a valid mask, and the leaves must
+ *        tile the key blob in order, NUL terminated. So any reference a
+ *        query follows stays in the image, descents end, and the blob can
+ *        be scanned from leaf to leaf.
+ */
+static int _frozen_image_is_valid(const char *image, size_t size)
+{
+    const pcb_frozen_header_t *h = (const pcb_frozen_header_t *)image;
+    if (!_frozen_header_is_valid(h, size))
+        return 0;
+    if (h->num_leaves == 0)
+        return 1;
+    const pcb_frozen_node_t *nodes = (const pcb_frozen_node_t *)(image + _frozen_align(sizeof(pcb_frozen_header_t)));
+    const char *blob = image + h->blob_offset;
 
-    /* loads the new PCB node */
-    n->used.cb_pos = cb_pos;
-    n->used.children[_get_bit(s, s_len, cb_pos) != 0] = (uintptr_t)sn;
-    n->used.children[_get_bit(s, s_len, cb_pos) == 0] = *pp;
+    /* walks the tree, marking the internal nodes reached */
+    unsigned char *reached = calloc(h->num_nodes / CHAR_BIT + 1, 1);
+    uint32_t *stack = NULL;
+    size_t stack_size = 0, depth = 0, offset = 0, num_leaves = 0;
+    int ok = reached != NULL && _reserve((void **)&stack, &stack_size, 1, sizeof(*stack));
+    if (ok)
+        stack[depth++] = h->root;
+    while (ok && depth > 0)
+    {
+        uint32_t p = stack[--depth];
 
-    /* connects it */
-    *pp = _get_base_ptr(t, n);
+        /* a leaf must be the next one in the blob */
+        if (!_frozen_is_node(p))
+        {
+            const pcb_frozen_leaf_t *l = (const pcb_frozen_leaf_t *)(blob + offset);
+            ok = (size_t)(p >> 1) * PCB_BLOCK_SIZE == offset &&
+                 h->blob_size - offset >= offsetof(pcb_frozen_leaf_t, s) &&
+                 _frozen_leaf_size(l->len) <= h->blob_size - offset &&
+                 l->s[l->len] == '\0';
+            if (ok)
+            {
+                offset += _frozen_leaf_size(l->len);
+                num_leaves++;
+            }
+            continue;
+        }
 
-    /* success */
-    return 1;
+        /* an internal node must be reached only once */
+        size_t i = p >> 1;
+        uint32_t mask = i < h->num_nodes ? nodes[i].cb_mask : 0;
+        ok = i < h->num_nodes && !(reached[i / CHAR_BIT] & (1u << (i % CHAR_BIT))) &&
+             mask != 0 && mask <= 0x100 && (mask & (mask - 1)) == 0 &&
+             _reserve((void **)&stack, &stack_size, depth + 2, sizeof(*stack));
+        if (ok)
+        {
+            reached[i / CHAR_BIT] |= (unsigned char)(1u << (i % CHAR_BIT));
+            stack[depth++] = nodes[i].children[1];
+            stack[depth++] = nodes[i].children[0];
+        }
+    }
+    ok = ok && offset == h->blob_size && num_leaves == h->num_leaves;
+    free(stack);
+    free(reached);
+    return ok;
 }
 
 
-/** Removes a string from the critbit.
+/** Opens a frozen critbit image file, mapping it into memory.
  *
- *  \param t Critbit tree.
- *  \param s String to be removed.
- *  \return 1 if successful, 0 otherwise.
+ *  \param path Path of the image file, written by \c pcb_save().
+ *  \return Frozen critbit or \c NULL in case of error.
+ *  \note The queries are served directly from the mapping, without copying.
+ *        The whole image is validated once, in a sequential pass, so a
+ *        truncated or corrupt file is rejected instead of being read out of
+ *        bounds by later queries.
  */
-int pcb_rem(pcb_t *t, const char *s)
+pcb_frozen_t *pcb_open_mmap(const char *path)
 {
-    /* if it's empty, we cannot remove anything */
-    if (t->root == 0)
-        return 0;
+    /* opens the file and gets its size */
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pcb_frozen_header_t))
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
 
-    /* gets the length of s */
-    size_t s_len = strlen(s);
+    /* maps it (the mapping stays valid after closing the file) */
+    void *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return NULL;
 
-    /* search loop */
-    uintptr_t *p = &t->root;
-    uintptr_t *q = NULL;
-    while (_is_node_ptr(*p))
+    /* checks the header and sets up the frozen critbit */
+    pcb_frozen_t *f = malloc(sizeof(pcb_frozen_t));
+    if (f == NULL || !_frozen_image_is_valid(image, size))
     {
-        q = p;
-        p = &_get_node_ptr(t, *p)->used.children[_get_direction(_get_node_ptr(t, *p), s, s_len)];
+        free(f);
+        munmap(image, size);
+        return NULL;
     }
+    _frozen_init(f, image);
+    f->mapped_size = size;
+    return f;
+}
 
-    /* if it doesn't match, it cannot be removed */
-    if (strcmp((const char *)*p, s) != 0)
-        return 0;
 
-    /* checks if the node has a sibling */
-    if (q != NULL)
-    {
-        /* gets the sibling node */
-        uintptr_t r = _get_node_ptr(t, *q)->used.children[_get_node_ptr(t, *q)->used.children[0] == *p];
+/** Gets a frozen internal node.
+ *
+ *  \param f Frozen critbit.
+ *  \param p Frozen reference (an internal node).
+ *  \return Internal node.
+ */
+static const pcb_frozen_node_t *_frozen_get_node(const pcb_frozen_t *f, uint32_t p)
+{
+    return &f->nodes[p >> 1];
+}
 
-        /* removes the node */
-        free((char *)*p);
 
-        /* removes the parent internal node */
-        _release_pcb_node(t, _get_node_ptr(t, *q));
+/** Gets a frozen leaf.
+ *
+ *  \param f Frozen critbit.
+ *  \param p Frozen reference (a leaf).
+ *  \return Leaf.
+ */
+static const pcb_frozen_leaf_t *_frozen_get_leaf(const pcb_frozen_t *f, uint32_t p)
+{
+    return (const pcb_frozen_leaf_t *)(f->blob + (size_t)(p >> 1) * PCB_BLOCK_SIZE);
+}
 
-        /* replaces it with the sibling */
-        *q = r;
-    }
-    else
-    {
-        /* no siblings, it's root */
-        /* releases it, setting the pointer to 0 */
-        free((char *)*p);
-        *p = 0;
-    }
 
-    /* success */
-    return 1;
+/** Gets the direction in a frozen string lookup process.
+ *
+ *  \param n Frozen internal node.
+ *  \param s String that is being looked up.
+ *  \param s_len Length of \a s.
+ *  \return 1 means right, 0 means left.
+ */
+static int _frozen_get_direction(const pcb_frozen_node_t *n, const char *s, size_t s_len)
+{
+    size_t i = n->cb_byte;
+    return i < s_len && ((0x100 | (unsigned char)s[i]) & n->cb_mask) != 0;
 }
 
 
-/** Clears the critbit.
+/** Gets the critbit position of a frozen internal node.
  *
- *  \param t Critbit tree.
- *  \note Releases all allocated memory.
+ *  \param n Frozen internal node.
+ *  \return CritBit position.
  */
-void pcb_clear(pcb_t *t)
+static size_t _frozen_get_cb_pos(const pcb_frozen_node_t *n)
 {
-    /* if it's empty, there is nothing to clear */
-    if (t->root == 0)
-        return;
+    return ((size_t)n->cb_byte << 4) |
+           (size_t)(__builtin_clz(n->cb_mask) - (sizeof(unsigned) * CHAR_BIT - 9));
+}
 
-    /* recursively clears all string nodes */
-    _rec_clear(t, t->root);
 
-    /* no nodes are used */
-    t->num_used_nodes = 0;
+/** Gets the leaf at one edge of a frozen subtree.
+ *
+ *  \param f Frozen critbit.
+ *  \param p Subtree root.
+ *  \param dir 0 for the smallest string, 1 for the biggest one.
+ *  \return Leaf reference.
+ */
+static uint32_t _frozen_get_edge_leaf(const pcb_frozen_t *f, uint32_t p, int dir)
+{
+    while (_frozen_is_node(p))
+        p = _frozen_get_node(f, p)->children[dir];
+    return p;
+}
 
-    /* initializes the free list */
-    for (size_t i = 0; i < t->num_total_nodes - 1; i++)
-        t->nodes[i].free.next_free_node = i + 1;
-    t->nodes[t->num_total_nodes - 1].free.next_free_node = SIZE_MAX;
 
-    /* sets the first free node */
-    t->first_free_node = 0;
+/** Descends a frozen critbit with a string.
+ *
+ *  \param f Frozen critbit (not empty).
+ *  \param s String.
+ *  \param s_len Length of \a s.
+ *  \param max_cb_pos Position where the descent stops.
+ *  \param q Last right sibling found (output, 0 if none).
+ *  \return Reference reached.
+ */
+static uint32_t _frozen_descend(const pcb_frozen_t *f, const char *s, size_t s_len, size_t max_cb_pos, uint32_t *q)
+{
+    uint32_t p = f->header->root;
+    *q = 0;
+    while (_frozen_is_node(p) && _frozen_get_cb_pos(_frozen_get_node(f, p)) < max_cb_pos)
+    {
+        const pcb_frozen_node_t *n = _frozen_get_node(f, p);
+        int dir = _frozen_get_direction(n, s, s_len);
+        if (dir == 0)
+            *q = n->children[1];
+        p = n->children[dir];
+    }
+    return p;
 }
 
 
-/** Checks if a string is in the critbit.
+/** Checks if a string with explicit length is in a frozen critbit.
  *
- *  \param t Critbit tree.
- *  \param s String to be searched for.
+ *  \param f Frozen critbit.
+ *  \param s String to be searched for (it can contain NUL bytes).
+ *  \param s_len Length of \a s.
  *  \return 1 if the string was found, 0 otherwise.
  */
-int pcb_in(const pcb_t* t, const char *s)
+int pcb_frozen_in_len(const pcb_frozen_t *f, const char *s, size_t s_len)
 {
-    /* exits on an empty critbit tree */
-    if (t->root == 0)
+    if (f->header->num_leaves == 0)
         return 0;
+    uint32_t q;
+    const pcb_frozen_leaf_t *l = _frozen_get_leaf(f, _frozen_descend(f, s, s_len, SIZE_MAX, &q));
+    return l->len == s_len && memcmp(l->s, s, s_len) == 0;
+}
 
-    /* gets the length of s */
-    size_t s_len = strlen(s);
-
-    /* main loop */
-    uintptr_t p = t->root;
-    while (_is_node_ptr(p))
-        p = _get_const_node_ptr(t, p)->used.children[_get_direction(_get_const_node_ptr(t, p), s, s_len)];
 
-    /* final check */
-    return strcmp((const char *)p, s) == 0;
+/** Checks if a string is in a frozen critbit.
+ *
+ *  \param f Frozen critbit.
+ *  \param s String to be searched for.
+ *  \return 1 if the string was found, 0 otherwise.
+ */
+int pcb_frozen_in(const pcb_frozen_t *f, const char *s)
+{
+    return pcb_frozen_in_len(f, s, strlen(s));
 }
 
 
-/** Finds the smallest lexicographically bigger string in the critbit.
+/** Finds the smallest lexicographically bigger string in a frozen critbit.
  *
- *  \param t Critbit tree.
+ *  \param f Frozen critbit.
  *  \param s Base string.
- *  \return The smallest string in \a t that is bigger than \a s or \c NULL if
+ *  \return The smallest string in \a f that is bigger than \a s or \c NULL if
  *          there is none.
+ *  \note The returned string is valid while \a f exists.
  */
-const char *pcb_find_next(const pcb_t *t, const char *s)
+const char *pcb_frozen_find_next(const pcb_frozen_t *f, const char *s)
 {
-    /* if it's empty, returns NULL */
-    if (t->root == 0)
+    /* if it's empty, there is no answer */
+    if (f->header->num_leaves == 0)
         return NULL;
 
-    /* gets the length of s */
+    /* if the leaf reached is s, the answer follows it in the blob */
     size_t s_len = strlen(s);
+    uint32_t q;
+    uint32_t p = _frozen_descend(f, s, s_len, SIZE_MAX, &q);
+    const pcb_frozen_leaf_t *l = _frozen_get_leaf(f, p);
+    size_t next_offset = (size_t)(p >> 1) * PCB_BLOCK_SIZE + _frozen_leaf_size(l->len);
+    if (l->len == s_len && memcmp(l->s, s, s_len) == 0)
+        return next_offset < f->header->blob_size ? ((const pcb_frozen_leaf_t *)(f->blob + next_offset))->s : NULL;
 
-    /* search loop for p */
-    intptr_t p = t->root;
-    intptr_t q = 0;
-    while (_is_node_ptr(p))
-    {
-        int dir = _get_direction(_get_const_node_ptr(t, p), s, s_len);
-        if (dir == 0)
-            q = _get_const_node_ptr(t, p)->used.children[1];
-        p = _get_const_node_ptr(t, p)->used.children[dir];
-    }
-
-    /* if p is bigger, it's the answer */
-    if (strcmp((const char *)p, s) > 0)
-        return (const char *)p;
+    /* otherwise, descends to the critical bit node */
+    size_t cb_pos = _get_critbit_pos(l->s, l->len, s, s_len);
+    p = _frozen_descend(f, s, s_len, cb_pos, &q);
 
-    /* if q is still 0, there is no answer */
-    if (q == 0)
-        return NULL;
+    /* if s is smaller than that subtree, the answer is its minimum */
+    if (!_get_bit(s, s_len, cb_pos))
+        return _frozen_get_leaf(f, _frozen_get_edge_leaf(f, p, 0))->s;
 
-    /* search loop for the minimal value in the subtree of q */
-    while (_is_node_ptr(q))
-        q = _get_const_node_ptr(t, q)->used.children[0];
-
-    /* success */
-    return (const char *)q;
+    /* if it's bigger, it's the minimum of the last right sibling */
+    return q != 0 ? _frozen_get_leaf(f, _frozen_get_edge_leaf(f, q, 0))->s : NULL;
 }
 
 
-/** Iterates over all the suffixes of a given string in the critbit.
+/** Iterates over all the suffixes of a given string in a frozen critbit.
  *
- *  \param t Critbit tree.
+ *  \param f Frozen critbit.
  *  \param s Base string.
  *  \param cb Callback function.
  *  \param ctx Context for the callback function.
  *  \return 1 if all the callback executions return 1, 0 otherwise.
- *  \note \a cb is executed over every string in \a t that has \a s as a
- *        prefix. The iteration is stopped if the callback returns 0.
+ *  \note \a cb is executed over every string in \a f that has \a s as a
+ *        prefix. As the strings are stored in key order, it's a sequential
+ *        scan of the key blob between the edges of the critical subtree.
  */
-int pcb_find_suffixes(const pcb_t *t, const char *s, int (*cb)(const char *s, void *ctx), void *ctx)
+int pcb_frozen_find_suffixes(const pcb_frozen_t *f, const char *s, int (*cb)(const char *s, void *ctx), void *ctx)
 {
     /* if it's empty, it "succeeded" */
-    if (t->root == 0)
+    if (f->header->num_leaves == 0)
         return 1;
 
-    /* gets the required critical bit position */
-    size_t s_len = strlen(s);
-    size_t cb_pos = s_len << 3;
-
     /* search loop for the critical node */
-    uintptr_t p = t->root;
-    while (_is_node_ptr(p) && _get_const_node_ptr(t, p)->used.cb_pos < cb_pos)
-        p = _get_const_node_ptr(t, p)->used.children[_get_direction(_get_const_node_ptr(t, p), s, s_len)];
-    uintptr_t q = p;
+    size_t s_len = strlen(s);
+    uint32_t q;
+    uint32_t p = _frozen_descend(f, s, s_len, s_len << 4, &q);
 
     /* checking the prefix existence */
-    while (_is_node_ptr(p))
-        p = _get_const_node_ptr(t, p)->used.children[_get_direction(_get_const_node_ptr(t, p), s, s_len)];
-    if (memcmp((const char *)p, s, cb_pos >> 3) != 0)
+    uint32_t first = _frozen_get_edge_leaf(f, p, 0);
+    const pcb_frozen_leaf_t *l = _frozen_get_leaf(f, first);
+    if (l->len < s_len || memcmp(l->s, s, s_len) != 0)
         return 1;
 
-    /* recursive traverse starting from the node */
-    return _rec_traverse(t, q, cb, ctx);
+    /* scans the blob */
+    size_t offset = (size_t)(first >> 1) * PCB_BLOCK_SIZE;
+    size_t end = (size_t)(_frozen_get_edge_leaf(f, p, 1) >> 1) * PCB_BLOCK_SIZE;
+    while (1)
+    {
+        l = (const pcb_frozen_leaf_t *)(f->blob + offset);
+        if (!cb(l->s, ctx))
+            return 0;
+        if (offset == end)
+            return 1;
+        offset += _frozen_leaf_size(l->len);
+    }
+}
+
+
+/** Shard alignment (a cache line, to keep the locks of different shards
+ *  apart). */
+#define PCB_SHARD_ALIGN 64
+
+
+/** Shard type. */
+typedef struct
+{
+    /** Lock (readers share it, writers hold it exclusively). */
+    pthread_rwlock_t lock;
+
+    /** Critbit tree. */
+    pcb_t *t;
+
+} pcb_shard_t;
+
+
+/** Sharded critbit type. */
+struct pcb_sharded_t
+{
+    /** Number of shards. */
+    size_t num_shards;
+
+    /** Shards (aligned, with \c shard_stride bytes each). */
+    char *shards;
+
+    /** Distance between shards in bytes. */
+    size_t shard_stride;
+
+    /** Split strings (\c num_shards - 1 of them, or \c NULL to split by the
+     *  first byte). */
+    char **splits;
+
+};
+
+
+/** Gets a shard.
+ *
+ *  \param st Sharded critbit.
+ *  \param i Shard index.
+ *  \return Shard.
+ */
+static pcb_shard_t *_get_shard(const pcb_sharded_t *st, size_t i)
+{
+    return (pcb_shard_t *)(st->shards + i * st->shard_stride);
+}
+
+
+/** Gets the index of the shard holding a string.
+ *
+ *  \param st Sharded critbit.
+ *  \param s String.
+ *  \return Shard index.
+ *  \note Shards hold consecutive key ranges, so the index never decreases
+ *        as \a s increases.
+ */
+static size_t _get_shard_index(const pcb_sharded_t *st, const char *s)
+{
+    /* without splits, the first byte is scaled to the number of shards */
+    if (st->splits == NULL)
+        return ((size_t)(unsigned char)s[0] * st->num_shards) >> CHAR_BIT;
+
+    /* otherwise, it counts the splits not greater than s */
+    size_t lo = 0, hi = st->num_shards - 1;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(st->splits[mid], s) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+/** Destroys the first shards and the splits of a sharded critbit.
+ *
+ *  \param st Sharded critbit.
+ *  \param num_shards Number of initialized shards.
+ */
+static void _sharded_release(pcb_sharded_t *st, size_t num_shards)
+{
+    for (size_t i = 0; i < num_shards; i++)
+    {
+        pthread_rwlock_destroy(&_get_shard(st, i)->lock);
+        pcb_destroy(_get_shard(st, i)->t);
+    }
+    if (st->splits != NULL)
+        for (size_t i = 0; i < st->num_shards - 1; i++)
+            free(st->splits[i]);
+    free(st->splits);
+    free(st->shards);
+    free(st);
+}
+
+
+/** Creates a sharded critbit.
+ *
+ *  \param num_shards Number of shards (at least one, and not more than
+ *         <tt>2^CHAR_BIT</tt> without splits).
+ *  \param splits Split strings (\a num_shards - 1 non-empty strings in
+ *         strictly increasing order, or \c NULL to split the keys evenly by
+ *         their first byte).
+ *  \return Newly created sharded critbit or \c NULL in case of error or
+ *          invalid arguments.
+ *  \note Shard \a i holds the keys between \a splits[i - 1] (included) and
+ *        \a splits[i] (excluded), so ordered queries visit the shards in
+ *        sequence. The splits are copied.
+ */
+pcb_sharded_t *pcb_sharded_create(size_t num_shards, const char *const *splits)
+{
+    /* checks the arguments */
+    if (num_shards == 0 || num_shards > SIZE_MAX / 2 / PCB_SHARD_ALIGN)
+        return NULL;
+    if (splits == NULL && num_shards > (size_t)1 << CHAR_BIT)
+        return NULL;
+    if (splits != NULL)
+    {
+        for (size_t i = 0; i < num_shards - 1; i++)
+        {
+            if (splits[i] == NULL || splits[i][0] == '\0' ||
+                (i > 0 && strcmp(splits[i - 1], splits[i]) >= 0))
+                return NULL;
+        }
+    }
+
+    /* allocates the structure */
+    pcb_sharded_t *st = malloc(sizeof(pcb_sharded_t));
+    if (st == NULL)
+        return NULL;
+    st->num_shards = num_shards;
+    st->shard_stride = (sizeof(pcb_shard_t) + PCB_SHARD_ALIGN - 1) / PCB_SHARD_ALIGN * PCB_SHARD_ALIGN;
+    st->shards = aligned_alloc(PCB_SHARD_ALIGN, num_shards * st->shard_stride);
+    st->splits = NULL;
+    if (st->shards == NULL)
+    {
+        _sharded_release(st, 0);
+        return NULL;
+    }
+
+    /* copies the splits */
+    if (splits != NULL && num_shards > 1)
+    {
+        st->splits = calloc(num_shards - 1, sizeof(char *));
+        if (st->splits == NULL)
+        {
+            _sharded_release(st, 0);
+            return NULL;
+        }
+        for (size_t i = 0; i < num_shards - 1; i++)
+        {
+            if ((st->splits[i] = strdup(splits[i])) == NULL)
+            {
+                _sharded_release(st, 0);
+                return NULL;
+            }
+        }
+    }
+
+    /* creates the shards */
+    for (size_t i = 0; i < num_shards; i++)
+    {
+        pcb_shard_t *sh = _get_shard(st, i);
+        if ((sh->t = pcb_create()) == NULL)
+        {
+            _sharded_release(st, i);
+            return NULL;
+        }
+        if (pthread_rwlock_init(&sh->lock, NULL) != 0)
+        {
+            pcb_destroy(sh->t);
+            _sharded_release(st, i);
+            return NULL;
+        }
+    }
+
+    /* returns it */
+    return st;
+}
+
+
+/** Destroys a sharded critbit.
+ *
+ *  \param st Sharded critbit to be destroyed.
+ *  \note No other thread can be using it.
+ */
+void pcb_sharded_destroy(pcb_sharded_t *st)
+{
+    _sharded_release(st, st->num_shards);
+}
+
+
+/** Adds a string to a sharded critbit.
+ *
+ *  \param st Sharded critbit.
+ *  \param s String to be added.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note Only the shard of \a s is locked.
+ */
+int pcb_sharded_add(pcb_sharded_t *st, const char *s)
+{
+    pcb_shard_t *sh = _get_shard(st, _get_shard_index(st, s));
+    pthread_rwlock_wrlock(&sh->lock);
+    int ret = pcb_add(sh->t, s);
+    pthread_rwlock_unlock(&sh->lock);
+    return ret;
+}
+
+
+/** Removes a string from a sharded critbit.
+ *
+ *  \param st Sharded critbit.
+ *  \param s String to be removed.
+ *  \return 1 if successful, 0 otherwise.
+ *  \note Only the shard of \a s is locked.
+ */
+int pcb_sharded_rem(pcb_sharded_t *st, const char *s)
+{
+    pcb_shard_t *sh = _get_shard(st, _get_shard_index(st, s));
+    pthread_rwlock_wrlock(&sh->lock);
+    int ret = pcb_rem(sh->t, s);
+    pthread_rwlock_unlock(&sh->lock);
+    return ret;
+}
+
+
+/** Checks if a string is in a sharded critbit.
+ *
+ *  \param st Sharded critbit.
+ *  \param s String to be checked.
+ *  \return 1 if it's there, 0 otherwise.
+ */
+int pcb_sharded_in(pcb_sharded_t *st, const char *s)
+{
+    pcb_shard_t *sh = _get_shard(st, _get_shard_index(st, s));
+    pthread_rwlock_rdlock(&sh->lock);
+    int ret = pcb_in(sh->t, s);
+    pthread_rwlock_unlock(&sh->lock);
+    return ret;
+}
+
+
+/** Finds the next string in a sharded critbit, copying it.
+ *
+ *  \param st Sharded critbit.
+ *  \param s Base string.
+ *  \param buf Buffer for the next string.
+ *  \param buf_size Size of \a buf (the copy is truncated to fit, NUL
+ *         included).
+ *  \return Length of the next string or 0 if there is no next string.
+ *  \note The next string is copied while its shard is locked, as other
+ *        threads could remove it right after. The following shards are
+ *        only looked at if the shard of \a s has nothing after it.
+ */
+size_t pcb_sharded_find_next(pcb_sharded_t *st, const char *s, char *buf, size_t buf_size)
+{
+    for (size_t i = _get_shard_index(st, s); i < st->num_shards; i++)
+    {
+        /* the following shards only hold bigger strings */
+        pcb_shard_t *sh = _get_shard(st, i);
+        pthread_rwlock_rdlock(&sh->lock);
+        const char *n = pcb_find_next(sh->t, s);
+        size_t n_len = n != NULL ? strlen(n) : 0;
+        if (n != NULL && buf_size > 0)
+        {
+            size_t c_len = n_len < buf_size ? n_len : buf_size - 1;
+            memcpy(buf, n, c_len);
+            buf[c_len] = '\0';
+        }
+        pthread_rwlock_unlock(&sh->lock);
+        if (n != NULL)
+            return n_len;
+    }
+    return 0;
+}
+
+
+/** Iterates over all the suffixes of a given string in a sharded critbit.
+ *
+ *  \param st Sharded critbit.
+ *  \param s Base string.
+ *  \param cb Callback function.
+ *  \param ctx Context for the callback function.
+ *  \return 1 if all the callback executions return 1, 0 otherwise.
+ *  \note \a cb is executed in order over every string that has \a s as a
+ *        prefix, visiting only the shards whose range can hold them. Each
+ *        shard stays locked for reading while its strings are visited.
+ */
+int pcb_sharded_find_suffixes(pcb_sharded_t *st, const char *s, int (*cb)(const char *s, void *ctx), void *ctx)
+{
+    /* the suffixes start in the shard of s */
+    size_t i = _get_shard_index(st, s);
+
+    /* and end in the shard of the first string after all of them */
+    size_t end = st->num_shards - 1;
+    if (s[0] != '\0')
+    {
+        /* that string has the last byte below 0xff incremented and the
+           following ones removed */
+        size_t s_len = strlen(s);
+        char *u = malloc(s_len + 1);
+        if (u == NULL)
+            return 0;
+        memcpy(u, s, s_len + 1);
+        while (s_len > 0 && (unsigned char)u[s_len - 1] == UCHAR_MAX)
+            u[--s_len] = '\0';
+        if (s_len > 0)
+        {
+            u[s_len - 1]++;
+            end = _get_shard_index(st, u);
+        }
+        free(u);
+    }
+
+    /* visits the shards in order */
+    int ret = 1;
+    for (; ret && i <= end; i++)
+    {
+        pcb_shard_t *sh = _get_shard(st, i);
+        pthread_rwlock_rdlock(&sh->lock);
+        ret = pcb_find_suffixes(sh->t, s, cb, ctx);
+        pthread_rwlock_unlock(&sh->lock);
+    }
+    return ret;
 }
@@ -7,20 +7,128 @@
 #ifndef PCB_H
 #define PCB_H
 
+#include <stddef.h>
+
+
+#ifndef PCB_VALUE_TYPE
+    /** Map value type (it must be the same for the library and its users). */
+    #define PCB_VALUE_TYPE void *
+#endif
+
+
+/* Map value type. */
+typedef PCB_VALUE_TYPE pcb_value_t;
 
 /* Pooled CritBit type (forward declaration). */
 struct pcb_t;
 typedef struct pcb_t pcb_t;
 
+/* Cursor type (forward declaration). */
+struct pcb_cursor_t;
+typedef struct pcb_cursor_t pcb_cursor_t;
+
+/* Reader type (forward declaration). */
+struct pcb_reader_t;
+typedef struct pcb_reader_t pcb_reader_t;
+
+/* Frozen critbit type (forward declaration). */
+struct pcb_frozen_t;
+typedef struct pcb_frozen_t pcb_frozen_t;
+
+/* Sharded critbit type (forward declaration). */
+struct pcb_sharded_t;
+typedef struct pcb_sharded_t pcb_sharded_t;
+
 /* prototypes */
 pcb_t *pcb_create( void );
 void pcb_destroy(pcb_t *t);
-int pcb_add(pcb_t **t, const char *s);
+pcb_t *pcb_build_sorted(const char *const *keys, size_t n);
+pcb_t *pcb_build_parallel(const char *const *keys, size_t n, size_t num_threads);
+int pcb_compact(pcb_t *t);
+pcb_reader_t *pcb_reader_create(pcb_t *t);
+void pcb_reader_destroy(pcb_reader_t *r);
+void pcb_read_begin(pcb_reader_t *r);
+void pcb_read_end(pcb_reader_t *r);
+int pcb_add(pcb_t *t, const char *s);
 int pcb_rem(pcb_t *t, const char *s);
+int pcb_add_concurrent(pcb_t *t, const char *s);
+int pcb_add_concurrent_len(pcb_t *t, const char *s, size_t s_len);
 void pcb_clear(pcb_t *t);
 int pcb_in(const pcb_t* t, const char *s);
 const char *pcb_find_next(const pcb_t *t, const char *s);
+const char *pcb_find_prev(const pcb_t *t, const char *s);
+const char *pcb_last(const pcb_t *t);
 int pcb_find_suffixes(const pcb_t *t, const char *s, int (*cb)(const char *s, void *ctx), void *ctx);
+int pcb_find_suffixes_rev(const pcb_t *t, const char *s, int (*cb)(const char *s, void *ctx), void *ctx);
+int pcb_find_suffixes_parallel(const pcb_t *t, const char *s, int (*cb)(const char *s, size_t chunk, void *ctx),
+                               void *const *ctxs, size_t num_threads, int ordered);
+pcb_t *pcb_union(const pcb_t *a, const pcb_t *b);
+pcb_t *pcb_intersect(const pcb_t *a, const pcb_t *b);
+pcb_t *pcb_difference(const pcb_t *a, const pcb_t *b);
+int pcb_union_cb(const pcb_t *a, const pcb_t *b, int (*cb)(const char *s, void *ctx), void *ctx);
+int pcb_intersect_cb(const pcb_t *a, const pcb_t *b, int (*cb)(const char *s, void *ctx), void *ctx);
+int pcb_difference_cb(const pcb_t *a, const pcb_t *b, int (*cb)(const char *s, void *ctx), void *ctx);
+size_t pcb_union_count(const pcb_t *a, const pcb_t *b);
+size_t pcb_intersect_count(const pcb_t *a, const pcb_t *b);
+size_t pcb_difference_count(const pcb_t *a, const pcb_t *b);
+size_t pcb_count_prefix(const pcb_t *t, const char *s);
+size_t pcb_rank(const pcb_t *t, const char *s);
+const char *pcb_select(const pcb_t *t, size_t k);
+const char *pcb_sample(const pcb_t *t, size_t r);
+const char *pcb_longest_prefix(const pcb_t *t, const char *s);
+const char *pcb_longest_prefix_len(const pcb_t *t, const char *s, size_t s_len, size_t *r_len);
+const char *pcb_map_longest_prefix(const pcb_t *t, const char *s, pcb_value_t **v);
+size_t pcb_bits_key(char *buf, const char *bits, size_t num_bits);
+const char *pcb_longest_prefix_bits(const pcb_t *t, const char *bits, size_t num_bits, size_t *r_bits);
+size_t pcb_in_batch(const pcb_t *t, const char *const *keys, size_t n, int *results);
+void pcb_find_next_batch(const pcb_t *t, const char *const *keys, size_t n, const char **results);
+int pcb_add_len(pcb_t *t, const char *s, size_t s_len);
+int pcb_rem_len(pcb_t *t, const char *s, size_t s_len);
+int pcb_in_len(const pcb_t *t, const char *s, size_t s_len);
+const char *pcb_find_next_len(const pcb_t *t, const char *s, size_t s_len, size_t *r_len);
+const char *pcb_find_prev_len(const pcb_t *t, const char *s, size_t s_len, size_t *r_len);
+int pcb_map_put(pcb_t *t, const char *s, pcb_value_t v);
+pcb_value_t *pcb_map_get(const pcb_t *t, const char *s);
+pcb_value_t *pcb_map_get_or_insert(pcb_t *t, const char *s, int *inserted);
+int pcb_map_remove(pcb_t *t, const char *s, pcb_value_t *v);
+const char *pcb_map_find_next(const pcb_t *t, const char *s, pcb_value_t **v);
+const char *pcb_map_find_prev(const pcb_t *t, const char *s, pcb_value_t **v);
+int pcb_map_find_suffixes(const pcb_t *t, const char *s, int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx);
+int pcb_map_find_suffixes_rev(const pcb_t *t, const char *s, int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx);
+int pcb_find_range(const pcb_t *t, const char *lo, const char *hi, int (*cb)(const char *s, void *ctx), void *ctx);
+size_t pcb_find_range_n(const pcb_t *t, const char *lo, const char *hi, size_t max_count,
+                        int (*cb)(const char *s, void *ctx), void *ctx, int *stopped);
+int pcb_map_find_range(const pcb_t *t, const char *lo, const char *hi,
+                       int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx);
+size_t pcb_map_find_range_n(const pcb_t *t, const char *lo, const char *hi, size_t max_count,
+                            int (*cb)(const char *s, pcb_value_t *v, void *ctx), void *ctx, int *stopped);
+pcb_cursor_t *pcb_cursor_create(const pcb_t *t);
+void pcb_cursor_destroy(pcb_cursor_t *c);
+int pcb_cursor_first(pcb_cursor_t *c);
+int pcb_cursor_last(pcb_cursor_t *c);
+int pcb_cursor_lower_bound(pcb_cursor_t *c, const char *s);
+int pcb_cursor_lower_bound_len(pcb_cursor_t *c, const char *s, size_t s_len);
+int pcb_cursor_seek(pcb_cursor_t *c, const char *s);
+int pcb_cursor_seek_len(pcb_cursor_t *c, const char *s, size_t s_len);
+int pcb_cursor_next(pcb_cursor_t *c);
+int pcb_cursor_prev(pcb_cursor_t *c);
+const char *pcb_cursor_key(const pcb_cursor_t *c, size_t *len);
+pcb_value_t *pcb_cursor_value(const pcb_cursor_t *c);
+pcb_frozen_t *pcb_freeze(const pcb_t *t);
+void pcb_frozen_destroy(pcb_frozen_t *f);
+int pcb_save(const pcb_t *t, int fd);
+pcb_frozen_t *pcb_open_mmap(const char *path);
+int pcb_frozen_in(const pcb_frozen_t *f, const char *s);
+int pcb_frozen_in_len(const pcb_frozen_t *f, const char *s, size_t s_len);
+const char *pcb_frozen_find_next(const pcb_frozen_t *f, const char *s);
+int pcb_frozen_find_suffixes(const pcb_frozen_t *f, const char *s, int (*cb)(const char *s, void *ctx), void *ctx);
+pcb_sharded_t *pcb_sharded_create(size_t num_shards, const char *const *splits);
+void pcb_sharded_destroy(pcb_sharded_t *st);
+int pcb_sharded_add(pcb_sharded_t *st, const char *s);
+int pcb_sharded_rem(pcb_sharded_t *st, const char *s);
+int pcb_sharded_in(pcb_sharded_t *st, const char *s);
+size_t pcb_sharded_find_next(pcb_sharded_t *st, const char *s, char *buf, size_t buf_size);
+int pcb_sharded_find_suffixes(pcb_sharded_t *st, const char *s, int (*cb)(const char *s, void *ctx), void *ctx);
 
 
 #endif
@@ -4,10 +4,15 @@
  *  \copyright MIT License.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "pcb.h"
 #include "scunit/scunit.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static int _is_prime(unsigned a)
 {
@@ -36,9 +41,9 @@ TEST(Basic)
 {
     pcb_t *t = pcb_create();
     ASSERT_NE(NULL, t);
-    ASSERT_EQ(1, pcb_add(&t, "AAA"));
-    ASSERT_EQ(1, pcb_add(&t, "AAB"));
-    ASSERT_EQ(0, pcb_add(&t, "AAA"));
+    ASSERT_EQ(1, pcb_add(t, "AAA"));
+    ASSERT_EQ(1, pcb_add(t, "AAB"));
+    ASSERT_EQ(0, pcb_add(t, "AAA"));
     ASSERT_EQ(1, pcb_in(t, "AAA"));
     ASSERT_EQ(0, pcb_in(t, "AAC"));
     ASSERT_EQ(1, pcb_in(t, "AAB"));
@@ -50,9 +55,9 @@ TEST(Basic)
     ASSERT_EQ(0, pcb_rem(t, "AAB"));
     ASSERT_EQ(0, pcb_in(t, "AAA"));
     ASSERT_EQ(0, pcb_in(t, "AAB"));
-    ASSERT_EQ(1, pcb_add(&t, "AAA"));
-    ASSERT_EQ(1, pcb_add(&t, "AAB"));
-    ASSERT_EQ(0, pcb_add(&t, "AAA"));
+    ASSERT_EQ(1, pcb_add(t, "AAA"));
+    ASSERT_EQ(1, pcb_add(t, "AAB"));
+    ASSERT_EQ(0, pcb_add(t, "AAA"));
     ASSERT_EQ(0, strcmp(pcb_find_next(t, ""), "AAA"));
     ASSERT_EQ(0, strcmp(pcb_find_next(t, "AAA"), "AAB"));
     ASSERT_EQ(NULL, pcb_find_next(t, "AAB"));
@@ -69,7 +74,7 @@ TEST(PrimeDecimals)
             continue;
         char buffer[32];
         sprintf(buffer, "%d", i);
-        ASSERT_EQ(1, pcb_add(&t, buffer));
+        ASSERT_EQ(1, pcb_add(t, buffer));
     }
     for (int i = 1000000 - 1; i >= 1; i--)
     {
@@ -81,7 +86,7 @@ TEST(PrimeDecimals)
     {
         char buffer[32];
         sprintf(buffer, "%d", i);
-        ASSERT_NE(_is_prime(i), pcb_add(&t, buffer));
+        ASSERT_NE(_is_prime(i), pcb_add(t, buffer));
     }
     for (int i = 1000000 - 1; i >= 1; i--)
     {
@@ -117,7 +122,7 @@ TEST(LexNextTests)
     {
         char buffer[32];
         sprintf(buffer, "%d", i);
-        ASSERT_EQ(1, pcb_add(&t, buffer));
+        ASSERT_EQ(1, pcb_add(t, buffer));
     }
     ASSERT_EQ(NULL, pcb_find_next(t, "999999"));
     for (int i = 0; i < 999999; i++)
@@ -132,9 +137,9 @@ TEST(ReadAfter0Tests)
 {
     pcb_t *t = pcb_create();
     ASSERT_NE(NULL, t);
-    ASSERT_EQ(1, pcb_add(&t, "AAA"));
-    ASSERT_EQ(1, pcb_add(&t, "AAB"));
-    ASSERT_EQ(1, pcb_add(&t, (char []){ 'A', 0x00, 0xff, 0xff }));
+    ASSERT_EQ(1, pcb_add(t, "AAA"));
+    ASSERT_EQ(1, pcb_add(t, "AAB"));
+    ASSERT_EQ(1, pcb_add(t, (char []){ 'A', 0x00, 0xff, 0xff }));
     ASSERT_EQ(0, strcmp(pcb_find_next(t, ""), "A"));
     pcb_destroy(t);
 }
@@ -150,9 +155,1237 @@ TEST(WalkTests)
         sprintf(buffer, "%d", i);
         if (buffer[0] == '2' && buffer[1] == '7')
             tgt_sum += i;
-        ASSERT_EQ(1, pcb_add(&t, buffer));
+        ASSERT_EQ(1, pcb_add(t, buffer));
     }
     ASSERT_EQ(1, pcb_find_suffixes(t, "27", _sum_cb, &cb_sum));
     ASSERT_EQ(tgt_sum, cb_sum);
     pcb_destroy(t);
 }
+
+TEST(ClearTests)
+{
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    char buffer[2048];
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 10000; i++)
+        {
+            int len = sprintf(buffer, "%d", i);
+            memset(buffer + len, 'x', i % 1500);
+            buffer[len + i % 1500] = '\0';
+            ASSERT_EQ(1, pcb_add(t, buffer));
+        }
+        for (int i = 0; i < 10000; i += 2)
+        {
+            int len = sprintf(buffer, "%d", i);
+            memset(buffer + len, 'x', i % 1500);
+            buffer[len + i % 1500] = '\0';
+            ASSERT_EQ(1, pcb_rem(t, buffer));
+        }
+        for (int i = 0; i < 10000; i++)
+        {
+            int len = sprintf(buffer, "%d", i);
+            memset(buffer + len, 'x', i % 1500);
+            buffer[len + i % 1500] = '\0';
+            ASSERT_EQ(i & 1, pcb_in(t, buffer));
+        }
+        pcb_clear(t);
+        ASSERT_EQ(0, pcb_in(t, "1"));
+        ASSERT_EQ(NULL, pcb_find_next(t, ""));
+    }
+    pcb_destroy(t);
+}
+
+TEST(InlineTests)
+{
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    char buffer[64];
+    for (int i = 1; i < 48; i++)
+    {
+        memset(buffer, 'a', i);
+        buffer[i] = '\0';
+        ASSERT_EQ(1, pcb_add(t, buffer));
+    }
+    const char *s = pcb_find_next(t, "");
+    for (int i = 1; i < 48; i++)
+    {
+        ASSERT_NE(NULL, s);
+        ASSERT_EQ(i, (int)strlen(s));
+        s = pcb_find_next(t, s);
+    }
+    ASSERT_EQ(NULL, s);
+    for (int i = 1; i < 48; i += 2)
+    {
+        memset(buffer, 'a', i);
+        buffer[i] = '\0';
+        ASSERT_EQ(1, pcb_rem(t, buffer));
+    }
+    for (int i = 1; i < 48; i++)
+    {
+        memset(buffer, 'a', i);
+        buffer[i] = '\0';
+        ASSERT_EQ(!(i & 1), pcb_in(t, buffer));
+    }
+    pcb_destroy(t);
+}
+
+static int _map_sum_cb(const char *s, pcb_value_t *v, void *ctx)
+{
+    (void)s;
+    *(unsigned long long *)ctx += (uintptr_t)*v;
+    return 1;
+}
+
+TEST(MapTests)
+{
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    unsigned long long tgt_sum = 0;
+    for (uintptr_t i = 1; i < 100000; i++)
+    {
+        char buffer[64];
+        sprintf(buffer, "%s%lu", (i & 1) ? "a-long-prefix-to-avoid-inlining-" : "", (unsigned long)i);
+        if (buffer[0] == '3')
+            tgt_sum += i;
+        ASSERT_EQ(1, pcb_map_put(t, buffer, (pcb_value_t)i));
+    }
+    for (uintptr_t i = 1; i < 100000; i++)
+    {
+        char buffer[64];
+        sprintf(buffer, "%s%lu", (i & 1) ? "a-long-prefix-to-avoid-inlining-" : "", (unsigned long)i);
+        pcb_value_t *v = pcb_map_get(t, buffer);
+        ASSERT_NE(NULL, v);
+        ASSERT_EQ((pcb_value_t)i, *v);
+    }
+    ASSERT_EQ(NULL, pcb_map_get(t, "0"));
+    int inserted = 1;
+    pcb_value_t *v = pcb_map_get_or_insert(t, "42", &inserted);
+    ASSERT_EQ(0, inserted);
+    ASSERT_EQ((pcb_value_t)42, *v);
+    v = pcb_map_get_or_insert(t, "0", &inserted);
+    ASSERT_EQ(1, inserted);
+    ASSERT_EQ(NULL, *v);
+    *v = (pcb_value_t)1234;
+    ASSERT_EQ((pcb_value_t)1234, *pcb_map_get(t, "0"));
+    ASSERT_EQ(1, pcb_map_put(t, "0", (pcb_value_t)4321));
+    ASSERT_EQ((pcb_value_t)4321, *pcb_map_get(t, "0"));
+    ASSERT_EQ(0, strcmp(pcb_map_find_next(t, "", &v), "0"));
+    ASSERT_EQ((pcb_value_t)4321, *v);
+    pcb_value_t rv = NULL;
+    ASSERT_EQ(1, pcb_map_remove(t, "0", &rv));
+    ASSERT_EQ((pcb_value_t)4321, rv);
+    ASSERT_EQ(0, pcb_map_remove(t, "0", &rv));
+    unsigned long long cb_sum = 0;
+    ASSERT_EQ(1, pcb_map_find_suffixes(t, "3", _map_sum_cb, &cb_sum));
+    ASSERT_EQ(tgt_sum, cb_sum);
+    pcb_destroy(t);
+}
+
+TEST(BinaryTests)
+{
+    static const struct { const char *s; size_t len; } keys[] =
+    {
+        { "", 0 }, { "\0", 1 }, { "\0\0", 2 }, { "\0\x01", 2 }, { "A", 1 },
+        { "A\0", 2 }, { "A\0\0", 3 }, { "A\0\x01", 3 }, { "A\x01", 2 },
+        { "A\x7f\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 20 }, { "B", 1 }, { "\xff", 1 }, { "\xff\0", 2 }
+    };
+    const size_t num_keys = sizeof(keys) / sizeof(keys[0]);
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    for (size_t i = num_keys; i-- > 0;)
+        ASSERT_EQ(1, pcb_add_len(t, keys[i].s, keys[i].len));
+    for (size_t i = 0; i < num_keys; i++)
+    {
+        ASSERT_EQ(0, pcb_add_len(t, keys[i].s, keys[i].len));
+        ASSERT_EQ(1, pcb_in_len(t, keys[i].s, keys[i].len));
+    }
+    ASSERT_EQ(0, pcb_in_len(t, "A\0\0\0", 4));
+    size_t len = 0;
+    const char *s = pcb_find_next_len(t, "", 0, &len);
+    for (size_t i = 1; i < num_keys; i++)
+    {
+        ASSERT_NE(NULL, s);
+        ASSERT_EQ(keys[i].len, len);
+        ASSERT_EQ(0, memcmp(s, keys[i].s, len));
+        s = pcb_find_next_len(t, s, len, &len);
+    }
+    ASSERT_EQ(NULL, s);
+    s = pcb_find_next_len(t, "A\0\0\0", 4, &len);
+    ASSERT_EQ(3, len);
+    ASSERT_EQ(0, memcmp(s, "A\0\x01", 3));
+    for (size_t i = 0; i < num_keys; i += 2)
+        ASSERT_EQ(1, pcb_rem_len(t, keys[i].s, keys[i].len));
+    for (size_t i = 0; i < num_keys; i++)
+        ASSERT_EQ((int)(i & 1), pcb_in_len(t, keys[i].s, keys[i].len));
+    pcb_destroy(t);
+}
+
+TEST(NextOfMissingTests)
+{
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(1, pcb_add(t, "A"));
+    ASSERT_EQ(1, pcb_add(t, "C"));
+    ASSERT_EQ(1, pcb_add(t, "CA"));
+    ASSERT_EQ(0, strcmp(pcb_find_next(t, "\x02"), "A"));
+    ASSERT_EQ(0, strcmp(pcb_find_next(t, "B"), "C"));
+    ASSERT_EQ(0, strcmp(pcb_find_next(t, "C"), "CA"));
+    ASSERT_EQ(0, strcmp(pcb_find_next(t, "C\x01"), "CA"));
+    ASSERT_EQ(NULL, pcb_find_next(t, "CB"));
+    ASSERT_EQ(NULL, pcb_find_next(t, "D"));
+    pcb_destroy(t);
+}
+
+TEST(BatchTests)
+{
+    enum { NUM_KEYS = 1000 };
+    static char bufs[NUM_KEYS][48];
+    const char *keys[NUM_KEYS];
+    int found[NUM_KEYS];
+    const char *next[NUM_KEYS];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(bufs[i], i < NUM_KEYS / 2 ? "%zu" : "a longer key to go out of line %zu", i);
+        keys[i] = bufs[i];
+    }
+    ASSERT_EQ(0, pcb_in_batch(t, keys, NUM_KEYS, found));
+    for (size_t i = 0; i < NUM_KEYS; i++)
+        ASSERT_EQ(0, found[i]);
+    for (size_t i = 0; i < NUM_KEYS; i += 2)
+        ASSERT_EQ(1, pcb_add(t, keys[i]));
+    ASSERT_EQ(NUM_KEYS / 2, pcb_in_batch(t, keys, NUM_KEYS, found));
+    pcb_find_next_batch(t, keys, NUM_KEYS, next);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        ASSERT_EQ(!(i & 1), found[i]);
+        ASSERT_EQ(pcb_find_next(t, keys[i]), next[i]);
+    }
+    pcb_destroy(t);
+}
+
+TEST(BuildSortedTests)
+{
+    enum { NUM_KEYS = 5000 };
+    static char bufs[NUM_KEYS][48];
+    const char *keys[NUM_KEYS];
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(bufs[i], (i / 7) & 1 ? "%zu" : "%zu with a long tail to go out of line", i * 7919);
+        keys[i] = bufs[i];
+    }
+    qsort(keys, NUM_KEYS, sizeof(keys[0]), _str_sort_cmp);
+    pcb_t *t = pcb_build_sorted(keys, NUM_KEYS);
+    ASSERT_NE(NULL, t);
+    const char *s = pcb_find_next(t, "");
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        ASSERT_EQ(1, pcb_in(t, keys[i]));
+        ASSERT_NE(NULL, s);
+        ASSERT_EQ(0, strcmp(s, keys[i]));
+        s = pcb_find_next(t, s);
+    }
+    ASSERT_EQ(NULL, s);
+    ASSERT_EQ(0, pcb_add(t, keys[0]));
+    ASSERT_EQ(1, pcb_add(t, "not there"));
+    ASSERT_EQ(1, pcb_rem(t, keys[NUM_KEYS / 2]));
+    ASSERT_EQ(0, pcb_in(t, keys[NUM_KEYS / 2]));
+    pcb_destroy(t);
+    t = pcb_build_sorted(keys, 0);
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(NULL, pcb_find_next(t, ""));
+    pcb_destroy(t);
+    static const char *const prefixes[] = { "", "A", "AB", "ABC", "B" };
+    t = pcb_build_sorted(prefixes, 5);
+    ASSERT_NE(NULL, t);
+    for (size_t i = 0; i < 5; i++)
+        ASSERT_EQ(1, pcb_in(t, prefixes[i]));
+    pcb_destroy(t);
+    static const char *const unsorted[] = { "A", "C", "B" };
+    ASSERT_EQ(NULL, pcb_build_sorted(unsorted, 3));
+    static const char *const duplicated[] = { "A", "B", "B", "C" };
+    ASSERT_EQ(NULL, pcb_build_sorted(duplicated, 4));
+}
+
+TEST(BuildParallelTests)
+{
+    enum { NUM_KEYS = 20000, NUM_DISTINCT = 7001 };
+    static char bufs[NUM_KEYS][48];
+    const char *keys[NUM_KEYS];
+    pcb_t *ref = pcb_create();
+    ASSERT_NE(NULL, ref);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        size_t k = i * 7919 % NUM_DISTINCT;
+        sprintf(bufs[i], (k / 7) & 1 ? "%zu" : "%zu with a long tail to go out of line", k);
+        keys[i] = bufs[i];
+        pcb_add(ref, keys[i]);
+    }
+    static const size_t num_threads[] = { 0, 1, 2, 3, 8 };
+    static const size_t num_keys[] = { 1, 2, 5, 100, NUM_KEYS };
+    for (size_t i = 0; i < sizeof(num_threads) / sizeof(num_threads[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(num_keys) / sizeof(num_keys[0]); j++)
+        {
+            pcb_t *t = pcb_build_parallel(keys, num_keys[j], num_threads[i]);
+            ASSERT_NE(NULL, t);
+            size_t count = 0;
+            for (const char *s = pcb_find_next(t, ""); s != NULL; s = pcb_find_next(t, s))
+            {
+                ASSERT_EQ(1, pcb_in(ref, s));
+                count++;
+            }
+            for (size_t k = 0; k < num_keys[j]; k++)
+                ASSERT_EQ(1, pcb_in(t, keys[k]));
+            if (num_keys[j] == NUM_KEYS)
+            {
+                ASSERT_EQ(NUM_DISTINCT, count);
+                ASSERT_EQ(0, pcb_add(t, keys[0]));
+                ASSERT_EQ(1, pcb_add(t, "not there"));
+                ASSERT_EQ(1, pcb_rem(t, keys[NUM_KEYS / 2]));
+                ASSERT_EQ(0, pcb_in(t, keys[NUM_KEYS / 2]));
+                ASSERT_EQ(1, pcb_compact(t));
+                ASSERT_EQ(1, pcb_in(t, keys[0]));
+            }
+            pcb_destroy(t);
+        }
+    }
+    pcb_t *t = pcb_build_parallel(keys, 0, 4);
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(NULL, pcb_find_next(t, ""));
+    pcb_destroy(t);
+    static const char *const repeated[] = { "B", "A", "B", "B", "B", "B", "B", "B", "", "B", "B" };
+    t = pcb_build_parallel(repeated, 11, 3);
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(1, pcb_in(t, ""));
+    ASSERT_EQ(0, strcmp(pcb_find_next(t, ""), "A"));
+    ASSERT_EQ(0, strcmp(pcb_find_next(t, "A"), "B"));
+    ASSERT_EQ(NULL, pcb_find_next(t, "B"));
+    pcb_destroy(t);
+    pcb_destroy(ref);
+}
+
+typedef struct
+{
+    size_t *chunks;
+    size_t count;
+    size_t prev_chunk;
+    char *prev;
+    int in_order;
+    size_t max_count;
+} _scan_ctx_t;
+
+static int _scan_cb(const char *s, size_t chunk, void *ctx)
+{
+    _scan_ctx_t *sc = ctx;
+    if (sc->prev != NULL && sc->prev_chunk == chunk && strcmp(sc->prev, s) >= 0)
+        sc->in_order = 0;
+    free(sc->prev);
+    sc->prev = strdup(s);
+    sc->prev_chunk = chunk;
+    sc->chunks[strtoul(s, NULL, 10)] = chunk;
+    return ++sc->count < sc->max_count;
+}
+
+TEST(FindSuffixesParallelTests)
+{
+    enum { NUM_KEYS = 30000, NUM_THREADS = 4 };
+    static size_t chunks[NUM_KEYS];
+    char s[64];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    _scan_ctx_t scs[NUM_THREADS];
+    void *ctxs[NUM_THREADS];
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        ctxs[i] = &scs[i];
+    ASSERT_EQ(1, pcb_find_suffixes_parallel(t, "", _scan_cb, ctxs, NUM_THREADS, 1));
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i / 3) & 1 ? "%zu" : "%zu and a long tail", i);
+        ASSERT_EQ(1, pcb_add(t, s));
+    }
+    for (int ordered = 0; ordered <= 1; ordered++)
+    {
+        static const size_t num_threads[] = { 1, 2, NUM_THREADS };
+        for (size_t j = 0; j < sizeof(num_threads) / sizeof(num_threads[0]); j++)
+        {
+            for (size_t i = 0; i < NUM_THREADS; i++)
+                scs[i] = (_scan_ctx_t){ chunks, 0, 0, NULL, 1, SIZE_MAX };
+            memset(chunks, 0xff, sizeof(chunks));
+            ASSERT_EQ(1, pcb_find_suffixes_parallel(t, "", _scan_cb, ctxs, num_threads[j], ordered));
+            size_t count = 0;
+            for (size_t i = 0; i < NUM_THREADS; i++)
+            {
+                count += scs[i].count;
+                free(scs[i].prev);
+                if (ordered)
+                    ASSERT_EQ(1, scs[i].in_order);
+            }
+            ASSERT_EQ(NUM_KEYS, count);
+            size_t prev_chunk = 0;
+            for (const char *r = pcb_find_next(t, ""); r != NULL; r = pcb_find_next(t, r))
+            {
+                size_t chunk = chunks[strtoul(r, NULL, 10)];
+                ASSERT_NE(SIZE_MAX, chunk);
+                if (ordered)
+                    ASSERT_TRUE(prev_chunk <= chunk);
+                prev_chunk = chunk;
+            }
+        }
+    }
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        scs[i] = (_scan_ctx_t){ chunks, 0, 0, NULL, 1, SIZE_MAX };
+    ASSERT_EQ(1, pcb_find_suffixes_parallel(t, "1234", _scan_cb, ctxs, NUM_THREADS, 0));
+    size_t count = 0;
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        count += scs[i].count;
+        free(scs[i].prev);
+    }
+    ASSERT_EQ(11, count);
+    ASSERT_EQ(1, pcb_find_suffixes_parallel(t, "x", _scan_cb, ctxs, NUM_THREADS, 0));
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        scs[i] = (_scan_ctx_t){ chunks, 0, 0, NULL, 1, 100 };
+    ASSERT_EQ(0, pcb_find_suffixes_parallel(t, "", _scan_cb, ctxs, NUM_THREADS, 0));
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        ASSERT_TRUE(scs[i].count <= 100);
+        free(scs[i].prev);
+    }
+    pcb_destroy(t);
+}
+
+TEST(CursorTests)
+{
+    enum { NUM_KEYS = 2000 };
+    static char bufs[NUM_KEYS][32];
+    const char *keys[NUM_KEYS];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    pcb_cursor_t *c = pcb_cursor_create(t);
+    ASSERT_NE(NULL, c);
+    ASSERT_EQ(0, pcb_cursor_first(c));
+    ASSERT_EQ(0, pcb_cursor_last(c));
+    ASSERT_EQ(0, pcb_cursor_lower_bound(c, ""));
+    ASSERT_EQ(NULL, pcb_cursor_key(c, NULL));
+    pcb_cursor_destroy(c);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(bufs[i], "%zu", 2 * i);
+        keys[i] = bufs[i];
+        ASSERT_EQ(1, pcb_map_put(t, keys[i], (void *)(uintptr_t)i));
+    }
+    qsort(keys, NUM_KEYS, sizeof(keys[0]), _str_sort_cmp);
+    c = pcb_cursor_create(t);
+    ASSERT_NE(NULL, c);
+    ASSERT_EQ(1, pcb_cursor_first(c));
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        size_t len = 0;
+        ASSERT_EQ(0, strcmp(pcb_cursor_key(c, &len), keys[i]));
+        ASSERT_EQ(strlen(keys[i]), len);
+        ASSERT_EQ(pcb_map_get(t, keys[i]), pcb_cursor_value(c));
+        ASSERT_EQ(i + 1 < NUM_KEYS, pcb_cursor_next(c));
+    }
+    ASSERT_EQ(NULL, pcb_cursor_key(c, NULL));
+    ASSERT_EQ(1, pcb_cursor_last(c));
+    for (size_t i = NUM_KEYS; i-- > 0;)
+    {
+        ASSERT_EQ(0, strcmp(pcb_cursor_key(c, NULL), keys[i]));
+        ASSERT_EQ(i > 0, pcb_cursor_prev(c));
+    }
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        char s[32];
+        sprintf(s, "%zu", 2 * i + 1);
+        const char *next = pcb_find_next(t, s);
+        ASSERT_EQ(next != NULL, pcb_cursor_lower_bound(c, s));
+        ASSERT_EQ(next, pcb_cursor_key(c, NULL));
+        ASSERT_EQ(0, pcb_cursor_seek(c, s));
+        ASSERT_EQ(1, pcb_cursor_lower_bound(c, keys[i]));
+        ASSERT_EQ(0, strcmp(pcb_cursor_key(c, NULL), keys[i]));
+        ASSERT_EQ(1, pcb_cursor_seek(c, keys[i]));
+        ASSERT_EQ(i > 0, pcb_cursor_prev(c));
+        if (i > 0)
+            ASSERT_EQ(0, strcmp(pcb_cursor_key(c, NULL), keys[i - 1]));
+    }
+    pcb_cursor_destroy(c);
+    pcb_destroy(t);
+}
+
+static int _count_ordered_cb(const char *s, void *ctx)
+{
+    size_t *count = ctx;
+    if (strlen(s) != ++*count)
+        return 0;
+    return 1;
+}
+
+TEST(DeepTraverseTests)
+{
+    enum { MAX_LEN = 4000 };
+    static char key[MAX_LEN + 1];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    for (size_t i = 0; i < MAX_LEN; i++)
+    {
+        key[i] = 'a';
+        ASSERT_EQ(1, pcb_add(t, key));
+    }
+    size_t count = 0;
+    ASSERT_EQ(1, pcb_find_suffixes(t, "", _count_ordered_cb, &count));
+    ASSERT_EQ(MAX_LEN, count);
+    count = 9;
+    ASSERT_EQ(1, pcb_find_suffixes(t, "aaaaaaaaaa", _count_ordered_cb, &count));
+    ASSERT_EQ(MAX_LEN, count);
+    pcb_destroy(t);
+}
+
+static int _collect_cb(const char *s, void *ctx)
+{
+    const char ***out = ctx;
+    *(*out)++ = s;
+    return strcmp(s, "stop") != 0;
+}
+
+TEST(RangeTests)
+{
+    static const char *const keys[] = { "", "a", "ab", "abc", "b", "ba", "c", "stop", "z" };
+    const size_t num_keys = sizeof(keys) / sizeof(keys[0]);
+    const char *res[16];
+    const char **out;
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    out = res;
+    ASSERT_EQ(1, pcb_find_range(t, NULL, NULL, _collect_cb, &out));
+    ASSERT_EQ(res, out);
+    for (size_t i = 0; i < num_keys; i++)
+        ASSERT_EQ(1, pcb_add(t, keys[i]));
+    out = res;
+    ASSERT_EQ(1, pcb_find_range(t, "a", "b", _collect_cb, &out));
+    ASSERT_EQ(3, out - res);
+    ASSERT_EQ(0, strcmp(res[0], "a"));
+    ASSERT_EQ(0, strcmp(res[2], "abc"));
+    out = res;
+    ASSERT_EQ(1, pcb_find_range(t, "aa", "bz", _collect_cb, &out));
+    ASSERT_EQ(4, out - res);
+    ASSERT_EQ(0, strcmp(res[0], "ab"));
+    ASSERT_EQ(0, strcmp(res[3], "ba"));
+    out = res;
+    ASSERT_EQ(1, pcb_find_range(t, "zz", NULL, _collect_cb, &out));
+    ASSERT_EQ(res, out);
+    out = res;
+    ASSERT_EQ(1, pcb_find_range(t, "b", "b", _collect_cb, &out));
+    ASSERT_EQ(res, out);
+    out = res;
+    ASSERT_EQ(0, pcb_find_range(t, NULL, NULL, _collect_cb, &out));
+    ASSERT_EQ(8, out - res);
+    int stopped = 1;
+    out = res;
+    ASSERT_EQ(3, pcb_find_range_n(t, "ab", NULL, 3, _collect_cb, &out, &stopped));
+    ASSERT_EQ(0, stopped);
+    ASSERT_EQ(0, strcmp(res[2], "b"));
+    ASSERT_EQ(3, pcb_find_range_n(t, pcb_find_next(t, res[2]), NULL, 3, _collect_cb, &out, &stopped));
+    ASSERT_EQ(1, stopped);
+    ASSERT_EQ(0, strcmp(res[5], "stop"));
+    pcb_destroy(t);
+}
+
+TEST(ReverseTests)
+{
+    enum { NUM_KEYS = 1000 };
+    static char bufs[NUM_KEYS][32];
+    const char *keys[NUM_KEYS];
+    const char *res[NUM_KEYS];
+    const char **out = res;
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(NULL, pcb_last(t));
+    ASSERT_EQ(NULL, pcb_find_prev(t, "A"));
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(bufs[i], "%zu", 3 * i);
+        keys[i] = bufs[i];
+        ASSERT_EQ(1, pcb_add(t, keys[i]));
+    }
+    qsort(keys, NUM_KEYS, sizeof(keys[0]), _str_sort_cmp);
+    ASSERT_EQ(0, strcmp(pcb_last(t), keys[NUM_KEYS - 1]));
+    ASSERT_EQ(NULL, pcb_find_prev(t, keys[0]));
+    ASSERT_EQ(NULL, pcb_find_prev(t, ""));
+    ASSERT_EQ(0, strcmp(pcb_find_prev(t, "\xff"), keys[NUM_KEYS - 1]));
+    for (size_t i = 1; i < NUM_KEYS; i++)
+    {
+        char s[40];
+        ASSERT_EQ(0, strcmp(pcb_find_prev(t, keys[i]), keys[i - 1]));
+        sprintf(s, "%s\x01", keys[i - 1]);
+        ASSERT_EQ(0, strcmp(pcb_find_prev(t, s), keys[i - 1]));
+    }
+    ASSERT_EQ(1, pcb_find_suffixes_rev(t, "1", _collect_cb, &out));
+    for (size_t i = 1; i < (size_t)(out - res); i++)
+        ASSERT_TRUE(strcmp(res[i - 1], res[i]) > 0);
+    for (size_t i = 0; i < (size_t)(out - res); i++)
+        ASSERT_EQ('1', res[i][0]);
+    size_t count = 0;
+    for (size_t i = 0; i < NUM_KEYS; i++)
+        count += keys[i][0] == '1';
+    ASSERT_EQ(count, (size_t)(out - res));
+    pcb_destroy(t);
+}
+
+TEST(CompactTests)
+{
+    enum { NUM_KEYS = 100000 };
+    char s[64];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(1, pcb_compact(t));
+    ASSERT_EQ(NULL, pcb_find_next(t, ""));
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail to go out of line", i);
+        ASSERT_EQ(1, pcb_map_put(t, s, (void *)(uintptr_t)i));
+    }
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail to go out of line", i);
+        if (i % 97 != 0)
+            ASSERT_EQ(1, pcb_rem(t, s));
+    }
+    ASSERT_EQ(1, pcb_compact(t));
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail to go out of line", i);
+        pcb_value_t *v = pcb_map_get(t, s);
+        if (i % 97 != 0)
+            ASSERT_EQ(NULL, v);
+        else
+        {
+            ASSERT_NE(NULL, v);
+            ASSERT_EQ(i, (uintptr_t)*v);
+        }
+    }
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, "new %zu", i);
+        ASSERT_EQ(1, pcb_add(t, s));
+    }
+    ASSERT_EQ(1, pcb_in(t, "new 0"));
+    ASSERT_EQ(1, pcb_in(t, "97"));
+    pcb_destroy(t);
+}
+
+TEST(FrozenTests)
+{
+    enum { NUM_KEYS = 20000 };
+    char s[64];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    pcb_frozen_t *f = pcb_freeze(t);
+    ASSERT_NE(NULL, f);
+    ASSERT_EQ(0, pcb_frozen_in(f, ""));
+    ASSERT_EQ(NULL, pcb_frozen_find_next(f, ""));
+    pcb_frozen_destroy(f);
+    ASSERT_EQ(1, pcb_add(t, "single"));
+    f = pcb_freeze(t);
+    ASSERT_NE(NULL, f);
+    ASSERT_EQ(1, pcb_frozen_in(f, "single"));
+    ASSERT_EQ(0, strcmp(pcb_frozen_find_next(f, ""), "single"));
+    ASSERT_EQ(NULL, pcb_frozen_find_next(f, "single"));
+    pcb_frozen_destroy(f);
+    pcb_t *lt = pcb_create();
+    ASSERT_NE(NULL, lt);
+    ASSERT_EQ(1, pcb_add(lt, "a single key with a long tail"));
+    f = pcb_freeze(lt);
+    ASSERT_NE(NULL, f);
+    ASSERT_EQ(1, pcb_frozen_in(f, "a single key with a long tail"));
+    pcb_frozen_destroy(f);
+    pcb_destroy(lt);
+    ASSERT_EQ(1, pcb_add(t, ""));
+    for (size_t i = 0; i < NUM_KEYS; i += 2)
+    {
+        sprintf(s, (i & 2) ? "%zu" : "%zu and a long tail", i * 7);
+        ASSERT_EQ(1, pcb_add(t, s));
+    }
+    f = pcb_freeze(t);
+    ASSERT_NE(NULL, f);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i & 2) ? "%zu" : "%zu and a long tail", i * 7);
+        ASSERT_EQ(pcb_in(t, s), pcb_frozen_in(f, s));
+        const char *n1 = pcb_find_next(t, s), *n2 = pcb_frozen_find_next(f, s);
+        ASSERT_EQ(n1 == NULL, n2 == NULL);
+        if (n1 != NULL)
+            ASSERT_EQ(0, strcmp(n1, n2));
+    }
+    ASSERT_EQ(1, pcb_frozen_in(f, ""));
+    ASSERT_EQ(0, pcb_frozen_in_len(f, "single", 5));
+    for (unsigned i = 0; i < 100; i++)
+    {
+        unsigned long long sum1 = 0, sum2 = 0;
+        sprintf(s, "%u", i);
+        ASSERT_EQ(1, pcb_find_suffixes(t, s, _sum_cb, &sum1));
+        ASSERT_EQ(1, pcb_frozen_find_suffixes(f, s, _sum_cb, &sum2));
+        ASSERT_EQ(sum1, sum2);
+    }
+    const char *res[8];
+    const char **out = res;
+    ASSERT_EQ(1, pcb_frozen_find_suffixes(f, "sin", _collect_cb, &out));
+    ASSERT_EQ(1, out - res);
+    ASSERT_EQ(1, pcb_frozen_find_suffixes(f, "nothing", _collect_cb, &out));
+    ASSERT_EQ(1, out - res);
+    pcb_frozen_destroy(f);
+    pcb_destroy(t);
+}
+
+TEST(SaveMmapTests)
+{
+    enum { NUM_KEYS = 20000 };
+    char s[64];
+    char path[] = "/tmp/pcb_t_XXXXXX";
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    for (size_t i = 0; i < NUM_KEYS; i += 2)
+    {
+        sprintf(s, (i & 2) ? "%zu" : "%zu and a long tail", i);
+        ASSERT_EQ(1, pcb_add(t, s));
+    }
+    int fd = mkstemp(path);
+    ASSERT_TRUE(fd >= 0);
+    ASSERT_EQ(0, pcb_save(t, -1));
+    ASSERT_EQ(1, pcb_save(t, fd));
+    off_t size = lseek(fd, 0, SEEK_END);
+    pcb_frozen_t *f = pcb_open_mmap(path);
+    ASSERT_NE(NULL, f);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i & 2) ? "%zu" : "%zu and a long tail", i);
+        ASSERT_EQ(pcb_in(t, s), pcb_frozen_in(f, s));
+        const char *n1 = pcb_find_next(t, s), *n2 = pcb_frozen_find_next(f, s);
+        ASSERT_EQ(n1 == NULL, n2 == NULL);
+        if (n1 != NULL)
+            ASSERT_EQ(0, strcmp(n1, n2));
+    }
+    pcb_frozen_destroy(f);
+
+    /* a child out of range, a cycle and a leaf past the blob are rejected */
+    uint32_t ref, saved;
+    uint64_t blob_offset;
+    ASSERT_EQ(8, pread(fd, &blob_offset, 8, 40));
+    off_t corrupt[3] = { 64 + 8, 64 + 12, (off_t)blob_offset };
+    uint32_t values[3] = { UINT32_MAX, 1, UINT32_MAX };
+    for (size_t i = 0; i < 3; i++)
+    {
+        ASSERT_EQ(4, pread(fd, &saved, 4, corrupt[i]));
+        ref = values[i];
+        ASSERT_EQ(4, pwrite(fd, &ref, 4, corrupt[i]));
+        ASSERT_EQ(NULL, pcb_open_mmap(path));
+        ASSERT_EQ(4, pwrite(fd, &saved, 4, corrupt[i]));
+    }
+    f = pcb_open_mmap(path);
+    ASSERT_NE(NULL, f);
+    pcb_frozen_destroy(f);
+
+    ASSERT_EQ(0, ftruncate(fd, size - 64));
+    ASSERT_EQ(NULL, pcb_open_mmap(path));
+    ASSERT_EQ(0, ftruncate(fd, 0));
+    ASSERT_EQ(NULL, pcb_open_mmap(path));
+    close(fd);
+    unlink(path);
+    ASSERT_EQ(NULL, pcb_open_mmap(path));
+    pcb_destroy(t);
+}
+
+typedef struct
+{
+    pcb_t *t;
+    size_t num_keys;
+    int done;
+    size_t num_reads;
+    size_t num_errors;
+} _reader_ctx_t;
+
+static void *_reader_thread(void *arg)
+{
+    _reader_ctx_t *rc = arg;
+    pcb_reader_t *r = pcb_reader_create(rc->t);
+    char s[64];
+    if (r == NULL)
+    {
+        rc->num_errors++;
+        return NULL;
+    }
+    while (!__atomic_load_n(&rc->done, __ATOMIC_ACQUIRE))
+    {
+        pcb_read_begin(r);
+        for (size_t i = 0; i < rc->num_keys; i += 2)
+        {
+            sprintf(s, "k%06zu", i);
+            const char *n = pcb_find_next(rc->t, s);
+            if (!pcb_in(rc->t, s) || n == NULL || strcmp(n, s) <= 0 || strncmp(n, "k", 1) != 0)
+                rc->num_errors++;
+        }
+        pcb_read_end(r);
+        rc->num_reads++;
+    }
+    pcb_reader_destroy(r);
+    return NULL;
+}
+
+TEST(ConcurrentReadTests)
+{
+    enum { NUM_KEYS = 20000, NUM_READERS = 3, NUM_ROUNDS = 4 };
+    char s[64];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    for (size_t i = 0; i <= NUM_KEYS; i += 2)
+    {
+        sprintf(s, "k%06zu", i);
+        ASSERT_EQ(1, pcb_add(t, s));
+    }
+    pthread_t threads[NUM_READERS];
+    _reader_ctx_t rcs[NUM_READERS];
+    for (size_t i = 0; i < NUM_READERS; i++)
+    {
+        rcs[i] = (_reader_ctx_t){ t, NUM_KEYS, 0, 0, 0 };
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, _reader_thread, &rcs[i]));
+    }
+    for (size_t round = 0; round < NUM_ROUNDS; round++)
+    {
+        for (size_t i = 1; i < NUM_KEYS; i += 2)
+        {
+            sprintf(s, (i & 2) ? "k%06zu" : "k%06zu with a tail longer than a node", i);
+            ASSERT_EQ(1, pcb_add(t, s));
+        }
+        for (size_t i = 1; i < NUM_KEYS; i += 2)
+        {
+            sprintf(s, (i & 2) ? "k%06zu" : "k%06zu with a tail longer than a node", i);
+            ASSERT_EQ(1, pcb_rem(t, s));
+        }
+    }
+    for (size_t i = 0; i < NUM_READERS; i++)
+    {
+        __atomic_store_n(&rcs[i].done, 1, __ATOMIC_RELEASE);
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT_EQ(0, rcs[i].num_errors);
+        ASSERT_TRUE(rcs[i].num_reads > 0);
+    }
+    pcb_reader_t *r = pcb_reader_create(t);
+    ASSERT_NE(NULL, r);
+    pcb_read_begin(r);
+    ASSERT_EQ(0, pcb_in(t, "k000001"));
+    ASSERT_EQ(1, pcb_in(t, "k000002"));
+    pcb_read_end(r);
+    pcb_reader_destroy(r);
+    pcb_destroy(t);
+}
+
+typedef struct
+{
+    pcb_sharded_t *st;
+    size_t first;
+    size_t step;
+    size_t num_keys;
+    size_t num_added;
+} _sharded_writer_ctx_t;
+
+static void *_sharded_writer_thread(void *arg)
+{
+    _sharded_writer_ctx_t *wc = arg;
+    char s[64];
+    for (size_t i = wc->first; i < wc->num_keys; i += wc->step)
+    {
+        sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail", i);
+        wc->num_added += pcb_sharded_add(wc->st, s);
+    }
+    return NULL;
+}
+
+static int _check_ordered_cb(const char *s, void *ctx)
+{
+    char **prev = ctx;
+    if (*prev != NULL && strcmp(*prev, s) >= 0)
+        return 0;
+    free(*prev);
+    *prev = strdup(s);
+    return 1;
+}
+
+TEST(ShardedTests)
+{
+    enum { NUM_KEYS = 40000, NUM_WRITERS = 4 };
+    const char *splits[] = { "2", "4", "6", "8" };
+    char s[64], buf[64];
+    for (int with_splits = 0; with_splits <= 1; with_splits++)
+    {
+        pcb_sharded_t *st = pcb_sharded_create(with_splits ? 5 : 16, with_splits ? splits : NULL);
+        ASSERT_NE(NULL, st);
+        ASSERT_EQ(0, pcb_sharded_find_next(st, "", buf, sizeof(buf)));
+        pthread_t threads[NUM_WRITERS];
+        _sharded_writer_ctx_t wcs[NUM_WRITERS];
+        for (size_t i = 0; i < NUM_WRITERS; i++)
+        {
+            wcs[i] = (_sharded_writer_ctx_t){ st, i, NUM_WRITERS, NUM_KEYS, 0 };
+            ASSERT_EQ(0, pthread_create(&threads[i], NULL, _sharded_writer_thread, &wcs[i]));
+        }
+        for (size_t i = 0; i < NUM_WRITERS; i++)
+        {
+            ASSERT_EQ(0, pthread_join(threads[i], NULL));
+            ASSERT_EQ(NUM_KEYS / NUM_WRITERS, wcs[i].num_added);
+        }
+        for (size_t i = 0; i < NUM_KEYS; i++)
+        {
+            sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail", i);
+            ASSERT_EQ(1, pcb_sharded_in(st, s));
+            ASSERT_EQ(0, pcb_sharded_add(st, s));
+        }
+        ASSERT_EQ(0, pcb_sharded_in(st, "1 and a long tail"));
+        size_t count = 0;
+        buf[0] = '\0';
+        for (size_t len; (len = pcb_sharded_find_next(st, buf, buf, sizeof(buf))) > 0; count++)
+            ASSERT_EQ(strlen(buf), len);
+        ASSERT_EQ(NUM_KEYS, count);
+        ASSERT_EQ(strlen("0 and a long tail"), pcb_sharded_find_next(st, "", buf, 2));
+        ASSERT_EQ(0, strcmp(buf, "0"));
+        char *prev = NULL;
+        ASSERT_EQ(1, pcb_sharded_find_suffixes(st, "", _check_ordered_cb, &prev));
+        ASSERT_EQ(0, strcmp(prev, "9999"));
+        free(prev);
+        unsigned long long cb_sum = 0;
+        ASSERT_EQ(1, pcb_sharded_find_suffixes(st, "3999", _sum_cb, &cb_sum));
+        ASSERT_EQ(3999 + 39990 + 39991 + 39992 + 39993 + 39994 + 39995 + 39996 + 39997 + 39998 + 39999, cb_sum);
+        for (size_t i = 0; i < NUM_KEYS; i += 2)
+        {
+            sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail", i);
+            ASSERT_EQ(1, pcb_sharded_rem(st, s));
+        }
+        ASSERT_EQ(0, pcb_sharded_in(st, "0 and a long tail"));
+        ASSERT_EQ(1, pcb_sharded_in(st, "1"));
+        ASSERT_EQ(1, pcb_sharded_find_next(st, "", buf, sizeof(buf)));
+        ASSERT_EQ(0, strcmp(buf, "1"));
+        pcb_sharded_destroy(st);
+    }
+    const char *bad_order[] = { "2", "4", "4", "8" };
+    const char *bad_empty[] = { "", "4", "6", "8" };
+    const char *bad_null[] = { "2", NULL, "6", "8" };
+    ASSERT_EQ(NULL, pcb_sharded_create(5, bad_order));
+    ASSERT_EQ(NULL, pcb_sharded_create(5, bad_empty));
+    ASSERT_EQ(NULL, pcb_sharded_create(5, bad_null));
+    ASSERT_EQ(NULL, pcb_sharded_create(257, NULL));
+    pcb_sharded_t *st = pcb_sharded_create(256, NULL);
+    ASSERT_NE(NULL, st);
+    ASSERT_EQ(1, pcb_sharded_add(st, "\xff"));
+    ASSERT_EQ(1, pcb_sharded_in(st, "\xff"));
+    pcb_sharded_destroy(st);
+}
+
+typedef struct
+{
+    pcb_t *t;
+    size_t first;
+    size_t num_keys;
+    size_t num_added;
+} _concurrent_writer_ctx_t;
+
+static void *_concurrent_writer_thread(void *arg)
+{
+    _concurrent_writer_ctx_t *wc = arg;
+    char s[64];
+    for (size_t j = 0; j < wc->num_keys; j++)
+    {
+        size_t i = (wc->first + j * 7919) % wc->num_keys;
+        sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail", i);
+        wc->num_added += pcb_add_concurrent(wc->t, s);
+    }
+    return NULL;
+}
+
+TEST(ConcurrentAddTests)
+{
+    enum { NUM_KEYS = 40000, NUM_WRITERS = 4 };
+    char s[64];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    pthread_t threads[NUM_WRITERS];
+    _concurrent_writer_ctx_t wcs[NUM_WRITERS];
+    for (size_t i = 0; i < NUM_WRITERS; i++)
+    {
+        wcs[i] = (_concurrent_writer_ctx_t){ t, i * (NUM_KEYS / NUM_WRITERS), NUM_KEYS, 0 };
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, _concurrent_writer_thread, &wcs[i]));
+    }
+    size_t num_added = 0;
+    for (size_t i = 0; i < NUM_WRITERS; i++)
+    {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        num_added += wcs[i].num_added;
+    }
+    ASSERT_EQ(NUM_KEYS, num_added);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail", i);
+        ASSERT_EQ(1, pcb_in(t, s));
+    }
+    char *prev = NULL;
+    ASSERT_EQ(1, pcb_find_suffixes(t, "", _check_ordered_cb, &prev));
+    ASSERT_EQ(0, strcmp(prev, "9999"));
+    free(prev);
+    for (size_t i = 0; i < NUM_KEYS; i += 2)
+    {
+        sprintf(s, (i & 1) ? "%zu" : "%zu and a long tail", i);
+        ASSERT_EQ(1, pcb_rem(t, s));
+    }
+    ASSERT_EQ(1, pcb_add_concurrent(t, "0 and a long tail"));
+    ASSERT_EQ(0, pcb_add_concurrent(t, "1"));
+    ASSERT_EQ(1, pcb_in(t, "0 and a long tail"));
+    ASSERT_EQ(0, pcb_in(t, "2 and a long tail"));
+    pcb_destroy(t);
+}
+
+static int _stop_cb(const char *s, void *ctx)
+{
+    (void)s;
+    (*(size_t *)ctx)++;
+    return 0;
+}
+
+TEST(SetAlgebraTests)
+{
+    enum { NUM_KEYS = 20000 };
+    char s[64];
+    pcb_t *a = pcb_create();
+    pcb_t *b = pcb_create();
+    pcb_t *e = pcb_create();
+    ASSERT_NE(NULL, a);
+    ASSERT_NE(NULL, b);
+    ASSERT_NE(NULL, e);
+    size_t num_a = 0, num_b = 0, num_both = 0;
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i / 5) & 1 ? "%zu" : "%zu and a long tail", i);
+        int in_a = i % 3 == 0 || (i > 1000 && i < 2000);
+        int in_b = i % 7 == 0 || (i > 1500 && i < 3000);
+        if (in_a)
+            ASSERT_EQ(1, pcb_add(a, s));
+        if (in_b)
+            ASSERT_EQ(1, pcb_add(b, s));
+        num_a += in_a;
+        num_b += in_b;
+        num_both += in_a && in_b;
+    }
+    ASSERT_EQ(num_a + num_b - num_both, pcb_union_count(a, b));
+    ASSERT_EQ(num_both, pcb_intersect_count(a, b));
+    ASSERT_EQ(num_a - num_both, pcb_difference_count(a, b));
+    ASSERT_EQ(num_b - num_both, pcb_difference_count(b, a));
+    ASSERT_EQ(num_a, pcb_union_count(a, a));
+    ASSERT_EQ(num_a, pcb_intersect_count(a, a));
+    ASSERT_EQ(0, pcb_difference_count(a, a));
+    ASSERT_EQ(num_a, pcb_union_count(e, a));
+    ASSERT_EQ(0, pcb_intersect_count(a, e));
+    ASSERT_EQ(num_a, pcb_difference_count(a, e));
+    ASSERT_EQ(0, pcb_union_count(e, e));
+    pcb_t *u = pcb_union(a, b);
+    pcb_t *x = pcb_intersect(a, b);
+    pcb_t *d = pcb_difference(a, b);
+    ASSERT_NE(NULL, u);
+    ASSERT_NE(NULL, x);
+    ASSERT_NE(NULL, d);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(s, (i / 5) & 1 ? "%zu" : "%zu and a long tail", i);
+        int in_a = pcb_in(a, s), in_b = pcb_in(b, s);
+        ASSERT_EQ(in_a || in_b, pcb_in(u, s));
+        ASSERT_EQ(in_a && in_b, pcb_in(x, s));
+        ASSERT_EQ(in_a && !in_b, pcb_in(d, s));
+    }
+    char *prev = NULL;
+    ASSERT_EQ(1, pcb_union_cb(a, b, _check_ordered_cb, &prev));
+    ASSERT_EQ(0, strcmp(prev, pcb_last(u)));
+    free(prev);
+    prev = NULL;
+    ASSERT_EQ(1, pcb_intersect_cb(a, b, _check_ordered_cb, &prev));
+    ASSERT_EQ(0, strcmp(prev, pcb_last(x)));
+    free(prev);
+    prev = NULL;
+    ASSERT_EQ(1, pcb_difference_cb(b, a, _check_ordered_cb, &prev));
+    free(prev);
+    size_t count = 0;
+    ASSERT_EQ(0, pcb_union_cb(a, b, _stop_cb, &count));
+    ASSERT_EQ(1, count);
+    pcb_destroy(u);
+    pcb_destroy(x);
+    pcb_destroy(d);
+    pcb_destroy(e);
+    pcb_destroy(b);
+    pcb_destroy(a);
+
+    /* keys with NUL bytes are kept whole */
+    a = pcb_create();
+    b = pcb_create();
+    ASSERT_NE(NULL, a);
+    ASSERT_NE(NULL, b);
+    ASSERT_EQ(1, pcb_add_len(a, "a\0b", 3));
+    ASSERT_EQ(1, pcb_add_len(a, "a\0c", 3));
+    ASSERT_EQ(1, pcb_add_len(a, "k\0v1 and a long tail", 21));
+    ASSERT_EQ(1, pcb_add_len(b, "a\0c", 3));
+    ASSERT_EQ(1, pcb_add(b, "z"));
+    ASSERT_EQ(4, pcb_union_count(a, b));
+    u = pcb_union(a, b);
+    x = pcb_intersect(a, b);
+    d = pcb_difference(a, b);
+    ASSERT_NE(NULL, u);
+    ASSERT_NE(NULL, x);
+    ASSERT_NE(NULL, d);
+    ASSERT_EQ(1, pcb_in_len(u, "a\0b", 3));
+    ASSERT_EQ(1, pcb_in_len(u, "a\0c", 3));
+    ASSERT_EQ(1, pcb_in_len(u, "k\0v1 and a long tail", 21));
+    ASSERT_EQ(1, pcb_in(u, "z"));
+    ASSERT_EQ(0, pcb_in(u, "a"));
+    ASSERT_EQ(0, pcb_in(u, "k"));
+    ASSERT_EQ(1, pcb_in_len(x, "a\0c", 3));
+    ASSERT_EQ(0, pcb_in_len(x, "a\0b", 3));
+    ASSERT_EQ(0, pcb_in(x, "a"));
+    ASSERT_EQ(1, pcb_in_len(d, "a\0b", 3));
+    ASSERT_EQ(1, pcb_in_len(d, "k\0v1 and a long tail", 21));
+    ASSERT_EQ(0, pcb_in_len(d, "a\0c", 3));
+    ASSERT_EQ(0, pcb_in(d, "a"));
+    pcb_destroy(u);
+    pcb_destroy(x);
+    pcb_destroy(d);
+    pcb_destroy(b);
+    pcb_destroy(a);
+}
+
+static int _count_prefix_cb(const char *s, void *ctx)
+{
+    (void)s;
+    (*(size_t *)ctx)++;
+    return 1;
+}
+
+static int _check_counts(const pcb_t *t)
+{
+    static const char *const prefixes[] = { "", "1", "12", "123", "1234", "9", "x", "5 and" };
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
+    {
+        size_t count = 0;
+        pcb_find_suffixes(t, prefixes[i], _count_prefix_cb, &count);
+        if (pcb_count_prefix(t, prefixes[i]) != count)
+            return 0;
+    }
+    size_t k = pcb_in(t, "");
+    for (const char *s = pcb_find_next(t, ""); s != NULL; s = pcb_find_next(t, s), k++)
+    {
+        if (pcb_rank(t, s) != k || (k % 97 == 0 && strcmp(s, pcb_select(t, k)) != 0))
+            return 0;
+    }
+    return pcb_select(t, k) == NULL && pcb_rank(t, "\xff") == k;
+}
+
+TEST(SubtreeCountTests)
+{
+    enum { NUM_KEYS = 5000 };
+    static char bufs[NUM_KEYS][48];
+    const char *keys[NUM_KEYS];
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(0, pcb_count_prefix(t, ""));
+    ASSERT_EQ(0, pcb_rank(t, "a"));
+    ASSERT_EQ(NULL, pcb_select(t, 0));
+    ASSERT_EQ(NULL, pcb_sample(t, 12345));
+    for (size_t i = 0; i < NUM_KEYS; i++)
+    {
+        sprintf(bufs[i], (i / 3) & 1 ? "%zu" : "%zu and a long tail", i);
+        keys[i] = bufs[i];
+        ASSERT_EQ(1, pcb_add(t, keys[i]));
+    }
+    ASSERT_EQ(NUM_KEYS, pcb_count_prefix(t, ""));
+    ASSERT_EQ(111, pcb_count_prefix(t, "12"));
+    ASSERT_EQ(0, pcb_rank(t, ""));
+    ASSERT_EQ(0, strcmp("0 and a long tail", pcb_select(t, 0)));
+    ASSERT_EQ(1, _check_counts(t));
+    for (size_t i = 0; i < NUM_KEYS; i += 3)
+        ASSERT_EQ(1, pcb_rem(t, keys[i]));
+    ASSERT_EQ(1, pcb_add(t, ""));
+    ASSERT_EQ(1, _check_counts(t));
+    ASSERT_EQ(1, pcb_compact(t));
+    ASSERT_EQ(1, _check_counts(t));
+    for (size_t i = 0; i < 100; i++)
+        ASSERT_EQ(1, pcb_in(t, pcb_sample(t, i * 2654435761u)));
+    pcb_destroy(t);
+    qsort(keys, NUM_KEYS, sizeof(keys[0]), _str_sort_cmp);
+    t = pcb_build_sorted(keys, NUM_KEYS);
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(1, _check_counts(t));
+    pcb_destroy(t);
+    t = pcb_build_parallel(keys, NUM_KEYS, 3);
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(1, _check_counts(t));
+    pcb_destroy(t);
+    t = pcb_create();
+    ASSERT_NE(NULL, t);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+        ASSERT_EQ(1, pcb_add_concurrent(t, keys[i]));
+    ASSERT_EQ(1, _check_counts(t));
+    pcb_destroy(t);
+}
+
+TEST(LongestPrefixTests)
+{
+    pcb_t *t = pcb_create();
+    ASSERT_NE(NULL, t);
+    ASSERT_EQ(NULL, pcb_longest_prefix(t, "/a"));
+    ASSERT_EQ(NULL, pcb_longest_prefix_bits(t, "\x0a", 8, NULL));
+    static const char *const routes[] = { "/", "/api", "/api/v1", "/api/v1/users", "/static", "/apiary" };
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); i++)
+        ASSERT_EQ(1, pcb_map_put(t, routes[i], (pcb_value_t)i));
+    ASSERT_EQ(NULL, pcb_longest_prefix(t, ""));
+    ASSERT_EQ(NULL, pcb_longest_prefix(t, "api"));
+    ASSERT_EQ(0, strcmp("/", pcb_longest_prefix(t, "/")));
+    ASSERT_EQ(0, strcmp("/", pcb_longest_prefix(t, "/ap")));
+    ASSERT_EQ(0, strcmp("/api", pcb_longest_prefix(t, "/api/v2/users")));
+    ASSERT_EQ(0, strcmp("/api/v1", pcb_longest_prefix(t, "/api/v1/user")));
+    ASSERT_EQ(0, strcmp("/api/v1/users", pcb_longest_prefix(t, "/api/v1/users/42")));
+    ASSERT_EQ(0, strcmp("/apiary", pcb_longest_prefix(t, "/apiary")));
+    pcb_value_t *v = NULL;
+    ASSERT_EQ(0, strcmp("/static", pcb_map_longest_prefix(t, "/static/img.png", &v)));
+    ASSERT_EQ((pcb_value_t)4, *v);
+    size_t r_len = 0;
+    ASSERT_EQ(0, strcmp("/api", pcb_longest_prefix_len(t, "/api\0/v1", 8, &r_len)));
+    ASSERT_EQ(4, r_len);
+    ASSERT_EQ(1, pcb_add(t, ""));
+    ASSERT_EQ(0, strcmp("", pcb_longest_prefix(t, "api")));
+    pcb_destroy(t);
+
+    /* IPv4 prefixes, as bit strings */
+    static const struct { unsigned char addr[4]; size_t num_bits; } prefixes[] =
+    {
+        { { 0, 0, 0, 0 }, 0 }, { { 10, 0, 0, 0 }, 8 }, { { 10, 1, 0, 0 }, 16 }, { { 10, 1, 2, 0 }, 23 },
+        { { 10, 1, 2, 128 }, 25 }, { { 192, 168, 0, 0 }, 16 }, { { 192, 168, 1, 1 }, 32 }
+    };
+    char key[8];
+    t = pcb_create();
+    ASSERT_NE(NULL, t);
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
+    {
+        size_t key_len = pcb_bits_key(key, (const char *)prefixes[i].addr, prefixes[i].num_bits);
+        ASSERT_EQ(prefixes[i].num_bits / 8 + 1, key_len);
+        ASSERT_EQ(1, pcb_add_len(t, key, key_len));
+    }
+    static const struct { unsigned char addr[4]; size_t num_bits; } queries[] =
+    {
+        { { 11, 0, 0, 1 }, 0 }, { { 10, 2, 0, 1 }, 8 }, { { 10, 1, 3, 1 }, 23 }, { { 10, 1, 2, 1 }, 23 },
+        { { 10, 1, 2, 200 }, 25 }, { { 10, 1, 4, 1 }, 16 }, { { 192, 168, 1, 1 }, 32 }, { { 192, 168, 1, 2 }, 16 }
+    };
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++)
+    {
+        size_t r_bits = SIZE_MAX;
+        ASSERT_NE(NULL, pcb_longest_prefix_bits(t, (const char *)queries[i].addr, 32, &r_bits));
+        ASSERT_EQ(queries[i].num_bits, r_bits);
+    }
+    size_t r_bits = SIZE_MAX;
+    ASSERT_NE(NULL, pcb_longest_prefix_bits(t, "\x0a\x01", 12, &r_bits));
+    ASSERT_EQ(8, r_bits);
+    pcb_destroy(t);
+}